@@ -1,8 +1,13 @@
 #pragma once
 
+#include <fstream>
+#include <iostream>
+
 #include "HistoryArguments.hpp"
 #include "Strategy.hpp"
 #include "TestExchange.hpp"
+#include "BacktestWindows.hpp"
+#include "IndicatorCache.hpp"
 
 #include "../misc/DynLoader.hpp"
 #include "../misc/date_to_sec.hpp"
@@ -26,17 +31,37 @@ public:
         addHelp({ "exchange", "e"}, "Exchange");
         addHelp({ "period-start", "p"}, "Period start");
         addHelp({ "period-end", "r"}, "Period end");
+        addHelp({ "fills", "f"}, "Finer interval resolving the order of limit fills (e.g. 1m)");
+        addHelp({ "fixed-point", "x"}, "Integer fixed-point ledger, decimals of price,quantity[,quoted[,fee]] (e.g. 2,8)");
+        addHelp({ "window-report", "t"}, "Per-window report file (csv) of the windows, default: standard output");
+        addHelp({ "windows", "w"}, "Batch of windows over the period: rolling,<size>,<step> | anchored,<first>,<step> | walk-forward,<train>,<test>[,anchored] (e.g. walk-forward,90d,30d)");
 
         chartfile = get<string>("chartfile"); //get<string>(1);
 
         strategyLib = STRATEGIES_DIR + get<string>("strategy") + LIB_EXT;
         strategy = loadStrategy();
 
+        if (has("fixed-point")) {
+            fixedPoint = true;
+            vector<string> decimals = explode(",", get<string>("fixed-point"));
+            if (decimals.size() < 2 || decimals.size() > 4)
+                throw ERROR("Invalid fixed-point decimals: " + get<string>("fixed-point"));
+            scales.price = stoi(decimals[0]);
+            scales.quantity = stoi(decimals[1]);
+            scales.quoted = decimals.size() > 2 ? stoi(decimals[2]) : scales.quoted;
+            scales.fee = decimals.size() > 3 ? stoi(decimals[3]) : scales.fee;
+        }
+
+        fillInterval = has("fills") ? get<string>("fills") : "";
+
         exchangeLib = EXCHANGES_DIR + get<string>("exchange") + LIB_EXT;
         exchange = loadExchange();
 
         periodStart = has("period-start") ? date_to_sec(get<string>("period-start")) : 0;
         periodEnd = has("period-end") ? date_to_sec(get<string>("period-end")) : get_time_sec();
+
+        if (has("windows")) windows = BacktestWindows::parse(get<string>("windows"), periodStart, periodEnd);
+        windowReport = has("window-report") ? get<string>("window-report") : "";
     }
 
     virtual ~BacktestArguments() {}
@@ -49,14 +74,60 @@ public:
     string getExchangeLib() const { return exchangeLib; }
     TestExchange* getExchange() const { return exchange; }
 
+    bool isFixedPoint() const { return fixedPoint; }
+    const FixedLedger::Scales& getScales() const { return scales; }
+
     Calculation<float>* getCalculation() const { return calculation; }
 
     time_sec getPeriodStart() const { return periodStart; }
     time_sec getPeriodEnd() const { return periodEnd; }
 
-    vector<Candle> loadCandles() const {
+    MappedCandles loadCandles() const {
         return HistoryArguments::loadCandles(periodStart, periodEnd);
     }
+
+    // The candles of the period as a stream, for periods larger than memory
+    // (see BacktestRunner::run(CandleStream&)).
+    unique_ptr<CandleStream> streamCandles(size_t chunk = CandleStream::DEFAULT_CHUNK, size_t buffers = 2) const {
+        return getHistory()->stream(getSymbol(), getInterval(), periodStart, periodEnd, chunk, buffers);
+    }
+
+    // Cache key of an indicator series over the candles of the period, for
+    // IndicatorCache::shared() (e.g. indicatorKey("ema", { 50 })).
+    IndicatorCache::Key indicatorKey(const string& indicator, const vector<double>& params = {}) const {
+        return { getSymbol(), getInterval(), periodStart, periodEnd, indicator, params };
+    }
+
+    // Windows of --windows, empty if not given.
+    const vector<BacktestWindow>& getWindows() const { return windows; }
+
+    // Backtests every window in parallel over the candles of the period
+    // (loaded once), results in the order of the windows.
+    vector<BacktestWindowResult> runWindows(
+        const vector<BacktestWindow>& windows,
+        size_t workers = thread::hardware_concurrency()
+    ) {
+        BacktestWindows::Pool pool(
+            loadCandles(),
+            [this]() { return shared_ptr<Strategy>(loadStrategy(), [](Strategy*) {}); },
+            [this]() { return shared_ptr<TestExchange>(loadExchange(), [](TestExchange*) {}); },
+            BacktestWindows::evaluate, workers
+        );
+        return BacktestWindows::run(pool, windows);
+    }
+
+    // Writes the per-window report (see BacktestWindows::report()) to the
+    // --window-report file, or to the standard output.
+    void reportWindows(const vector<BacktestWindowResult>& results) const {
+        if (windowReport.empty()) {
+            BacktestWindows::report(results, cout);
+            return;
+        }
+        ofstream file(windowReport, ios::trunc);
+        BacktestWindows::report(results, file);
+        file.close();
+        if (!file) throw ERROR("Unable to write: " + windowReport);
+    }
     
 protected:
 
@@ -69,14 +140,32 @@ protected:
     TestExchange* loadExchange() {
         TestExchange* exchange = 
             loader.load<TestExchange>(exchangeLib);
+        if (fixedPoint) exchange->setFixedPoint(scales);
+        if (!fillInterval.empty()) exchange->setIntraCandleResolver(createIntraCandleResolver());
         return exchange;
     }
 
+    // Every exchange gets its own, the resolver caches a window of candles.
+    shared_ptr<IntraCandleResolver> createIntraCandleResolver() const {
+        CandleHistory* history = getHistory();
+        const string symbol = getSymbol();
+        const string interval = fillInterval;
+        return make_shared<IntraCandleResolver>(intervalToSecond(getInterval()),
+            [history, symbol, interval](time_sec from, time_sec to) {
+                return history->loadMapped(symbol, interval, from, to);
+            });
+    }
+
     string chartfile;
     string strategyLib;
     string exchangeLib;
     time_sec periodStart;
     time_sec periodEnd;
+    string fillInterval;
+    bool fixedPoint = false;
+    FixedLedger::Scales scales;
+    vector<BacktestWindow> windows;
+    string windowReport;
     TestExchange* exchange = nullptr;
     Strategy* strategy = nullptr;
     vector<Candle> candles;
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <span>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+#include "Candle.hpp"
+#include "MappedCandles.hpp"
+#include "Strategy.hpp"
+#include "TestExchange.hpp"
+#include "BacktestRunner.hpp"
+#include "PerformanceMetrics.hpp"
+
+using namespace std;
+
+// Evaluates optimizer candidates (parameter sets) in parallel. Every worker
+// thread creates its own strategy and exchange once, from the factories,
+// and reuses them for all its candidates; the candles are one read-only
+// view shared by all workers. A batch is dealt round-robin onto per-worker
+// queues: workers take from the front of their own queue and steal from the
+// back of the others, so uneven candidates do not leave threads idle.
+// A task may return more than a score (Result), see BacktestWindows.
+template<typename Params = vector<double>, typename Result = double>
+class BacktestPool {
+public:
+    typedef function<shared_ptr<Strategy>()> StrategyFactory;
+    typedef function<shared_ptr<TestExchange>()> ExchangeFactory;
+
+    struct Worker {
+        size_t id = 0;
+        shared_ptr<Strategy> strategy;
+        shared_ptr<TestExchange> exchange;
+        unique_ptr<BacktestRunner> runner;
+        TestExchange::State initial; // exchange state as created, see TestExchange::restore()
+        PerformanceMetrics metrics; // fed by the exchange and the runner, reset it per candidate
+    };
+
+    // Sets up the worker's instances for the candidate, runs it, returns its score.
+    typedef function<Result(const Params& params, Worker& worker, span<const Candle> candles)> Evaluate;
+
+    BacktestPool(
+        const MappedCandles& candles,
+        StrategyFactory strategies,
+        ExchangeFactory exchanges,
+        Evaluate evaluate,
+        size_t workers = thread::hardware_concurrency()
+    ):
+        candles(candles),
+        strategies(strategies),
+        exchanges(exchanges),
+        evaluate(evaluate)
+    {
+        workers = workers ? workers : 1;
+        for (size_t i = 0; i < workers; i++) queues.push_back(make_unique<Queue>());
+        for (size_t i = 0; i < workers; i++) threads.emplace_back([this, i]() { work(i); });
+    }
+
+    virtual ~BacktestPool() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (thread& t: threads) t.join();
+    }
+
+    size_t getWorkers() const { return threads.size(); }
+
+    // Scores of the parameter sets, in their order. Blocks until the whole
+    // batch is done; the first exception of a candidate is rethrown.
+    vector<Result> run(const vector<Params>& batch) {
+        vector<Result> scores(batch.size());
+        if (batch.empty()) return scores;
+        {
+            lock_guard<mutex> lock(mtx);
+            remaining = batch.size();
+            error = nullptr;
+            for (size_t i = 0; i < batch.size(); i++) {
+                Queue& queue = *queues[i % queues.size()];
+                lock_guard<mutex> queueLock(queue.mtx);
+                queue.tasks.push_back({ &batch[i], &scores[i] });
+            }
+            generation++;
+        }
+        cv.notify_all();
+        unique_lock<mutex> lock(mtx);
+        done.wait(lock, [this]() { return remaining == 0; });
+        if (error) rethrow_exception(error);
+        return scores;
+    }
+
+private:
+
+    struct Task {
+        const Params* params;
+        Result* score;
+    };
+
+    struct Queue {
+        mutex mtx;
+        deque<Task> tasks;
+    };
+
+    bool take(size_t id, Task& task) {
+        for (size_t k = 0; k < queues.size(); k++) {
+            Queue& queue = *queues[(id + k) % queues.size()];
+            lock_guard<mutex> lock(queue.mtx);
+            if (queue.tasks.empty()) continue;
+            if (k == 0) {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            } else {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void work(size_t id) {
+        Worker worker;
+        worker.id = id;
+        size_t seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> lock(mtx);
+                cv.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            Task task;
+            while (take(id, task)) {
+                try {
+                    if (!worker.runner) {
+                        lock_guard<mutex> lock(factoryMtx); // plugin loading is not thread safe
+                        worker.strategy = strategies();
+                        worker.exchange = exchanges();
+                        worker.runner = make_unique<BacktestRunner>(*worker.strategy, *worker.exchange);
+                        worker.initial = worker.exchange->snapshot();
+                        worker.exchange->setMetrics(&worker.metrics);
+                    }
+                    *task.score = evaluate(*task.params, worker, candles);
+                } catch (...) {
+                    lock_guard<mutex> lock(mtx);
+                    if (!error) error = current_exception();
+                }
+                lock_guard<mutex> lock(mtx);
+                if (--remaining == 0) done.notify_all();
+            }
+        }
+    }
+
+    MappedCandles candles;
+    StrategyFactory strategies;
+    ExchangeFactory exchanges;
+    Evaluate evaluate;
+
+    vector<unique_ptr<Queue>> queues;
+    vector<thread> threads;
+    mutex mtx;
+    mutex factoryMtx;
+    condition_variable cv;
+    condition_variable done;
+    size_t generation = 0;
+    size_t remaining = 0;
+    bool stopping = false;
+    exception_ptr error;
+};
+
+
+#ifdef TEST
+
+TEST(test_BacktestPool_matches_serial_backtests) {
+    vector<Candle> data = BacktestRunner_test_candles(20000);
+    auto evaluate = [](const vector<double>& params, BacktestPool<>::Worker& worker, span<const Candle> candles) {
+        worker.exchange->restore(worker.initial);
+        worker.exchange->setBalance(params[0]);
+        worker.strategy->reset();
+        worker.metrics.reset();
+        worker.runner->run(candles);
+        return (double)worker.exchange->getBalanceTotal() + worker.metrics.getSharpe();
+    };
+    atomic<int> created = 0;
+    BacktestPool<> pool(MappedCandles(vector<Candle>(data)),
+        [&created]() { created++; return make_shared<BacktestRunnerCounterStrategy>(); },
+        []() { return make_shared<BacktestRunnerExchangeMock>(); },
+        evaluate, 4);
+
+    vector<vector<double>> batch;
+    for (int i = 0; i < 40; i++) batch.push_back({ 1000.0 + i * 100 });
+    vector<double> scores = pool.run(batch);
+    vector<double> again = pool.run(batch);
+
+    BacktestPool<>::Worker serial;
+    serial.strategy = make_shared<BacktestRunnerCounterStrategy>();
+    serial.exchange = make_shared<BacktestRunnerExchangeMock>();
+    serial.runner = make_unique<BacktestRunner>(*serial.strategy, *serial.exchange);
+    serial.initial = serial.exchange->snapshot();
+    serial.exchange->setMetrics(&serial.metrics);
+    for (size_t i = 0; i < batch.size(); i++)
+        assert(scores[i] == evaluate(batch[i], serial, data) && "Parallel scores should match serial runs in order");
+    assert(again == scores && "Reused worker instances should give the same scores");
+    assert(created <= 4 && "Each worker should create its instances once");
+}
+
+TEST(test_BacktestPool_steals_uneven_work_and_rethrows) {
+    // The quick candidates wait for the blocking one to start, so the other
+    // workers can not take it from worker 0, then it holds worker 0 until
+    // every other candidate is done: those of its queue can only be stolen.
+    mutex mtx;
+    condition_variable cv;
+    bool blocking = false;
+    size_t finished = 0;
+    const int BLOCK = 0, QUICK = 1;
+    BacktestPool<int> pool(MappedCandles(vector<Candle>()),
+        []() { return make_shared<BacktestRunnerCounterStrategy>(); },
+        []() { return make_shared<BacktestRunnerExchangeMock>(); },
+        [&](const int& candidate, BacktestPool<int>::Worker& worker, span<const Candle>) {
+            if (candidate < 0) throw ERROR("Invalid candidate");
+            unique_lock<mutex> lock(mtx);
+            if (candidate == BLOCK) {
+                blocking = true;
+                cv.notify_all();
+                cv.wait_for(lock, chrono::seconds(10), [&]() { return finished == 28; }); // not forever if nothing is stolen
+            } else {
+                cv.wait(lock, [&]() { return blocking; });
+                if (++finished == 28) cv.notify_all();
+            }
+            return (double)worker.id;
+        }, 4);
+
+    // worker 0's queue gets the blocking candidate and 7 quick ones
+    vector<int> batch(29, QUICK);
+    batch[0] = BLOCK;
+    vector<double> workers = pool.run(batch);
+    assert(workers[0] == 0 && finished == 28 && "The other candidates should finish while worker 0 is busy");
+    for (size_t i = 1; i < batch.size(); i++)
+        assert(workers[i] != 0 && "Queued work of a busy worker should be stolen");
+
+    bool thrown = false;
+    try {
+        pool.run({ QUICK, -1, QUICK });
+    } catch (exception& e) {
+        thrown = string(e.what()).find("Invalid candidate") != string::npos;
+    }
+    assert(thrown && "A failing candidate should be rethrown");
+    assert(pool.run({ QUICK, QUICK }).size() == 2 && finished == 32 && "The pool should stay usable after an error");
+}
+
+#endif
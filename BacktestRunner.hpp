@@ -0,0 +1,334 @@
+#pragma once
+
+#include <span>
+#include <chrono>
+#include <cstdint>
+
+#include "Candle.hpp"
+#include "Strategy.hpp"
+#include "TestExchange.hpp"
+#include "CandleStream.hpp"
+#include "PerformanceMetrics.hpp"
+
+using namespace std;
+
+// Drives a strategy and a test exchange over a candle series.
+// Event order, the same for every tool:
+//   first candle: exchange.setTime/setPrice(close), strategy.onStart
+//   every next candle: exchange.setTime, exchange.setPrice(close),
+//                      exchange.processLimitOrders, strategy.onCandleClose
+// While no limit order is pending, candles are offered to the strategy in
+// batches (Strategy::onCandleBatch); the candles it handles skip the
+// per-candle calls, the exchange is moved to the last of them. Results are
+// the same as with per-candle calls.
+// With exchange metrics (TestExchange::setMetrics()) the equity of every
+// candle is recorded after the strategy saw it, batched candles included.
+// The loop itself does not allocate; the elapsed time is accumulated so the
+// cost per candle can be tracked across runs.
+// Periods larger than memory run from a CandleStream, chunk by chunk with
+// resume(), with the same results as one run() over all the candles.
+class BacktestRunner {
+public:
+    struct Stats {
+        uint64_t candles = 0;
+        uint64_t nanoseconds = 0;
+
+        double nanosPerCandle() const { return candles ? (double)nanoseconds / candles : 0; }
+    };
+
+    BacktestRunner(Strategy& strategy, TestExchange& exchange):
+        strategy(strategy), exchange(exchange)
+    {
+        strategy.setExchange(&exchange);
+    }
+
+    virtual ~BacktestRunner() {}
+
+    // Candles offered to onCandleBatch at once, 0: per-candle calls only.
+    size_t getBatchSize() const { return batchSize; }
+    void setBatchSize(size_t batchSize) { this->batchSize = batchSize; }
+
+    // Returns the number of candles passed to onCandleClose.
+    size_t run(span<const Candle> candles) {
+        if (candles.empty()) return 0;
+        auto start = chrono::steady_clock::now();
+
+        const Candle& first = candles.front();
+        exchange.setTime(first.getTime());
+        exchange.setPrice(first.getClose());
+        strategy.onStart(first);
+        if (exchange.getMetrics()) record(*exchange.getMetrics());
+        stats.nanoseconds += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        return resume(candles.subspan(1));
+    }
+
+    // Every chunk of the stream, the first one as run() does.
+    size_t run(CandleStream& stream) {
+        span<const Candle> candles = stream.next();
+        if (candles.empty()) return 0;
+        size_t closed = run(candles);
+        for (candles = stream.next(); !candles.empty(); candles = stream.next()) closed += resume(candles);
+        return closed;
+    }
+
+    // Continues a run() with the candles after the ones it had (all of
+    // them go to onCandleClose).
+    size_t resume(span<const Candle> candles) {
+        auto start = chrono::steady_clock::now();
+        PerformanceMetrics* metrics = exchange.getMetrics();
+
+        // strategies that handle no batch are offered one less and less often
+        size_t backoff = 0;
+        size_t wait = 0;
+        for (size_t i = 0; i < candles.size();) {
+            if (batchSize && !wait && !exchange.getPendingOrderCount()) {
+                const size_t size = min(batchSize, candles.size() - i);
+                const size_t handled = min(strategy.onCandleBatch(candles.subspan(i, size)), size);
+                if (handled) {
+                    if (metrics) record(*metrics, candles.subspan(i, handled));
+                    i += handled;
+                    exchange.setTime(candles[i - 1].getTime());
+                    exchange.setPrice(candles[i - 1].getClose());
+                    backoff = 0;
+                } else wait = backoff = min<size_t>(backoff ? 2 * backoff : 1, 64);
+                if (handled == size) continue;
+            } else if (wait) wait--;
+            step(candles[i++]);
+            if (metrics) record(*metrics);
+        }
+
+        stats.candles += candles.size();
+        stats.nanoseconds += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        return candles.size();
+    }
+
+    const Stats& getStats() const { return stats; }
+    void resetStats() { stats = Stats(); }
+
+protected:
+
+    void step(const Candle& candle) {
+        exchange.setTime(candle.getTime());
+        exchange.setPrice(candle.getClose());
+        exchange.processLimitOrders(candle);
+        strategy.onCandleClose(candle);
+    }
+
+    void record(PerformanceMetrics& metrics) {
+        metrics.onEquity(exchange.getEquity(), exchange.isExposed());
+    }
+
+    // Candles the strategy handled in a batch: nothing traded, the equity
+    // only follows the close.
+    void record(PerformanceMetrics& metrics, span<const Candle> candles) {
+        for (const Candle& candle: candles) {
+            exchange.setPrice(candle.getClose());
+            record(metrics);
+        }
+    }
+
+    Strategy& strategy;
+    TestExchange& exchange;
+    Stats stats;
+    size_t batchSize = 4096;
+};
+
+
+#ifdef TEST
+
+// Records the callbacks it gets; trades at fixed candles.
+class BacktestRunnerStrategyMock: public Strategy {
+public:
+    vector<string> events;
+
+    void onStart(const Candle& candle) override {
+        events.push_back("start " + to_string(candle.getTime()));
+    }
+
+    void onCandleClose(const Candle& candle) override {
+        events.push_back("close " + to_string(candle.getTime()) + " pending " + to_string(exchange->getPendingOrderCount()));
+        if (candle.getTime() == 2) (void)exchange->buyLimit(100, 5);
+    }
+};
+
+class BacktestRunnerExchangeMock: public TestExchange {
+public:
+    BacktestRunnerExchangeMock(bool throwsOnError = true): TestExchange(false, false, throwsOnError) {
+        balance = 1000;
+        asset = 0;
+    }
+
+    uint32_t getTime() override { return time; }
+    float getPrice() override { return price; }
+};
+
+// Minute candles of a price oscillating around 100, shared by the runner,
+// pool and windows tests.
+inline vector<Candle> BacktestRunner_test_candles(int count) {
+    vector<Candle> candles;
+    candles.reserve(count);
+    for (int i = 0; i < count; i++) {
+        float price = 100 + 10 * sin(i / 50.0f);
+        candles.push_back(Candle(i * 60, price, price * 1.02f, price * 0.98f, price, 1));
+    }
+    return candles;
+}
+
+// Counter strategy in the shape of Strategy1, with a limit order in each cycle.
+class BacktestRunnerCounterStrategy: public Strategy {
+public:
+    bool batching = true;
+    int i = 0;
+
+    void onStart(const Candle&) override {}
+
+    void reset() override { i = 0; }
+
+    Strategy* clone() const override { return new BacktestRunnerCounterStrategy(*this); }
+
+    void onCandleClose(const Candle& candle) override {
+        i++;
+        if (i == 100) (void)exchange->buy(exchange->getBalanceFree() / 20);
+        if (i == 150) (void)exchange->sellLimit(exchange->getAssetUsed() / 4, candle.getClose() * 1.01f);
+        if (i == 200) (void)exchange->sell(exchange->getAssetUsed() / 2);
+        if (i == 300) i = 0;
+    }
+
+    size_t onCandleBatch(span<const Candle> candles) override {
+        if (!batching) return 0;
+        size_t handled = 0;
+        for (; handled < candles.size(); handled++) {
+            int next = i + 1;
+            if (next == 100 || next == 150 || next == 200) break;
+            i = next == 300 ? 0 : next;
+        }
+        return handled;
+    }
+};
+
+TEST(test_BacktestRunner_event_order) {
+    vector<Candle> candles = {
+        Candle(1, 10, 11, 9, 10, 1), Candle(2, 10, 11, 9, 10, 1),
+        Candle(3, 10, 11, 9, 10, 1), Candle(4, 10, 11, 4, 10, 1)
+    };
+    BacktestRunnerStrategyMock strategy;
+    BacktestRunnerExchangeMock exchange;
+    BacktestRunner runner(strategy, exchange);
+    assert(runner.run(candles) == 3 && "Every candle after the first should close");
+    assert((strategy.events == vector<string>{ "start 1", "close 2 pending 0", "close 3 pending 1", "close 4 pending 0" }) &&
+           "Limit orders should be processed before the strategy sees the candle");
+    assert(exchange.getTime() == 4 && exchange.getPrice() == 10 && abs(exchange.getAsset() - 20) < 0.001f &&
+           "Exchange should follow the candles and fill the order");
+}
+
+// Allocations of the loop and the orders: tests/allocations.cpp
+TEST(test_BacktestRunner_orders_return_result_codes) {
+    BacktestRunnerExchangeMock exchange(false); // rejections are not reported
+    exchange.setPrice(10);
+    OrderResult rejected = exchange.buy(5000);
+    OrderResult accepted = exchange.buyLimit(100, 9);
+    OrderResult invalid = exchange.sell(-1);
+    assert(!rejected && rejected.status == OrderStatus::INSUFFICIENT_BALANCE && accepted && "Result codes should tell the outcome");
+    assert(invalid.status == OrderStatus::INVALID_AMOUNT && invalid.side == OrderSide::SELL && "Rejection should keep the order");
+    assert(rejected.message() == "BUY quoted: 5000.000000 (failed): Insufficient balance: 5000.000000 > 1000.000000" &&
+           "Message should be formatted on demand");
+}
+
+TEST(test_BacktestRunner_records_metrics_in_batches_too) {
+    vector<Candle> candles = BacktestRunner_test_candles(20000);
+    auto backtest = [&candles](size_t batchSize) {
+        BacktestRunnerCounterStrategy strategy;
+        BacktestRunnerExchangeMock exchange;
+        PerformanceMetrics metrics;
+        exchange.setMetrics(&metrics);
+        BacktestRunner runner(strategy, exchange);
+        runner.setBatchSize(batchSize);
+        runner.run(candles);
+        return metrics;
+    };
+    PerformanceMetrics single = backtest(0);
+    PerformanceMetrics batched = backtest(4096);
+    assert(single.getCandles() == candles.size() && single.getFills() > 0 && single.getTrades() > 0 && "Every candle and fill should be recorded");
+    assert(batched.getCandles() == single.getCandles() && batched.getFills() == single.getFills() &&
+           batched.getSharpe() == single.getSharpe() && batched.getMaxDrawdown() == single.getMaxDrawdown() &&
+           batched.getWinRate() == single.getWinRate() && batched.getExposure() == single.getExposure() &&
+           "Batched candles should give the same metrics");
+    assert(single.getMaxDrawdown() > 0 && single.getExposure() > 0 && "Metrics should follow the account");
+}
+
+// Places a buy limit far below the price, cancels it later.
+class BacktestRunnerCancellingStrategy: public Strategy {
+public:
+    void onStart(const Candle&) override {}
+
+    void onCandleClose(const Candle& candle) override {
+        if (candle.getTime() == 2) (void)exchange->buyLimit(400, 1);
+        if (candle.getTime() == 3) (void)exchange->sellLimit(exchange->getAssetUsed() / 2, 1000);
+        if (candle.getTime() == 5) exchange->cancelAllOrders();
+    }
+};
+
+TEST(test_BacktestRunner_equity_includes_pending_orders) {
+    vector<Candle> candles;
+    for (int i = 1; i <= 7; i++) candles.push_back(Candle(i, 10, 11, 9, 10, 1));
+    BacktestRunnerCancellingStrategy strategy;
+    BacktestRunnerExchangeMock exchange;
+    exchange.setAsset(10);
+    PerformanceMetrics metrics;
+    exchange.setMetrics(&metrics);
+    BacktestRunner runner(strategy, exchange);
+    runner.run(candles);
+    assert(metrics.getCandles() == 7 && metrics.getReturn() == 0 && metrics.getMaxDrawdown() == 0 && metrics.getVolatility() == 0 &&
+           "Reserved cash and asset should stay in the equity while the orders are pending");
+    assert(metrics.getExposure() == 1 && "Asset in a pending sell is still held");
+    assert(exchange.getEquity() == exchange.getBalanceTotal() && exchange.getEquity() == 1100 && "Cancelling should give everything back");
+
+    exchange.setFixedPoint(FixedLedger::Scales());
+    (void)exchange.buyLimit(400, 1);
+    (void)exchange.sellLimit(5, 1000);
+    assert(exchange.getEquity() == 1100 && exchange.getBalanceTotal() < 1100 && "The fixed-point ledger should count reservations too");
+}
+
+TEST(test_BacktestRunner_batches_match_per_candle_calls) {
+    vector<Candle> candles = BacktestRunner_test_candles(200000);
+    auto backtest = [&candles](bool batching, size_t batchSize, BacktestRunner::Stats& stats) {
+        BacktestRunnerCounterStrategy strategy;
+        strategy.batching = batching;
+        BacktestRunnerExchangeMock exchange;
+        BacktestRunner runner(strategy, exchange);
+        runner.setBatchSize(batchSize);
+        runner.run(candles);
+        stats = runner.getStats();
+        return make_tuple(exchange.getBalance(), exchange.getAsset(), exchange.getPendingOrderCount(),
+            exchange.getTime(), exchange.getPrice(), strategy.i);
+    };
+    BacktestRunner::Stats single, batched, small;
+    auto expected = backtest(false, 0, single);
+    assert(backtest(true, 4096, batched) == expected && "Batches should give bit-identical results");
+    assert(backtest(true, 7, small) == expected && "Batch boundaries should not change the results");
+    assert(single.candles == batched.candles && batched.candles == small.candles && "Stats should count every candle");
+}
+
+
+TEST(test_BacktestRunner_streamed_period_matches_loaded_one) {
+    vector<Candle> candles = BacktestRunner_test_candles(50000);
+    const string file = CandleFile_test_file("runner-stream");
+    CandleFile::save(file, candles, "BTCUSDT", "1m");
+
+    auto backtest = [&](CandleStream* stream) {
+        BacktestRunnerCounterStrategy strategy;
+        BacktestRunnerExchangeMock exchange;
+        PerformanceMetrics metrics;
+        exchange.setMetrics(&metrics);
+        BacktestRunner runner(strategy, exchange);
+        size_t closed = stream ? runner.run(*stream) : runner.run(candles);
+        return make_tuple(closed, exchange.getBalance(), exchange.getAsset(), exchange.getPendingOrderCount(),
+            exchange.getTime(), strategy.i, metrics.getCandles(), metrics.getSharpe(), metrics.getMaxDrawdown());
+    };
+    auto expected = backtest(nullptr);
+    CandleStream stream(CandleStream::fileReader(file, 0, 49999 * 60), 4096, 3);
+    assert(backtest(&stream) == expected && "Chunks should give the same results as one loaded period");
+    assert(stream.getStats().chunks == (candles.size() + 4095) / 4096 && "Stream should be read in chunks");
+}
+
+#endif
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+
+#include "../misc/ERROR.hpp"
+#include "../misc/sec_to_datetime.hpp"
+#include "Candle.hpp"
+#include "MappedCandles.hpp"
+#include "BacktestPool.hpp"
+#include "PerformanceMetrics.hpp"
+
+using namespace std;
+
+// A period of the loaded candles, [start, end] inclusive. Walk-forward
+// folds come as a train and a test window with the same fold number.
+struct BacktestWindow {
+    time_sec start = 0;
+    time_sec end = 0;
+    int fold = -1;     // walk-forward fold, -1: none
+    bool test = false; // the out-of-sample part of the fold
+
+    bool operator==(const BacktestWindow&) const = default;
+};
+
+// Outcome of one window.
+struct BacktestWindowResult {
+    BacktestWindow window;
+    size_t candles = 0;
+    float balanceTotal = 0;
+    PerformanceMetrics metrics;
+};
+
+// Many backtests over windows of one loaded dataset: the windows are views
+// (binary searched slices) of the shared candles, no window reloads or
+// copies anything, and they run in parallel on a BacktestPool whose
+// workers reuse their strategy and exchange (restored, reset) per window.
+class BacktestWindows {
+public:
+    typedef BacktestPool<BacktestWindow, BacktestWindowResult> Pool;
+
+    // Fixed size windows every `step` seconds; the last one ends at or before `to`.
+    static vector<BacktestWindow> rolling(time_sec from, time_sec to, time_sec size, time_sec step) {
+        check(size, step);
+        vector<BacktestWindow> windows;
+        for (time_sec start = from; start + size - 1 <= to; start += step)
+            windows.push_back({ start, start + size - 1 });
+        return windows;
+    }
+
+    // Windows from `from`, the first `first` seconds long, growing by `step`.
+    static vector<BacktestWindow> anchored(time_sec from, time_sec to, time_sec first, time_sec step) {
+        check(first, step);
+        vector<BacktestWindow> windows;
+        for (time_sec end = from + first - 1; end <= to; end += step)
+            windows.push_back({ from, end });
+        return windows;
+    }
+
+    // Train/test pairs stepping by the test size: the test windows tile the
+    // period after the first train window. Anchored: train windows all
+    // start at `from`.
+    static vector<BacktestWindow> walkForward(
+        time_sec from, time_sec to, time_sec train, time_sec test, bool anchored = false
+    ) {
+        check(train, test);
+        vector<BacktestWindow> windows;
+        int fold = 0;
+        for (time_sec start = from + train; start + test - 1 <= to; start += test, fold++) {
+            windows.push_back({ anchored ? from : start - train, start - 1, fold, false });
+            windows.push_back({ start, start + test - 1, fold, true });
+        }
+        return windows;
+    }
+
+    // Duration like "90d", "12h", "2w", "30m" or "45s" in seconds.
+    static time_sec duration(const string& text) {
+        static const string units = "smhdw";
+        static const time_sec seconds[] = { 1, 60, 60 * 60, 24 * 60 * 60, 7 * 24 * 60 * 60 };
+        size_t digits = 0;
+        while (digits < text.size() && isdigit((unsigned char)text[digits])) digits++;
+        if (!digits || digits + 1 != text.size() || units.find(text.back()) == string::npos)
+            throw ERROR("Invalid duration: '" + text + "'");
+        return stoll(text.substr(0, digits)) * seconds[units.find(text.back())];
+    }
+
+    // Windows from a spec: "rolling,<size>,<step>", "anchored,<first>,<step>"
+    // or "walk-forward,<train>,<test>[,anchored]", durations as above.
+    static vector<BacktestWindow> parse(const string& spec, time_sec from, time_sec to) {
+        vector<string> parts;
+        for (size_t begin = 0, comma; begin <= spec.size(); begin = comma + 1) {
+            comma = spec.find(',', begin);
+            if (comma == string::npos) comma = spec.size();
+            parts.push_back(spec.substr(begin, comma - begin));
+        }
+        if (parts.size() == 3 && parts[0] == "rolling")
+            return rolling(from, to, duration(parts[1]), duration(parts[2]));
+        if (parts.size() == 3 && parts[0] == "anchored")
+            return anchored(from, to, duration(parts[1]), duration(parts[2]));
+        if ((parts.size() == 3 || (parts.size() == 4 && parts[3] == "anchored")) && parts[0] == "walk-forward")
+            return walkForward(from, to, duration(parts[1]), duration(parts[2]), parts.size() == 4);
+        throw ERROR("Invalid windows: '" + spec + "'");
+    }
+
+    // Backtest of one window on a pool worker, from the worker's initial
+    // exchange state and a reset strategy.
+    static BacktestWindowResult evaluate(const BacktestWindow& window, Pool::Worker& worker, span<const Candle> candles) {
+        span<const Candle> slice = MappedCandles::range(candles, window.start, window.end);
+        worker.exchange->restore(worker.initial);
+        worker.strategy->reset();
+        worker.metrics.reset();
+        BacktestWindowResult result;
+        result.window = window;
+        result.candles = slice.size();
+        if (slice.empty()) return result;
+        worker.runner->run(slice);
+        result.balanceTotal = worker.exchange->getBalanceTotal();
+        result.metrics = worker.metrics;
+        return result;
+    }
+
+    // Results in the order of the windows.
+    static vector<BacktestWindowResult> run(Pool& pool, const vector<BacktestWindow>& windows) {
+        return pool.run(windows);
+    }
+
+    // Csv report, one row per window: the window, its candles, final
+    // balance and metrics (per candle, not annualized).
+    static void report(const vector<BacktestWindowResult>& results, ostream& out) {
+        out << "start,end,fold,part,candles,balance,return,max_drawdown,volatility,sharpe,sortino,trades,win_rate,exposure\n";
+        for (const BacktestWindowResult& result: results) {
+            const BacktestWindow& window = result.window;
+            const PerformanceMetrics& metrics = result.metrics;
+            out << sec_to_datetime(window.start) << "," << sec_to_datetime(window.end) << ","
+                << (window.fold < 0 ? "" : to_string(window.fold)) << ","
+                << (window.fold < 0 ? "" : window.test ? "test" : "train") << ","
+                << result.candles << "," << result.balanceTotal << ","
+                << metrics.getReturn() << "," << metrics.getMaxDrawdown() << "," << metrics.getVolatility() << ","
+                << metrics.getSharpe() << "," << metrics.getSortino() << ","
+                << metrics.getTrades() << "," << metrics.getWinRate() << "," << metrics.getExposure() << "\n";
+        }
+    }
+
+private:
+
+    static void check(time_sec size, time_sec step) {
+        if (size <= 0 || step <= 0)
+            throw ERROR("Invalid window size or step: " + to_string(size) + ", " + to_string(step));
+    }
+};
+
+
+#ifdef TEST
+
+#include <sstream>
+#include <algorithm>
+
+TEST(test_BacktestWindows_generators) {
+    const time_sec day = 24 * 60 * 60;
+    vector<BacktestWindow> rolling = BacktestWindows::rolling(0, 10 * day - 1, 4 * day, 3 * day);
+    assert(rolling.size() == 3 && rolling[2].start == 6 * day && rolling[2].end == 10 * day - 1 && "Rolling windows should fit the period");
+
+    vector<BacktestWindow> anchored = BacktestWindows::anchored(0, 10 * day - 1, 4 * day, 3 * day);
+    assert(anchored.size() == 3 && anchored[2].start == 0 && anchored[2].end == 10 * day - 1 && "Anchored windows should grow");
+
+    vector<BacktestWindow> folds = BacktestWindows::parse("walk-forward,4d,2d", 0, 10 * day - 1);
+    assert(folds.size() == 6 && "Three folds of train and test windows");
+    assert((folds[2] == BacktestWindow{ 2 * day, 6 * day - 1, 1, false }) && (folds[3] == BacktestWindow{ 6 * day, 8 * day - 1, 1, true }) &&
+           "Test windows should follow their train windows");
+    assert(BacktestWindows::parse("walk-forward,4d,2d,anchored", 0, 10 * day - 1)[4].start == 0 && "Anchored folds train from the start");
+    assert(BacktestWindows::duration("2w") == 14 * day && BacktestWindows::duration("90m") == 90 * 60 && "Durations");
+
+    bool thrown = false;
+    try {
+        BacktestWindows::parse("rolling,4x,1d", 0, day);
+    } catch (exception&) {
+        thrown = true;
+    }
+    assert(thrown && "Invalid specs should be reported");
+}
+
+TEST(test_BacktestWindows_runs_windows_over_one_dataset) {
+    vector<Candle> data = BacktestRunner_test_candles(30000);
+    BacktestWindows::Pool pool(MappedCandles(vector<Candle>(data)),
+        []() { return make_shared<BacktestRunnerCounterStrategy>(); },
+        []() { return make_shared<BacktestRunnerExchangeMock>(); },
+        BacktestWindows::evaluate, 4);
+    vector<BacktestWindow> windows = BacktestWindows::walkForward(0, 30000 * 60 - 1, 10000 * 60, 5000 * 60);
+    windows.push_back({ 40000 * 60, 50000 * 60 }); // after the data
+    vector<BacktestWindowResult> results = BacktestWindows::run(pool, windows);
+
+    assert(results.size() == windows.size() && results[1].window == windows[1] && "Results should come in window order");
+    assert(results.back().candles == 0 && results.back().balanceTotal == 0 && "Empty windows should give empty results");
+    for (size_t i = 0; i + 1 < windows.size(); i++) {
+        BacktestRunnerCounterStrategy strategy;
+        BacktestRunnerExchangeMock exchange;
+        BacktestRunner runner(strategy, exchange);
+        span<const Candle> slice = MappedCandles::range(data, windows[i].start, windows[i].end);
+        runner.run(slice);
+        assert(results[i].candles == slice.size() && results[i].balanceTotal == exchange.getBalanceTotal() &&
+               "Every window should match a separate backtest of its slice");
+        assert(results[i].metrics.getCandles() == slice.size() && "Every window should have its own metrics");
+    }
+
+    stringstream report;
+    BacktestWindows::report(results, report);
+    vector<string> rows;
+    for (string row; getline(report, row);) rows.push_back(row);
+    assert(rows.size() == windows.size() + 1 && rows[0].starts_with("start,end,fold,part,candles,") && "A header and a row per window");
+    assert(rows[2].starts_with(sec_to_datetime(windows[1].start) + "," + sec_to_datetime(windows[1].end) + ",0,test," +
+           to_string(results[1].candles) + ",") && "Rows should follow the windows");
+    assert(rows.back().find(",,,0,") != string::npos && "Windows outside folds leave the fold empty");
+    for (const string& row: rows)
+        assert(count(row.begin(), row.end(), ',') == 13 && "Every row should have every column");
+}
+
+#endif
@@ -0,0 +1,560 @@
+#pragma once
+
+#include <ctime>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "../misc/Curl.hpp"
+#include "../misc/ERROR.hpp"
+#include "../misc/datetime_to_sec.hpp"
+#include "../misc/get_time_sec.hpp"
+#include "../misc/str_contains.hpp"
+#include "Candle.hpp"
+#include "BinanceKlineManifest.hpp"
+#include "KlineCsvParser.hpp"
+#include "OrderedWorkerPool.hpp"
+#include "S3ListingParser.hpp"
+#include "Sha256.hpp"
+#include "ZipArchive.hpp"
+
+using namespace std;
+
+// Lists and downloads the daily kline archives of data.binance.vision.
+// Days are fetched and decoded concurrently by a bounded worker pool
+// (each worker with its own connection) and merged back in date order.
+// sync() builds the daily URLs straight from the last stored candle and
+// only lists the bucket when there is no history yet or a gap shows up.
+// Every archive is checked against its published .CHECKSUM (SHA-256,
+// hashed by the worker while the archive streams in) before its candles
+// are merged; repair() re-fetches only the days whose checksum changed.
+// A key that is not published (S3's NoSuchKey answer) is a missing day;
+// failed requests and other error answers are retried, then thrown.
+class BinanceKlineDownloader {
+public:
+    typedef Curl::StreamCallback Chunk;
+    // GETs the url passing the body to `chunk` as it arrives, returns false on failure.
+    typedef function<bool(const string& url, Chunk chunk)> Fetcher;
+    // Creates one fetcher per worker, so workers do not share connections.
+    typedef function<Fetcher()> FetcherFactory;
+    // Turns a downloaded archive into candles.
+    typedef function<vector<Candle>(const string& zip, const string& name)> Decoder;
+
+    struct Archive {
+        string key;  // data/spot/daily/klines/<symbol>/<interval>/<symbol>-<interval>-<date>.zip
+        string date;
+        time_sec time;
+    };
+
+    enum class Status { FOUND, MISSING, FAILED };
+
+    // A fetched day: FAILED when the archive did not match its checksum.
+    struct Day {
+        Status status = Status::MISSING;
+        string checksum; // SHA-256 the archive was verified against
+        vector<Candle> candles;
+    };
+
+    typedef function<void(const Archive&, const Day&)> OnArchive;
+
+    static const time_sec DAY = 24 * 60 * 60;
+    static const int ATTEMPTS = 2; // requests per file before a failure or mismatch is final
+
+    BinanceKlineDownloader(
+        size_t workers = 8,
+        FetcherFactory fetchers = curlFetchers(),
+        const string& listUrl = "https://s3-ap-northeast-1.amazonaws.com/data.binance.vision",
+        const string& dataUrl = "https://data.binance.vision"
+    ):
+        workers(workers),
+        fetchers(fetchers),
+        listUrl(listUrl),
+        dataUrl(dataUrl),
+        decoder(inflate)
+    {}
+
+    virtual ~BinanceKlineDownloader() {}
+
+    static FetcherFactory curlFetchers() {
+        return []() -> Fetcher {
+            shared_ptr<Curl> curl = make_shared<Curl>();
+            return [curl](const string& url, Chunk chunk) {
+                return curl->GET(url, chunk);
+            };
+        };
+    }
+
+    void setDecoder(Decoder decoder) { this->decoder = decoder; }
+
+    static string prefix(const string& symbol, const string& interval) {
+        return "data/spot/daily/klines/" + symbol + "/" + interval + "/";
+    }
+
+    static string date(time_sec time) {
+        time_t t = time;
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        char buffer[16];
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d", &tm);
+        return buffer;
+    }
+
+    static Archive archive(const string& symbol, const string& interval, time_sec day) {
+        const string d = date(day);
+        return { prefix(symbol, interval) + symbol + "-" + interval + "-" + d + ".zip", d, day };
+    }
+
+    // Brings the history up to yesterday: new candles after `last`, in order.
+    // Common case: the missing days are fetched by URL without listing.
+    // Days the manifest knows as gaps are skipped; an unknown gap (a day
+    // missing before one that exists) falls back to a listing. Trailing
+    // missing days are not published yet and are left for the next run.
+    // A day failing verification stops the sync there too and is recorded
+    // as failed in the manifest, so no unverified candles get stored.
+    // A day that can not be fetched (the request fails ATTEMPTS times) is
+    // not taken for unpublished: the sync throws and the next run resumes.
+    vector<Candle> sync(
+        const string& symbol, const string& interval, time_sec last,
+        BinanceKlineManifest& manifest, OnArchive onArchive = nullptr,
+        time_sec now = get_time_sec()
+    ) {
+        vector<Candle> candles;
+        auto merge = [&](const Archive& archive, const Day& day) {
+            if (onArchive) onArchive(archive, day);
+            manifest.add(archive.date, day.checksum);
+            candles.insert(candles.end(), day.candles.begin(), day.candles.end());
+        };
+
+        if (last) {
+            vector<Archive> days;
+            const time_sec today = now - now % DAY;
+            for (time_sec day = last - last % DAY + DAY; day < today; day += DAY) {
+                Archive next = archive(symbol, interval, day);
+                if (!manifest.isKnownGap(next.date)) days.push_back(next);
+            }
+            bool stopped = false;
+            bool failed = false;
+            bool gap = false;
+            fetch(days, [&](size_t i, Day& day) {
+                if (day.status == Status::FAILED) manifest.fail(days[i].date);
+                if (!stopped && day.status == Status::FOUND) merge(days[i], day);
+                else if (!stopped) {
+                    stopped = true;
+                    failed = day.status == Status::FAILED;
+                } else if (!failed && day.status == Status::FOUND) gap = true;
+            });
+            if (!gap) return candles;
+            if (!candles.empty()) last = candles.back().getTime();
+        }
+
+        vector<Archive> archives = list(symbol, interval, last);
+        if (!archives.empty()) manifest.setListedUntil(archives.back().date);
+        download(archives, merge);
+        return candles;
+    }
+
+    // Streams the bucket listing page by page and collects the archives of days after `after`.
+    vector<Archive> list(const string& symbol, const string& interval, time_sec after) {
+        const string url = listUrl + "?delimiter=/&prefix=" + prefix(symbol, interval);
+        const string name = prefix(symbol, interval) + symbol + "-" + interval + "-";
+        const string checksum = ".zip.CHECKSUM";
+        Fetcher fetch = fetchers();
+        vector<Archive> archives;
+        string marker;
+        while (true) {
+            S3ListingParser parser([&](const string& key) {
+                if (!key.ends_with(checksum) || !key.starts_with(name)) return;
+                const string date = key.substr(name.size(), key.size() - name.size() - checksum.size());
+                time_sec time = datetime_to_sec(date);
+                if (!after || time > after)
+                    archives.push_back({ key.substr(0, key.size() - checksum.size() + 4), date, time });
+            });
+            if (!fetch(url + "&marker=" + marker, [&parser](const string& chunk) { parser.feed(chunk); }))
+                throw ERROR("Unable to GET: " + url + "&marker=" + marker);
+            if (!parser.isTruncated() || parser.getNextMarker().empty() || parser.getNextMarker() == marker) break;
+            marker = parser.getNextMarker();
+        }
+        return archives;
+    }
+
+    // Fetches, verifies and decodes the archives concurrently, returns their
+    // candles in archive order. `onArchive` is called in order as each day is merged.
+    vector<Candle> download(const vector<Archive>& archives, OnArchive onArchive = nullptr) {
+        vector<Candle> candles;
+        fetch(archives, [&](size_t i, Day& day) {
+            const string url = dataUrl + "/" + archives[i].key;
+            if (day.status == Status::MISSING) throw ERROR("Unable to GET: " + url);
+            if (day.status == Status::FAILED) throw ERROR("Checksum mismatch: " + url);
+            if (onArchive) onArchive(archives[i], day);
+            candles.insert(candles.end(), day.candles.begin(), day.candles.end());
+        });
+        return candles;
+    }
+
+    // Compares the recorded days with the published checksums (a few bytes
+    // per day) and re-fetches only the days whose checksum changed, which
+    // failed, or which were stored before verification. Returns the candles
+    // of the re-fetched days in date order; they replace the stored ones.
+    vector<Candle> repair(
+        const string& symbol, const string& interval,
+        BinanceKlineManifest& manifest, OnArchive onArchive = nullptr
+    ) {
+        vector<Archive> known;
+        for (const auto& [date, checksum]: manifest.getArchives())
+            known.push_back(archive(symbol, interval, datetime_to_sec(date)));
+        for (const string& date: manifest.getFailed())
+            known.push_back(archive(symbol, interval, datetime_to_sec(date)));
+        sort(known.begin(), known.end(), [](const Archive& a, const Archive& b) { return a.time < b.time; });
+
+        vector<Archive> stale;
+        OrderedWorkerPool<string> pool(workers);
+        vector<Fetcher> fetches;
+        for (size_t i = 0; i < pool.getWorkers(); i++) fetches.push_back(fetchers());
+        pool.run(known.size(), [&](size_t i, size_t worker) {
+            return checksum(fetches[worker], dataUrl + "/" + known[i].key);
+        }, [&](size_t i, string& published) {
+            // not published (any more): nothing to compare with, keep the stored day
+            if (!published.empty() && published != manifest.getChecksum(known[i].date)) stale.push_back(known[i]);
+        });
+
+        vector<Candle> candles;
+        fetch(stale, [&](size_t i, Day& day) {
+            if (day.status == Status::FAILED) manifest.fail(stale[i].date);
+            if (day.status != Status::FOUND) return;
+            if (onArchive) onArchive(stale[i], day);
+            manifest.add(stale[i].date, day.checksum);
+            candles.insert(candles.end(), day.candles.begin(), day.candles.end());
+        });
+        return candles;
+    }
+
+    // Concurrent fetch, verification and decode; `consume` gets the days in
+    // order. A day without a published checksum is MISSING (not out yet),
+    // one that still does not match after ATTEMPTS downloads is FAILED; one
+    // whose requests keep failing throws.
+    void fetch(
+        const vector<Archive>& archives,
+        function<void(size_t i, Day& day)> consume
+    ) {
+        OrderedWorkerPool<Day> pool(workers);
+        vector<Fetcher> fetches;
+        for (size_t i = 0; i < pool.getWorkers(); i++) fetches.push_back(fetchers());
+        pool.run(archives.size(), [&](size_t i, size_t worker) {
+            const string url = dataUrl + "/" + archives[i].key;
+            Day day;
+            const string expected = checksum(fetches[worker], url);
+            if (expected.empty()) return day;
+            bool failed = false; // the last request
+            for (int attempt = 0; attempt < ATTEMPTS; attempt++) {
+                string zip;
+                Sha256 sha;
+                bool fetched = fetches[worker](url, [&zip, &sha](const string& chunk) {
+                    zip += chunk;
+                    sha.update(chunk);
+                });
+                failed = !fetched || (isErrorResponse(zip) && !isNotFound(zip));
+                if (failed) continue;
+                if (isNotFound(zip)) {
+                    day.status = Status::MISSING;
+                    return day;
+                }
+                day.status = Status::FAILED;
+                if (sha.hex() != expected) continue;
+                day.status = Status::FOUND;
+                day.checksum = expected;
+                day.candles = decoder(zip, archives[i].key);
+                return day;
+            }
+            if (failed) throw ERROR("Unable to GET: " + url);
+            return day;
+        }, [&](size_t i, Day& day) {
+            consume(i, day);
+        });
+    }
+
+    // Published SHA-256 of the archive at `url` ("<hex>  <file name>"),
+    // empty when there is none; throws when it can not be fetched.
+    static string checksum(Fetcher& fetch, const string& url) {
+        string body;
+        for (int attempt = 0; attempt < ATTEMPTS; attempt++) {
+            body.clear();
+            bool fetched = fetch(url + ".CHECKSUM", [&body](const string& chunk) { body += chunk; });
+            if (!fetched || (isErrorResponse(body) && !isNotFound(body))) continue;
+            if (isNotFound(body)) return "";
+            const string hex = body.substr(0, body.find_first_of(" \t\r\n"));
+            if (hex.size() != 64 || hex.find_first_not_of("0123456789abcdef") != string::npos) return "";
+            return hex;
+        }
+        throw ERROR("Unable to GET: " + url + ".CHECKSUM");
+    }
+
+    // Default decoder: inflates the csv of the archive in memory and parses
+    // it while inflating, no temp files or extra copies of the text.
+    static vector<Candle> inflate(const string& zip, const string& name) {
+        vector<Candle> candles;
+        candles.reserve(86400); // a day of 1s candles at most
+        ZipArchive archive(zip);
+        for (const ZipArchive::Entry& entry: archive.getEntries()) {
+            if (!str_contains(entry.name, ".csv")) continue;
+            KlineCsvParser parser;
+            archive.stream(entry, [&](const char* data, size_t size) {
+                parser.feed(data, size, candles);
+            });
+            parser.finish(candles);
+            return candles;
+        }
+        throw ERROR("No csv in archive: " + name);
+    }
+
+protected:
+
+    // S3 answers errors with an XML error document.
+    static bool isErrorResponse(const string& body) {
+        return body.compare(0, 5, "<?xml") == 0 || body.compare(0, 7, "<Error>") == 0;
+    }
+
+    // The 404 of S3: the key is not published (AccessDenied when listing
+    // is not allowed), as opposed to a server error worth retrying.
+    static bool isNotFound(const string& body) {
+        return isErrorResponse(body) && (str_contains(body, "<Code>NoSuchKey</Code>") || str_contains(body, "<Code>AccessDenied</Code>"));
+    }
+
+    size_t workers;
+    FetcherFactory fetchers;
+    string listUrl;
+    string dataUrl;
+    Decoder decoder;
+};
+
+
+#ifdef TEST
+
+#include <map>
+#include <mutex>
+
+// Local stand-in for the listing and data hosts, serving fixtures by URL
+// in process (no HTTP): unknown keys get S3's 404 document, `failures`
+// make the first requests of a URL fail like a dropped connection.
+class BinanceKlineStandIn {
+public:
+    map<string, string> files;
+    map<string, int> failures;
+    vector<string> requests;
+    mutex mtx;
+
+    BinanceKlineDownloader::FetcherFactory fetchers() {
+        return [this]() -> BinanceKlineDownloader::Fetcher {
+            return [this](const string& url, BinanceKlineDownloader::Chunk chunk) {
+                string body;
+                {
+                    lock_guard<mutex> lock(mtx);
+                    requests.push_back(url);
+                    auto failing = failures.find(url);
+                    if (failing != failures.end() && failing->second > 0) {
+                        failing->second--;
+                        return false;
+                    }
+                    auto it = files.find(url);
+                    body = it == files.end() ? NOT_FOUND : it->second;
+                }
+                for (size_t i = 0; i < body.size(); i += 1000) chunk(body.substr(i, 1000));
+                return true;
+            };
+        };
+    }
+
+    static constexpr const char* NOT_FOUND =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<Error><Code>NoSuchKey</Code><Message>The specified key does not exist.</Message></Error>";
+
+    int listings() {
+        lock_guard<mutex> lock(mtx);
+        int count = 0;
+        for (const string& url: requests) count += str_contains(url, "/list?");
+        return count;
+    }
+
+    int requested(const string& suffix) {
+        lock_guard<mutex> lock(mtx);
+        int count = 0;
+        for (const string& url: requests) count += url.ends_with(suffix);
+        return count;
+    }
+
+    // Publishes an archive with its checksum file.
+    void serve(const string& key, const string& zip) {
+        files["http://stand-in/data/" + key] = zip;
+        files["http://stand-in/data/" + key + ".CHECKSUM"] =
+            Sha256::hash(zip) + "  " + key.substr(key.rfind('/') + 1) + "\n";
+    }
+
+    void serveDay(const string& date, int count = 1440, const string& symbol = "BTCUSDT", const string& interval = "1m") {
+        const string name = symbol + "-" + interval + "-" + date;
+        serve(BinanceKlineDownloader::prefix(symbol, interval) + name + ".zip",
+            ZipArchive_test_zip(name + ".csv", day(datetime_to_sec(date), count), true));
+    }
+
+    static string day(time_sec start, int count) {
+        string csv;
+        for (int i = 0; i < count; i++)
+            csv += to_string((start + i * 60) * 1000) + ",1.5,2.5,0.5,2,100," +
+                to_string((start + i * 60 + 59) * 1000 + 999) + ",150,10,50,75,0\n";
+        return csv;
+    }
+};
+
+TEST(test_BinanceKlineDownloader_lists_pages_and_downloads_in_date_order) {
+    BinanceKlineStandIn standIn;
+    const string list = "http://stand-in/list?delimiter=/&prefix=" + BinanceKlineDownloader::prefix("BTCUSDT", "1m");
+    const string key = BinanceKlineDownloader::prefix("BTCUSDT", "1m") + "BTCUSDT-1m-";
+    standIn.files[list + "&marker="] =
+        "<ListBucketResult><IsTruncated>true</IsTruncated><NextMarker>page2</NextMarker>"
+        "<Contents><Key>" + key + "2024-01-01.zip</Key></Contents>"
+        "<Contents><Key>" + key + "2024-01-01.zip.CHECKSUM</Key></Contents>"
+        "<Contents><Key>" + key + "2024-01-02.zip.CHECKSUM</Key></Contents></ListBucketResult>";
+    standIn.files[list + "&marker=page2"] =
+        "<ListBucketResult><IsTruncated>false</IsTruncated>"
+        "<Contents><Key>" + key + "2024-01-03.zip.CHECKSUM</Key></Contents>"
+        "<Contents><Key>" + key + "2024-01-04.zip.CHECKSUM</Key></Contents></ListBucketResult>";
+    const time_sec day1 = datetime_to_sec("2024-01-01");
+    for (int d = 0; d < 4; d++)
+        standIn.serve(key + "2024-01-0" + to_string(d + 1) + ".zip", ZipArchive_test_zip("BTCUSDT-1m-2024-01-0" + to_string(d + 1) + ".csv",
+                BinanceKlineStandIn::day(day1 + d * 86400, 1440), d % 2));
+
+    BinanceKlineDownloader downloader(3, standIn.fetchers(), "http://stand-in/list", "http://stand-in/data");
+    vector<BinanceKlineDownloader::Archive> archives = downloader.list("BTCUSDT", "1m", day1 + 86399);
+    assert(archives.size() == 3 && "Should list the days after the last stored candle across pages");
+    assert(archives.front().date == "2024-01-02" && archives.back().date == "2024-01-04" && "Days should be listed in order");
+
+    vector<string> merged;
+    vector<Candle> candles = downloader.download(archives, [&merged](const BinanceKlineDownloader::Archive& archive, const BinanceKlineDownloader::Day&) {
+        merged.push_back(archive.date);
+    });
+    assert((merged == vector<string>{ "2024-01-02", "2024-01-03", "2024-01-04" }) && "Days should merge in date order");
+    assert(candles.size() == 3 * 1440 && "Should return every candle of the new days");
+    for (size_t i = 1; i < candles.size(); i++)
+        assert(candles[i].getTime() == candles[i - 1].getTime() + 60 && "Candles should be contiguous and ordered");
+    assert(candles.front().getTime() == day1 + 86400 && candles.front().getClose() == 2 && "Candles should be parsed");
+}
+
+TEST(test_BinanceKlineDownloader_download_fails_on_missing_day) {
+    BinanceKlineStandIn standIn;
+    BinanceKlineDownloader downloader(2, standIn.fetchers(), "http://stand-in/list", "http://stand-in/data");
+    bool thrown = false;
+    try {
+        downloader.download({ { "missing.zip", "2024-01-01", 0 } });
+    } catch (exception& e) {
+        thrown = str_contains(e.what(), "Unable to GET: http://stand-in/data/missing.zip");
+    }
+    assert(thrown && "A failed day should abort the download");
+}
+
+TEST(test_BinanceKlineDownloader_sync_builds_urls_without_listing) {
+    BinanceKlineStandIn standIn;
+    for (string date: { "2024-01-01", "2024-01-02", "2024-01-03" }) standIn.serveDay(date);
+    BinanceKlineDownloader downloader(2, standIn.fetchers(), "http://stand-in/list", "http://stand-in/data");
+    BinanceKlineManifest manifest;
+
+    const time_sec last = datetime_to_sec("2023-12-31") + 86340; // last stored candle
+    const time_sec now = datetime_to_sec("2024-01-05") + 3600;   // 01-04 is not published yet
+    vector<Candle> candles = downloader.sync("BTCUSDT", "1m", last, manifest, nullptr, now);
+    assert(candles.size() == 3 * 1440 && "Should download every published day");
+    assert(standIn.listings() == 0 && "Should not list the bucket in the common case");
+    assert(manifest.has("2024-01-03") && !manifest.has("2024-01-04") && "Manifest should record downloaded days");
+}
+
+TEST(test_BinanceKlineDownloader_sync_lists_on_gap_and_skips_known_gaps) {
+    BinanceKlineStandIn standIn;
+    for (string date: { "2024-01-01", "2024-01-03" }) standIn.serveDay(date); // 01-02 never existed
+    const string list = "http://stand-in/list?delimiter=/&prefix=" + BinanceKlineDownloader::prefix("BTCUSDT", "1m");
+    const string key = BinanceKlineDownloader::prefix("BTCUSDT", "1m") + "BTCUSDT-1m-";
+    standIn.files[list + "&marker="] = "<ListBucketResult><IsTruncated>false</IsTruncated>"
+        "<Contents><Key>" + key + "2024-01-01.zip.CHECKSUM</Key></Contents>"
+        "<Contents><Key>" + key + "2024-01-03.zip.CHECKSUM</Key></Contents></ListBucketResult>";
+    BinanceKlineDownloader downloader(2, standIn.fetchers(), "http://stand-in/list", "http://stand-in/data");
+    BinanceKlineManifest manifest;
+
+    const time_sec last = datetime_to_sec("2023-12-31") + 86340;
+    const time_sec now = datetime_to_sec("2024-01-04") + 3600;
+    vector<Candle> candles = downloader.sync("BTCUSDT", "1m", last, manifest, nullptr, now);
+    assert(candles.size() == 2 * 1440 && "Should download the days around the gap");
+    assert(candles[1440].getTime() == datetime_to_sec("2024-01-03") && "Days should stay in order");
+    assert(standIn.listings() == 1 && "Gap should fall back to a listing");
+    assert(manifest.isKnownGap("2024-01-02") && "Listing should mark the gap as known");
+
+    standIn.serveDay("2024-01-04");
+    candles = downloader.sync("BTCUSDT", "1m", datetime_to_sec("2024-01-01") + 86340, manifest, nullptr, now + 86400);
+    assert(candles.size() == 2 * 1440 && standIn.listings() == 1 && "Known gaps should not trigger a new listing");
+}
+
+TEST(test_BinanceKlineDownloader_sync_stops_at_day_failing_checksum) {
+    BinanceKlineStandIn standIn;
+    for (string date: { "2024-01-01", "2024-01-02", "2024-01-03" }) standIn.serveDay(date);
+    const string corrupt = "http://stand-in/data/" + BinanceKlineDownloader::prefix("BTCUSDT", "1m") + "BTCUSDT-1m-2024-01-02.zip";
+    standIn.files[corrupt][100] ^= 1;
+    BinanceKlineDownloader downloader(2, standIn.fetchers(), "http://stand-in/list", "http://stand-in/data");
+    BinanceKlineManifest manifest;
+
+    const time_sec last = datetime_to_sec("2023-12-31") + 86340;
+    const time_sec now = datetime_to_sec("2024-01-04") + 3600;
+    vector<Candle> candles = downloader.sync("BTCUSDT", "1m", last, manifest, nullptr, now);
+    assert(candles.size() == 1440 && "Only the days before the corrupt one should be merged");
+    assert(standIn.requested("2024-01-02.zip") == BinanceKlineDownloader::ATTEMPTS && "Corrupt day should be retried");
+    assert(manifest.isFailed("2024-01-02") && !manifest.has("2024-01-03") && "Corrupt day should be recorded as failed");
+    assert(manifest.getChecksum("2024-01-01") == standIn.files[
+        "http://stand-in/data/" + BinanceKlineDownloader::prefix("BTCUSDT", "1m") + "BTCUSDT-1m-2024-01-01.zip.CHECKSUM"
+    ].substr(0, 64) && "Verified day should keep its checksum");
+    assert(standIn.listings() == 0 && "A failed day is not a gap");
+}
+
+TEST(test_BinanceKlineDownloader_sync_retries_and_reports_failed_requests) {
+    BinanceKlineStandIn standIn;
+    for (string date: { "2024-01-01", "2024-01-02" }) standIn.serveDay(date);
+    const string key = "http://stand-in/data/" + BinanceKlineDownloader::prefix("BTCUSDT", "1m") + "BTCUSDT-1m-";
+    standIn.failures[key + "2024-01-01.zip.CHECKSUM"] = 1;
+    standIn.failures[key + "2024-01-02.zip"] = 1;
+    BinanceKlineDownloader downloader(2, standIn.fetchers(), "http://stand-in/list", "http://stand-in/data");
+    BinanceKlineManifest manifest;
+
+    const time_sec last = datetime_to_sec("2023-12-31") + 86340;
+    const time_sec now = datetime_to_sec("2024-01-04") + 3600; // 01-03 is not published yet
+    vector<Candle> candles = downloader.sync("BTCUSDT", "1m", last, manifest, nullptr, now);
+    assert(candles.size() == 2 * 1440 && manifest.has("2024-01-02") && "A failed request should be retried");
+    assert(standIn.requested("2024-01-03.zip.CHECKSUM") == 1 && "A 404 is an unpublished day, not retried");
+
+    standIn.serveDay("2024-01-03");
+    standIn.failures[key + "2024-01-03.zip.CHECKSUM"] = BinanceKlineDownloader::ATTEMPTS;
+    bool thrown = false;
+    try {
+        downloader.sync("BTCUSDT", "1m", candles.back().getTime(), manifest, nullptr, now + 86400);
+    } catch (exception& e) {
+        thrown = str_contains(e.what(), "Unable to GET: " + key + "2024-01-03.zip.CHECKSUM");
+    }
+    assert(thrown && !manifest.has("2024-01-03") && "A day that can not be fetched should be reported, not taken for unpublished");
+}
+
+TEST(test_BinanceKlineDownloader_repair_refetches_only_changed_days) {
+    BinanceKlineStandIn standIn;
+    for (string date: { "2024-01-01", "2024-01-02", "2024-01-03", "2024-01-04" }) standIn.serveDay(date);
+    BinanceKlineDownloader downloader(3, standIn.fetchers(), "http://stand-in/list", "http://stand-in/data");
+    BinanceKlineManifest manifest;
+    downloader.sync("BTCUSDT", "1m", datetime_to_sec("2023-12-31") + 86340, manifest, nullptr,
+        datetime_to_sec("2024-01-05") + 3600);
+    manifest.add("2024-01-04"); // stored before verification
+
+    standIn.serveDay("2024-01-02", 1000); // republished
+    standIn.requests.clear();
+    vector<string> repaired;
+    vector<Candle> candles = downloader.repair("BTCUSDT", "1m", manifest,
+        [&repaired](const BinanceKlineDownloader::Archive& archive, const BinanceKlineDownloader::Day&) {
+            repaired.push_back(archive.date);
+        });
+    assert((repaired == vector<string>{ "2024-01-02", "2024-01-04" }) && "Only changed and unverified days should be re-fetched");
+    assert(candles.size() == 1000 + 1440 && "Should return the candles of the re-fetched days");
+    assert(standIn.requested(".zip") == 2 && standIn.requested(".CHECKSUM") == 4 + 2 && "Unchanged days cost a checksum only");
+    assert(manifest.isVerified("2024-01-04") && "Re-fetched days should be verified");
+    assert(downloader.repair("BTCUSDT", "1m", manifest).empty() && "A repaired history should have nothing left to fetch");
+}
+
+#endif
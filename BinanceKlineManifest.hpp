@@ -0,0 +1,137 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <fstream>
+#include <sstream>
+
+#include "../misc/ERROR.hpp"
+#include "../misc/file_exists.hpp"
+
+using namespace std;
+
+// Local record of the daily kline archives of one symbol and interval:
+// the days already downloaded and the newest day seen in a full listing.
+// Days up to that one which are not recorded are known gaps, so the
+// direct (listing-free) update can skip them without listing again.
+// Each day keeps the SHA-256 its archive was verified against, so a
+// repair only re-fetches days whose published checksum has changed or
+// whose verification failed.
+//
+// Text format, one record per line:
+//   listed <date>
+//   archive <date> [<sha256>]   (no checksum: stored before verification)
+//   failed <date>
+class BinanceKlineManifest {
+public:
+    BinanceKlineManifest(const string& file = ""): file(file) {
+        if (!file.empty()) load();
+    }
+
+    virtual ~BinanceKlineManifest() {}
+
+    void load() {
+        archives.clear();
+        failed.clear();
+        listedUntil.clear();
+        if (!file_exists(file)) return;
+        ifstream in(file);
+        if (!in) throw ERROR("Unable to read manifest: " + file);
+        string line;
+        while (getline(in, line)) {
+            istringstream fields(line);
+            string type, date, checksum;
+            fields >> type >> date >> checksum;
+            if (type == "listed") listedUntil = date;
+            else if (type == "archive") archives[date] = checksum;
+            else if (type == "failed") failed.insert(date);
+        }
+    }
+
+    void save() const {
+        const string temp = file + ".tmp";
+        {
+            ofstream out(temp, ios::trunc);
+            if (!out) throw ERROR("Unable to write manifest: " + temp);
+            if (!listedUntil.empty()) out << "listed " << listedUntil << "\n";
+            for (const auto& [date, checksum]: archives)
+                out << "archive " << date << (checksum.empty() ? "" : " " + checksum) << "\n";
+            for (const string& date: failed) out << "failed " << date << "\n";
+            if (!out) throw ERROR("Unable to write manifest: " + temp);
+        }
+        if (::rename(temp.c_str(), file.c_str()))
+            throw ERROR("Unable to write manifest: " + file);
+    }
+
+    bool has(const string& date) const { return archives.count(date); }
+
+    void add(const string& date, const string& checksum = "") {
+        archives[date] = checksum;
+        failed.erase(date);
+    }
+
+    // A published day whose archive did not match its checksum.
+    void fail(const string& date) {
+        archives.erase(date);
+        failed.insert(date);
+    }
+
+    bool isFailed(const string& date) const { return failed.count(date); }
+
+    bool isVerified(const string& date) const { return !getChecksum(date).empty(); }
+
+    string getChecksum(const string& date) const {
+        auto it = archives.find(date);
+        return it == archives.end() ? "" : it->second;
+    }
+
+    // A day the last listing covered but did not contain.
+    bool isKnownGap(const string& date) const {
+        return !listedUntil.empty() && date <= listedUntil && !has(date) && !isFailed(date);
+    }
+
+    string getListedUntil() const { return listedUntil; }
+    void setListedUntil(const string& date) { listedUntil = date; }
+
+    // date => verified checksum
+    const map<string, string>& getArchives() const { return archives; }
+    const set<string>& getFailed() const { return failed; }
+
+private:
+    string file;
+    string listedUntil;
+    map<string, string> archives;
+    set<string> failed;
+};
+
+
+#ifdef TEST
+
+#include "../misc/mkdir.hpp"
+
+TEST(test_BinanceKlineManifest_save_and_load_roundtrip) {
+    const string folder = ".data/test/manifests";
+    if (!file_exists(folder)) mkdir(folder, true);
+    const string file = folder + "/roundtrip.manifest";
+    {
+        BinanceKlineManifest manifest(file);
+        manifest.add("2024-01-01");
+        manifest.add("2024-01-03", "abc123");
+        manifest.add("2024-01-05");
+        manifest.fail("2024-01-05");
+        manifest.setListedUntil("2024-01-05");
+        manifest.save();
+    }
+    BinanceKlineManifest manifest(file);
+    assert(manifest.getArchives().size() == 2 && manifest.has("2024-01-03") && "Archives should be reloaded");
+    assert(manifest.getChecksum("2024-01-03") == "abc123" && !manifest.isVerified("2024-01-01") &&
+           "Checksums should be reloaded");
+    assert(manifest.isFailed("2024-01-05") && !manifest.has("2024-01-05") && "Failed days should be reloaded");
+    assert(manifest.getListedUntil() == "2024-01-05" && "Listing coverage should be reloaded");
+    assert(manifest.isKnownGap("2024-01-02") && "Unlisted day inside the coverage is a gap");
+    assert(!manifest.isKnownGap("2024-01-05") && "A failed day is not a gap");
+    assert(!manifest.isKnownGap("2024-01-06") && "Days after the coverage are unknown");
+}
+
+#endif
@@ -0,0 +1,438 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../misc/ERROR.hpp"
+#include "../misc/file_exists.hpp"
+#include "Candle.hpp"
+#include "CandleFile.hpp"
+
+using namespace std;
+
+// Header of compressed candle files (.cdat).
+// Layout: header | block | block | ... | index
+// Appends write new blocks and a new index after the old ones and commit
+// them with a single header pwrite; the superseded bytes are counted in
+// deadBytes and reclaimed by a rewrite once they grow too large.
+struct CandleBlockFileHeader {
+    char magic[4];
+    uint32_t version;
+    char symbol[24];
+    char interval[8];
+    uint64_t count;
+    uint64_t indexOffset;
+    uint32_t blockCount;
+    uint32_t deadBytes;
+
+    static constexpr char MAGIC[4] = { 'C', 'B', 'L', 'K' };
+    static const uint32_t VERSION = 1;
+
+    CandleBlockFileHeader() { memset(this, 0, sizeof(*this)); }
+
+    CandleBlockFileHeader(const string& symbol, const string& interval) {
+        memset(this, 0, sizeof(*this));
+        memcpy(magic, MAGIC, sizeof(magic));
+        version = VERSION;
+        if (symbol.size() >= sizeof(this->symbol) || interval.size() >= sizeof(this->interval))
+            throw ERROR("Symbol or interval too long for candle file header: " + symbol + "-" + interval);
+        memcpy(this->symbol, symbol.data(), symbol.size());
+        memcpy(this->interval, interval.data(), interval.size());
+        indexOffset = sizeof(*this);
+    }
+
+    bool valid() const { return !memcmp(magic, MAGIC, sizeof(magic)); }
+
+    string getSymbol() const { return string(symbol, strnlen(symbol, sizeof(symbol))); }
+    string getInterval() const { return string(interval, strnlen(interval, sizeof(interval))); }
+};
+
+static_assert(sizeof(CandleBlockFileHeader) == 64, "CandleBlockFileHeader must stay one 64 byte block");
+
+// One entry per block, so a range load reads and decodes only the blocks it needs.
+struct CandleBlockIndexEntry {
+    int64_t firstTime;
+    int64_t lastTime;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t count;
+};
+
+// Candle block codec: per candle, delta-of-delta coded time, then the
+// float prices XOR-ed with their closest neighbour (open with the previous
+// close, high/low/close with the open) and the volume XOR-ed with the
+// previous volume. Everything is written as LEB128 varints, so unchanged
+// values cost one byte and similar ones only their differing low bits.
+class CandleBlockCodec {
+public:
+
+    static void encode(span<const Candle> candles, string& out) {
+        int64_t prevTime = 0;
+        int64_t prevDelta = 0;
+        uint32_t prevClose = 0;
+        uint32_t prevVolume = 0;
+        for (size_t i = 0; i < candles.size(); i++) {
+            const Candle& candle = candles[i];
+            int64_t time = candle.getTime();
+            int64_t delta = time - prevTime;
+            putVarint(out, zigzag(delta - prevDelta));
+            prevTime = time;
+            prevDelta = i ? delta : 0;
+
+            uint32_t open = bits(candle.getOpen());
+            uint32_t close = bits(candle.getClose());
+            uint32_t volume = bits(candle.getVolume());
+            putVarint(out, open ^ prevClose);
+            putVarint(out, bits(candle.getHigh()) ^ open);
+            putVarint(out, bits(candle.getLow()) ^ open);
+            putVarint(out, close ^ open);
+            putVarint(out, volume ^ prevVolume);
+            prevClose = close;
+            prevVolume = volume;
+        }
+    }
+
+    static void decode(const uint8_t* data, size_t size, size_t count, Candle* out) {
+        const uint8_t* p = data;
+        const uint8_t* end = data + size;
+        int64_t prevTime = 0;
+        int64_t prevDelta = 0;
+        uint32_t prevClose = 0;
+        uint32_t prevVolume = 0;
+        for (size_t i = 0; i < count; i++) {
+            int64_t delta = prevDelta + unzigzag(getVarint(p, end));
+            int64_t time = prevTime + delta;
+            prevTime = time;
+            prevDelta = i ? delta : 0;
+
+            uint32_t open = (uint32_t)getVarint(p, end) ^ prevClose;
+            uint32_t high = (uint32_t)getVarint(p, end) ^ open;
+            uint32_t low = (uint32_t)getVarint(p, end) ^ open;
+            uint32_t close = (uint32_t)getVarint(p, end) ^ open;
+            uint32_t volume = (uint32_t)getVarint(p, end) ^ prevVolume;
+            prevClose = close;
+            prevVolume = volume;
+
+            out[i].set(time, real(open), real(high), real(low), real(close), real(volume));
+        }
+        if (p != end) throw ERROR("Corrupted candle block (trailing bytes)");
+    }
+
+private:
+
+    static uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+    static int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+    static uint32_t bits(float f) { uint32_t u; memcpy(&u, &f, sizeof(u)); return u; }
+    static float real(uint32_t u) { float f; memcpy(&f, &u, sizeof(f)); return f; }
+
+    static void putVarint(string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back((char)(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back((char)v);
+    }
+
+    static uint64_t getVarint(const uint8_t*& p, const uint8_t* end) {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (p >= end) break;
+            uint8_t byte = *p++;
+            v |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return v;
+        }
+        throw ERROR("Corrupted candle block (bad varint)");
+    }
+};
+
+class CandleBlockFile {
+public:
+
+    static const size_t BLOCK_CANDLES = 1024;
+
+    static bool readHeader(const string& file, CandleBlockFileHeader& header) {
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        ssize_t n = ::pread(fd, &header, sizeof(header), 0);
+        ::close(fd);
+        return n == (ssize_t)sizeof(header) && header.valid();
+    }
+
+    static vector<CandleBlockIndexEntry> readIndex(const string& file, CandleBlockFileHeader& header) {
+        vector<CandleBlockIndexEntry> index;
+        if (!readHeader(file, header)) return index;
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) throw ERROR("Unable to open: " + file);
+        index.resize(header.blockCount);
+        bool ok = CandleFile::readAll(fd, index.data(), index.size() * sizeof(CandleBlockIndexEntry), header.indexOffset);
+        ::close(fd);
+        if (!ok) throw ERROR("Truncated candle block index: " + file);
+        return index;
+    }
+
+    static vector<Candle> load(const string& file) {
+        return load(file, numeric_limits<time_sec>::min(), numeric_limits<time_sec>::max());
+    }
+
+    // Decodes only the blocks overlapping [period_start, period_end].
+    static vector<Candle> load(const string& file, time_sec period_start, time_sec period_end) {
+        vector<Candle> candles;
+        if (!file_exists(file)) return candles;
+        CandleBlockFileHeader header;
+        vector<CandleBlockIndexEntry> index = readIndex(file, header);
+        if (!header.valid()) throw ERROR("Not a compressed candle file: " + file);
+
+        auto first = lower_bound(index.begin(), index.end(), period_start,
+            [](const CandleBlockIndexEntry& entry, time_sec time) {
+                return entry.lastTime < time;
+            });
+        auto last = upper_bound(first, index.end(), period_end,
+            [](time_sec time, const CandleBlockIndexEntry& entry) {
+                return time < entry.firstTime;
+            });
+        if (first == last) return candles;
+
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) throw ERROR("Unable to open: " + file);
+        size_t total = 0;
+        for (auto it = first; it != last; ++it) total += it->count;
+        candles.resize(total);
+        string buffer;
+        size_t at = 0;
+        for (auto it = first; it != last; ++it) {
+            buffer.resize(it->size);
+            if (!CandleFile::readAll(fd, buffer.data(), it->size, it->offset)) {
+                ::close(fd);
+                throw ERROR("Truncated candle block: " + file);
+            }
+            CandleBlockCodec::decode((const uint8_t*)buffer.data(), it->size, it->count, candles.data() + at);
+            at += it->count;
+        }
+        ::close(fd);
+
+        // trim the partially covered edge blocks
+        auto from = lower_bound(candles.begin(), candles.end(), period_start,
+            [](const Candle& candle, time_sec time) { return candle.getTime() < time; });
+        auto to = upper_bound(from, candles.end(), period_end,
+            [](time_sec time, const Candle& candle) { return time < candle.getTime(); });
+        candles.erase(to, candles.end());
+        candles.erase(candles.begin(), from);
+        return candles;
+    }
+
+    static time_sec lastTime(const string& file) {
+        CandleBlockFileHeader header;
+        vector<CandleBlockIndexEntry> index = readIndex(file, header);
+        return index.empty() ? 0 : index.back().lastTime;
+    }
+
+    static void save(
+        const string& file, span<const Candle> candles,
+        const string& symbol, const string& interval
+    ) {
+        CandleBlockFileHeader header(symbol, interval);
+        vector<CandleBlockIndexEntry> index;
+        const string temp = file + ".tmp";
+        int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw ERROR("Unable to open: " + temp);
+        bool ok =
+            writeBlocks(fd, candles, header, index) &&
+            CandleFile::writeAll(fd, &header, sizeof(header), 0) &&
+            !::fsync(fd);
+        ::close(fd);
+        if (!ok || ::rename(temp.c_str(), file.c_str())) {
+            ::unlink(temp.c_str());
+            throw ERROR("Unable to write: " + file);
+        }
+    }
+
+    // Re-encodes the last, partially filled block together with the new
+    // candles. Everything is written past the current end of file, so an
+    // interrupted append leaves the committed header and index untouched.
+    static void append(
+        const string& file, span<const Candle> candles,
+        const string& symbol, const string& interval
+    ) {
+        CandleBlockFileHeader header;
+        vector<CandleBlockIndexEntry> index = readIndex(file, header);
+        if (!header.valid()) {
+            if (file_exists(file)) throw ERROR("Not a compressed candle file: " + file);
+            save(file, candles, symbol, interval);
+            return;
+        }
+        if (header.getSymbol() != symbol || header.getInterval() != interval)
+            throw ERROR("Candle file belongs to " + header.getSymbol() + "-" + header.getInterval() + ": " + file);
+        if (candles.empty()) return;
+
+        const uint64_t end = header.indexOffset + index.size() * sizeof(CandleBlockIndexEntry);
+        uint64_t dead = header.deadBytes + index.size() * sizeof(CandleBlockIndexEntry);
+        vector<Candle> tail;
+        if (!index.empty() && index.back().count < BLOCK_CANDLES) {
+            const CandleBlockIndexEntry last = index.back();
+            tail = load(file, last.firstTime, last.lastTime);
+            index.pop_back();
+            header.count -= last.count;
+            dead += last.size;
+        }
+        tail.insert(tail.end(), candles.begin(), candles.end());
+
+        if (dead > UINT32_MAX || (dead > (1 << 20) && dead > end / 4)) { // compact
+            vector<Candle> all = load(file);
+            all.insert(all.end(), candles.begin(), candles.end());
+            save(file, all, symbol, interval);
+            return;
+        }
+
+        int fd = ::open(file.c_str(), O_RDWR);
+        if (fd < 0) throw ERROR("Unable to open: " + file);
+        header.deadBytes = dead;
+        bool ok =
+            !::ftruncate(fd, end) &&
+            writeBlocks(fd, tail, header, index, end) &&
+            !::fdatasync(fd) &&
+            CandleFile::writeAll(fd, &header, sizeof(header), 0) &&
+            !::fdatasync(fd);
+        ::close(fd);
+        if (!ok) throw ERROR("Unable to append: " + file);
+    }
+
+private:
+
+    // Writes the candles as blocks from `offset` on, followed by the whole
+    // index, and points the header at it.
+    static bool writeBlocks(
+        int fd, span<const Candle> candles,
+        CandleBlockFileHeader& header, vector<CandleBlockIndexEntry>& index,
+        uint64_t offset = sizeof(CandleBlockFileHeader)
+    ) {
+        string block;
+        for (size_t i = 0; i < candles.size(); i += BLOCK_CANDLES) {
+            span<const Candle> chunk = candles.subspan(i, min(BLOCK_CANDLES, candles.size() - i));
+            block.clear();
+            CandleBlockCodec::encode(chunk, block);
+            if (!CandleFile::writeAll(fd, block.data(), block.size(), offset)) return false;
+            index.push_back({
+                chunk.front().getTime(), chunk.back().getTime(),
+                offset, (uint32_t)block.size(), (uint32_t)chunk.size()
+            });
+            offset += block.size();
+            header.count += chunk.size();
+        }
+        header.indexOffset = offset;
+        header.blockCount = index.size();
+        return CandleFile::writeAll(fd, index.data(), index.size() * sizeof(CandleBlockIndexEntry), offset);
+    }
+};
+
+
+#ifdef TEST
+
+#include <chrono>
+#include <functional>
+#include "../misc/mkdir.hpp"
+#include "../misc/replace_extension.hpp"
+#include "../misc/vector_save.hpp"
+#include "generateRandomCandles.hpp"
+
+inline string CandleBlockFile_test_file(const string& name) {
+    const string folder = ".data/test/candles";
+    if (!file_exists(folder) && !mkdir(folder, true))
+        throw ERROR("Unable to create folder: " + folder);
+    return folder + "/" + name + ".cdat";
+}
+
+inline bool CandleBlockFile_test_same(const Candle& a, const Candle& b) {
+    return a.getTime() == b.getTime() && a.getOpen() == b.getOpen() && a.getHigh() == b.getHigh() &&
+        a.getLow() == b.getLow() && a.getClose() == b.getClose() && a.getVolume() == b.getVolume();
+}
+
+TEST(test_CandleBlockFile_save_and_load_is_lossless) {
+    const string file = CandleBlockFile_test_file("lossless");
+    vector<Candle> candles = generateRandomCandles(3000, 1600000000, 60);
+    candles[1500].setTime(candles[1500].getTime() + 7); // irregular gap
+    CandleBlockFile::save(file, candles, "BTCUSDT", "1m");
+
+    vector<Candle> result = CandleBlockFile::load(file);
+    assert(result.size() == candles.size() && "Should load every candle");
+    for (size_t i = 0; i < candles.size(); i++)
+        assert(CandleBlockFile_test_same(result[i], candles[i]) && "Decoded candles should be bit-identical");
+
+    struct stat st;
+    ::stat(file.c_str(), &st);
+    assert((size_t)st.st_size < candles.size() * sizeof(Candle) && "Compressed file should be smaller than raw");
+}
+
+TEST(test_CandleBlockFile_range_load_decodes_only_needed_blocks) {
+    const string file = CandleBlockFile_test_file("range");
+    vector<Candle> candles = generateRandomCandles(5000, 0, 60);
+    CandleBlockFile::save(file, candles, "BTCUSDT", "1m");
+
+    CandleBlockFileHeader header;
+    vector<CandleBlockIndexEntry> index = CandleBlockFile::readIndex(file, header);
+    assert(index.size() == 5 && header.count == 5000 && "Should write one index entry per block");
+
+    vector<Candle> result = CandleBlockFile::load(file, 2000 * 60, 2100 * 60);
+    assert(result.size() == 101 && "Should return the inclusive range");
+    assert(result.front().getTime() == 2000 * 60 && result.back().getTime() == 2100 * 60 && "Range edges should match");
+    assert(CandleBlockFile::load(file, -100, -1).empty() && "Range before the data should be empty");
+}
+
+TEST(test_CandleBlockFile_append_merges_partial_block) {
+    const string file = CandleBlockFile_test_file("append");
+    vector<Candle> candles = generateRandomCandles(2500, 0, 60);
+    CandleBlockFile::save(file, span<const Candle>(candles).first(1500), "BTCUSDT", "1m");
+    CandleBlockFile::append(file, span<const Candle>(candles).subspan(1500, 700), "BTCUSDT", "1m");
+    CandleBlockFile::append(file, span<const Candle>(candles).subspan(2200), "BTCUSDT", "1m");
+
+    vector<Candle> result = CandleBlockFile::load(file);
+    assert(result.size() == candles.size() && "Appended candles should follow the old ones");
+    for (size_t i = 0; i < candles.size(); i++)
+        assert(CandleBlockFile_test_same(result[i], candles[i]) && "Appended candles should be intact");
+    assert(CandleBlockFile::lastTime(file) == candles.back().getTime() && "Last time should follow appends");
+}
+
+#ifdef BENCHMARK
+
+// Decode throughput of the block format against the raw vector_load path.
+TEST(test_CandleBlockFile_benchmark_decode_vs_vector_load) {
+    const size_t count = 1000000;
+    vector<Candle> candles = generateRandomCandles(count, 1600000000, 60);
+    const string blocks = CandleBlockFile_test_file("benchmark");
+    const string raw = replace_extension(blocks, ".raw");
+    CandleBlockFile::save(blocks, candles, "BTCUSDT", "1m");
+    vector_save<Candle>(candles, raw);
+
+    auto measure = [](function<void()> f) {
+        auto start = chrono::steady_clock::now();
+        f();
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+    vector<Candle> loaded;
+    double rawSec = measure([&]() { vector_load<Candle>(loaded, raw); });
+    assert(loaded.size() == count);
+    double blockSec = measure([&]() { loaded = CandleBlockFile::load(blocks); });
+    assert(loaded.size() == count);
+
+    struct stat st;
+    ::stat(blocks.c_str(), &st);
+    const double mb = count * sizeof(Candle) / 1e6;
+    cout << "  vector_load: " << mb / rawSec << " MB/s (" << count / rawSec / 1e6 << " M candles/s), "
+         << "blocks: " << mb / blockSec << " MB/s (" << count / blockSec / 1e6 << " M candles/s), "
+         << "compression: " << (double)(count * sizeof(Candle)) / st.st_size << "x" << endl;
+    ::unlink(raw.c_str());
+    ::unlink(blocks.c_str());
+}
+
+#endif // BENCHMARK
+
+#endif
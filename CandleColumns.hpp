@@ -0,0 +1,123 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "Candle.hpp"
+
+using namespace std;
+
+// Structure-of-arrays candle storage.
+// Each field lives in its own contiguous array so single-field passes
+// (closes for an SMA, lows for limit orders, etc.) stream and vectorize.
+class CandleColumns {
+public:
+    CandleColumns() {}
+
+    CandleColumns(span<const Candle> candles) { assign(candles); }
+
+    virtual ~CandleColumns() {}
+
+    void assign(span<const Candle> candles) {
+        resize(candles.size());
+        for (size_t i = 0; i < candles.size(); i++) {
+            const Candle& candle = candles[i];
+            time[i] = candle.getTime();
+            open[i] = candle.getOpen();
+            high[i] = candle.getHigh();
+            low[i] = candle.getLow();
+            close[i] = candle.getClose();
+            volume[i] = candle.getVolume();
+        }
+    }
+
+    vector<Candle> toCandles() const {
+        vector<Candle> candles;
+        candles.reserve(size());
+        for (size_t i = 0; i < size(); i++)
+            candles.emplace_back(time[i], open[i], high[i], low[i], close[i], volume[i]);
+        return candles;
+    }
+
+    Candle at(size_t i) const {
+        return Candle(time[i], open[i], high[i], low[i], close[i], volume[i]);
+    }
+
+    void push_back(const Candle& candle) {
+        time.push_back(candle.getTime());
+        open.push_back(candle.getOpen());
+        high.push_back(candle.getHigh());
+        low.push_back(candle.getLow());
+        close.push_back(candle.getClose());
+        volume.push_back(candle.getVolume());
+    }
+
+    void reserve(size_t n) {
+        time.reserve(n);
+        open.reserve(n);
+        high.reserve(n);
+        low.reserve(n);
+        close.reserve(n);
+        volume.reserve(n);
+    }
+
+    void resize(size_t n) {
+        time.resize(n);
+        open.resize(n);
+        high.resize(n);
+        low.resize(n);
+        close.resize(n);
+        volume.resize(n);
+    }
+
+    void clear() { resize(0); }
+
+    size_t size() const { return time.size(); }
+    bool empty() const { return time.empty(); }
+
+    span<const time_sec> times() const { return time; }
+    span<const float> opens() const { return open; }
+    span<const float> highs() const { return high; }
+    span<const float> lows() const { return low; }
+    span<const float> closes() const { return close; }
+    span<const float> volumes() const { return volume; }
+
+private:
+    vector<time_sec> time;
+    vector<float> open;
+    vector<float> high;
+    vector<float> low;
+    vector<float> close;
+    vector<float> volume;
+};
+
+
+#ifdef TEST
+
+TEST(test_CandleColumns_roundtrip_preserves_candles) {
+    vector<Candle> candles = {
+        Candle(100, 1, 4, 0.5f, 2, 10),
+        Candle(160, 2, 3, 1.5f, 2.5f, 20),
+        Candle(220, 2.5f, 5, 2, 4, 30),
+    };
+    CandleColumns columns(candles);
+    assert(columns.size() == 3 && "Columns should hold every candle");
+    assert(columns.closes()[2] == 4 && columns.lows()[1] == 1.5f && "Fields should land in their own arrays");
+    assert(columns.times()[1] == 160 && "Times should be kept");
+
+    vector<Candle> result = columns.toCandles();
+    assert(result.size() == candles.size() && "Roundtrip should keep the size");
+    for (size_t i = 0; i < candles.size(); i++)
+        assert(result[i].dump() == candles[i].dump() && "Roundtrip should keep every field");
+}
+
+TEST(test_CandleColumns_push_back_and_at) {
+    CandleColumns columns;
+    columns.push_back(Candle(60, 1, 2, 0.5f, 1.5f, 7));
+    assert(columns.size() == 1 && "push_back should append");
+    assert(columns.at(0).getVolume() == 7 && columns.at(0).getHigh() == 2 && "at() should rebuild the candle");
+    columns.clear();
+    assert(columns.empty() && "clear() should empty every column");
+}
+
+#endif
@@ -0,0 +1,434 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../misc/ERROR.hpp"
+#include "../misc/file_exists.hpp"
+#include "../misc/vector_load.hpp"
+#include "../misc/replace_extension.hpp"
+#include "Candle.hpp"
+#include "MappedCandles.hpp"
+
+using namespace std;
+
+// On-disk header of versioned candle files (.dat).
+// Legacy files are a raw Candle dump without header; they are told apart
+// by the magic and still load. The header is a single 64 byte block so it
+// is rewritten with one sector-sized pwrite when candles are appended.
+struct CandleFileHeader {
+    char magic[4];
+    uint32_t version;
+    char symbol[24];
+    char interval[8];
+    uint64_t count;
+    int64_t lastTime;
+    uint64_t checksum; // FNV-1a 64 over the candle records
+
+    static constexpr char MAGIC[4] = { 'C', 'N', 'D', 'L' };
+    static const uint32_t VERSION = 1;
+    static const uint64_t CHECKSUM_SEED = 0xcbf29ce484222325ULL;
+
+    CandleFileHeader() { memset(this, 0, sizeof(*this)); }
+
+    CandleFileHeader(const string& symbol, const string& interval) {
+        memset(this, 0, sizeof(*this));
+        memcpy(magic, MAGIC, sizeof(magic));
+        version = VERSION;
+        if (symbol.size() >= sizeof(this->symbol) || interval.size() >= sizeof(this->interval))
+            throw ERROR("Symbol or interval too long for candle file header: " + symbol + "-" + interval);
+        memcpy(this->symbol, symbol.data(), symbol.size());
+        memcpy(this->interval, interval.data(), interval.size());
+        checksum = CHECKSUM_SEED;
+    }
+
+    bool valid() const { return !memcmp(magic, MAGIC, sizeof(magic)); }
+
+    string getSymbol() const { return string(symbol, strnlen(symbol, sizeof(symbol))); }
+    string getInterval() const { return string(interval, strnlen(interval, sizeof(interval))); }
+
+    // Extends the running checksum, so appends never rehash old records.
+    static uint64_t hash(uint64_t seed, span<const Candle> candles) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(candles.data());
+        const size_t size = candles.size_bytes();
+        for (size_t i = 0; i < size; i++) {
+            seed ^= bytes[i];
+            seed *= 0x100000001b3ULL;
+        }
+        return seed;
+    }
+};
+
+static_assert(sizeof(CandleFileHeader) == 64, "CandleFileHeader must stay one 64 byte block");
+static_assert(sizeof(CandleFileHeader) % alignof(Candle) == 0, "Candles after the header must stay aligned");
+
+// Sparse time index sidecar (.idx) of a versioned candle file: the time and
+// byte offset of every INDEX_STRIDE-th record. `count` is the number of
+// records it was built for; a mismatch with the data header means stale.
+struct CandleIndexHeader {
+    char magic[4];
+    uint32_t stride;
+    uint64_t count;
+
+    static constexpr char MAGIC[4] = { 'C', 'I', 'D', 'X' };
+};
+
+struct CandleIndexEntry {
+    int64_t time;
+    uint64_t offset;
+};
+
+class CandleFile {
+public:
+
+    static const size_t INDEX_STRIDE = 4096;
+
+    static string indexFile(const string& file) {
+        return replace_extension(file, ".idx");
+    }
+
+    // Returns true and fills the header when the file has one.
+    static bool readHeader(const string& file, CandleFileHeader& header) {
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        ssize_t n = ::pread(fd, &header, sizeof(header), 0);
+        ::close(fd);
+        return n == (ssize_t)sizeof(header) && header.valid();
+    }
+
+    // Byte offset of the first candle record.
+    static size_t dataOffset(const string& file) {
+        CandleFileHeader header;
+        return readHeader(file, header) ? sizeof(header) : 0;
+    }
+
+    static vector<Candle> load(const string& file) {
+        vector<Candle> candles;
+        if (!file_exists(file)) return candles;
+        CandleFileHeader header;
+        if (!readHeader(file, header)) { // legacy headerless dump
+            vector_load<Candle>(candles, file);
+            return candles;
+        }
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) throw ERROR("Unable to open: " + file);
+        candles.resize(header.count);
+        bool ok = readAll(fd, candles.data(), candles.size() * sizeof(Candle), sizeof(header));
+        ::close(fd);
+        if (!ok) throw ERROR("Truncated candle file: " + file);
+        if (CandleFileHeader::hash(CandleFileHeader::CHECKSUM_SEED, candles) != header.checksum)
+            throw ERROR("Candle file checksum mismatch: " + file);
+        return candles;
+    }
+
+    // Reads only the records within [period_start, period_end], seeking
+    // through the sidecar index. Legacy files are loaded and sliced.
+    static vector<Candle> load(const string& file, time_sec period_start, time_sec period_end) {
+        CandleFileHeader header;
+        if (!readHeader(file, header)) {
+            vector<Candle> candles = load(file);
+            span<const Candle> window = range(candles, period_start, period_end);
+            return vector<Candle>(window.begin(), window.end());
+        }
+        auto [first, last] = indexWindow(file, header, period_start, period_end);
+        vector<Candle> candles(last - first);
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) throw ERROR("Unable to open: " + file);
+        bool ok = readAll(fd, candles.data(), candles.size() * sizeof(Candle), sizeof(header) + first * sizeof(Candle));
+        ::close(fd);
+        if (!ok) throw ERROR("Truncated candle file: " + file);
+        span<const Candle> window = range(candles, period_start, period_end);
+        return vector<Candle>(window.begin(), window.end());
+    }
+
+    // Record window [first, last) that contains every candle of
+    // [period_start, period_end], narrowed by the index when it is fresh.
+    static pair<size_t, size_t> indexWindow(
+        const string& file, const CandleFileHeader& header,
+        time_sec period_start, time_sec period_end
+    ) {
+        vector<CandleIndexEntry> index;
+        if (!readIndex(file, header.count, index) || index.empty())
+            return { 0, header.count };
+        auto from = upper_bound(index.begin(), index.end(), period_start,
+            [](time_sec time, const CandleIndexEntry& entry) { return time < entry.time; });
+        auto to = upper_bound(index.begin(), index.end(), period_end,
+            [](time_sec time, const CandleIndexEntry& entry) { return time < entry.time; });
+        size_t first = from == index.begin() ? 0 : (from - index.begin() - 1) * INDEX_STRIDE;
+        size_t last = to == index.end() ? header.count : (to - index.begin()) * INDEX_STRIDE;
+        return { first, max(first, last) };
+    }
+
+    static bool readIndex(const string& file, uint64_t count, vector<CandleIndexEntry>& index) {
+        const string idx = indexFile(file);
+        int fd = ::open(idx.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        CandleIndexHeader header;
+        bool ok = readAll(fd, &header, sizeof(header), 0) &&
+            !memcmp(header.magic, CandleIndexHeader::MAGIC, sizeof(header.magic)) &&
+            header.stride == INDEX_STRIDE && header.count == count;
+        if (ok) {
+            index.resize((count + INDEX_STRIDE - 1) / INDEX_STRIDE);
+            ok = readAll(fd, index.data(), index.size() * sizeof(CandleIndexEntry), sizeof(header));
+        }
+        ::close(fd);
+        return ok;
+    }
+
+    // Extends (or rebuilds, when stale) the index after `candles` were
+    // written as records [count - candles.size(), count).
+    static void updateIndex(const string& file, span<const Candle> candles, uint64_t count) {
+        const uint64_t first = count - candles.size();
+        vector<CandleIndexEntry> index;
+        if (first && !readIndex(file, first, index)) {
+            CandleFileHeader header;
+            if (!readHeader(file, header)) return;
+            index.clear();
+            MappedCandles all(file, sizeof(header), header.count);
+            for (size_t i = 0; i < all.size(); i += INDEX_STRIDE)
+                index.push_back({ all[i].getTime(), sizeof(header) + i * sizeof(Candle) });
+        } else {
+            for (uint64_t i = (first + INDEX_STRIDE - 1) / INDEX_STRIDE * INDEX_STRIDE; i < count; i += INDEX_STRIDE)
+                index.push_back({ candles[i - first].getTime(), sizeof(CandleFileHeader) + i * sizeof(Candle) });
+        }
+
+        CandleIndexHeader header;
+        memcpy(header.magic, CandleIndexHeader::MAGIC, sizeof(header.magic));
+        header.stride = INDEX_STRIDE;
+        header.count = count;
+        const string idx = indexFile(file);
+        const string temp = idx + ".tmp";
+        int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw ERROR("Unable to open: " + temp);
+        bool ok =
+            writeAll(fd, &header, sizeof(header), 0) &&
+            writeAll(fd, index.data(), index.size() * sizeof(CandleIndexEntry), sizeof(header));
+        ::close(fd);
+        if (!ok || ::rename(temp.c_str(), idx.c_str())) {
+            ::unlink(temp.c_str());
+            throw ERROR("Unable to write: " + idx);
+        }
+    }
+
+    static span<const Candle> range(span<const Candle> candles, time_sec period_start, time_sec period_end) {
+        return MappedCandles::range(candles, period_start, period_end);
+    }
+
+    // Writes a complete file next to the target and renames it over,
+    // so readers (and existing mappings) never see a half-written file.
+    static void save(
+        const string& file, span<const Candle> candles,
+        const string& symbol, const string& interval
+    ) {
+        CandleFileHeader header(symbol, interval);
+        header.count = candles.size();
+        header.lastTime = candles.empty() ? 0 : candles.back().getTime();
+        header.checksum = CandleFileHeader::hash(header.checksum, candles);
+
+        const string temp = file + ".tmp";
+        int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw ERROR("Unable to open: " + temp);
+        bool ok =
+            writeAll(fd, &header, sizeof(header), 0) &&
+            writeAll(fd, candles.data(), candles.size_bytes(), sizeof(header)) &&
+            !::fsync(fd);
+        ::close(fd);
+        if (!ok || ::rename(temp.c_str(), file.c_str())) {
+            ::unlink(temp.c_str());
+            throw ERROR("Unable to write: " + file);
+        }
+        updateIndex(file, candles, candles.size());
+    }
+
+    // Writes only the new candles after the existing ones, then commits
+    // them by rewriting the header. Records beyond the header count (left by
+    // an interrupted append) are dropped first. Legacy files get converted.
+    static void append(
+        const string& file, span<const Candle> candles,
+        const string& symbol, const string& interval
+    ) {
+        CandleFileHeader header;
+        if (!readHeader(file, header)) {
+            vector<Candle> all = load(file);
+            all.insert(all.end(), candles.begin(), candles.end());
+            save(file, all, symbol, interval);
+            return;
+        }
+        if (header.getSymbol() != symbol || header.getInterval() != interval)
+            throw ERROR("Candle file belongs to " + header.getSymbol() + "-" + header.getInterval() + ": " + file);
+        if (candles.empty()) return;
+
+        int fd = ::open(file.c_str(), O_RDWR);
+        if (fd < 0) throw ERROR("Unable to open: " + file);
+        const off_t end = sizeof(header) + header.count * sizeof(Candle);
+        header.count += candles.size();
+        header.lastTime = candles.back().getTime();
+        header.checksum = CandleFileHeader::hash(header.checksum, candles);
+        bool ok =
+            !::ftruncate(fd, end) &&
+            writeAll(fd, candles.data(), candles.size_bytes(), end) &&
+            !::fdatasync(fd) &&
+            writeAll(fd, &header, sizeof(header), 0) &&
+            !::fdatasync(fd);
+        ::close(fd);
+        if (!ok) throw ERROR("Unable to append: " + file);
+        updateIndex(file, candles, header.count);
+    }
+
+    static bool readAll(int fd, void* data, size_t size, off_t offset) {
+        char* p = static_cast<char*>(data);
+        while (size) {
+            ssize_t n = ::pread(fd, p, size, offset);
+            if (n <= 0) return false;
+            p += n;
+            size -= n;
+            offset += n;
+        }
+        return true;
+    }
+
+    static bool writeAll(int fd, const void* data, size_t size, off_t offset) {
+        const char* p = static_cast<const char*>(data);
+        while (size) {
+            ssize_t n = ::pwrite(fd, p, size, offset);
+            if (n <= 0) return false;
+            p += n;
+            size -= n;
+            offset += n;
+        }
+        return true;
+    }
+};
+
+
+#ifdef TEST
+
+#include "../misc/mkdir.hpp"
+#include "../misc/vector_save.hpp"
+
+inline string CandleFile_test_file(const string& name) {
+    const string folder = ".data/test/candles";
+    if (!file_exists(folder) && !mkdir(folder, true))
+        throw ERROR("Unable to create folder: " + folder);
+    return folder + "/" + name + ".dat";
+}
+
+inline vector<Candle> CandleFile_test_candles(time_sec start, size_t count) {
+    vector<Candle> candles;
+    for (size_t i = 0; i < count; i++)
+        candles.emplace_back(start + i * 60, 1, 2, 0.5f, 1.5f, i);
+    return candles;
+}
+
+TEST(test_CandleFile_save_and_load_with_header) {
+    const string file = CandleFile_test_file("header");
+    vector<Candle> candles = CandleFile_test_candles(6000, 10);
+    CandleFile::save(file, candles, "BTCUSDT", "1m");
+
+    CandleFileHeader header;
+    assert(CandleFile::readHeader(file, header) && "Saved file should have a header");
+    assert(header.count == 10 && header.lastTime == 6000 + 9 * 60 && "Header should describe the candles");
+    assert(header.getSymbol() == "BTCUSDT" && header.getInterval() == "1m" && "Header should name the pair");
+
+    vector<Candle> result = CandleFile::load(file);
+    assert(result.size() == 10 && result.back().getTime() == header.lastTime && "Load should return saved candles");
+}
+
+TEST(test_CandleFile_append_writes_only_new_candles) {
+    const string file = CandleFile_test_file("append");
+    CandleFile::save(file, CandleFile_test_candles(6000, 5), "BTCUSDT", "1m");
+    CandleFile::append(file, CandleFile_test_candles(6300, 3), "BTCUSDT", "1m");
+
+    vector<Candle> result = CandleFile::load(file);
+    assert(result.size() == 8 && "Appended candles should follow the old ones");
+    assert(result[5].getTime() == 6300 && result.back().getTime() == 6420 && "Appended candles should be in order");
+}
+
+TEST(test_CandleFile_append_drops_uncommitted_tail) {
+    const string file = CandleFile_test_file("uncommitted");
+    CandleFile::save(file, CandleFile_test_candles(6000, 5), "BTCUSDT", "1m");
+    // simulate an append interrupted before the header update
+    vector<Candle> garbage = CandleFile_test_candles(99999, 2);
+    int fd = ::open(file.c_str(), O_WRONLY | O_APPEND);
+    assert(::write(fd, garbage.data(), garbage.size() * sizeof(Candle)) > 0);
+    ::close(fd);
+
+    CandleFile::append(file, CandleFile_test_candles(6300, 1), "BTCUSDT", "1m");
+    vector<Candle> result = CandleFile::load(file);
+    assert(result.size() == 6 && result.back().getTime() == 6300 && "Uncommitted records should be dropped");
+}
+
+TEST(test_CandleFile_loads_and_converts_legacy_headerless_file) {
+    const string file = CandleFile_test_file("legacy");
+    vector_save<Candle>(CandleFile_test_candles(6000, 4), file);
+    assert(CandleFile::dataOffset(file) == 0 && "Legacy file should have no header");
+    assert(CandleFile::load(file).size() == 4 && "Legacy file should still load");
+
+    CandleFile::append(file, CandleFile_test_candles(6240, 2), "BTCUSDT", "1m");
+    assert(CandleFile::dataOffset(file) == sizeof(CandleFileHeader) && "Append should convert to the versioned format");
+    assert(CandleFile::load(file).size() == 6 && "Converted file should keep old and new candles");
+}
+
+TEST(test_CandleFile_load_detects_corruption) {
+    const string file = CandleFile_test_file("corrupt");
+    CandleFile::save(file, CandleFile_test_candles(6000, 4), "BTCUSDT", "1m");
+    int fd = ::open(file.c_str(), O_WRONLY);
+    float bad = 12345;
+    assert(::pwrite(fd, &bad, sizeof(bad), sizeof(CandleFileHeader) + sizeof(Candle) + sizeof(time_sec)) > 0);
+    ::close(fd);
+
+    bool thrown = false;
+    try {
+        CandleFile::load(file);
+    } catch (exception&) {
+        thrown = true;
+    }
+    assert(thrown && "Corrupted candles should fail the checksum");
+}
+
+TEST(test_CandleFile_range_load_seeks_through_index) {
+    const string file = CandleFile_test_file("indexed");
+    const size_t count = CandleFile::INDEX_STRIDE * 3 + 100;
+    CandleFile::save(file, CandleFile_test_candles(0, count - 500), "BTCUSDT", "1m");
+    CandleFile::append(file, CandleFile_test_candles((count - 500) * 60, 500), "BTCUSDT", "1m");
+
+    CandleFileHeader header;
+    assert(CandleFile::readHeader(file, header) && header.count == count);
+    vector<CandleIndexEntry> index;
+    assert(CandleFile::readIndex(file, count, index) && index.size() == 4 && "Index should follow appends");
+    assert(index[2].time == (time_sec)(2 * CandleFile::INDEX_STRIDE * 60) && "Entries should sample every stride");
+
+    time_sec start = 5000 * 60;
+    time_sec end = 5010 * 60;
+    auto [first, last] = CandleFile::indexWindow(file, header, start, end);
+    assert(first == CandleFile::INDEX_STRIDE && last == 2 * CandleFile::INDEX_STRIDE && "Window should be one stride");
+
+    vector<Candle> result = CandleFile::load(file, start, end);
+    assert(result.size() == 11 && result.front().getTime() == start && result.back().getTime() == end &&
+           "Range load should return the inclusive window");
+    assert(CandleFile::load(file, (count - 1) * 60, numeric_limits<time_sec>::max()).size() == 1 &&
+           "Range load should reach the last record");
+}
+
+TEST(test_CandleFile_stale_index_falls_back_to_full_window) {
+    const string file = CandleFile_test_file("stale");
+    CandleFile::save(file, CandleFile_test_candles(0, 10), "BTCUSDT", "1m");
+    ::unlink(CandleFile::indexFile(file).c_str());
+
+    CandleFileHeader header;
+    CandleFile::readHeader(file, header);
+    auto [first, last] = CandleFile::indexWindow(file, header, 120, 180);
+    assert(first == 0 && last == 10 && "Missing index should cover the whole file");
+    assert(CandleFile::load(file, 120, 180).size() == 2 && "Range load should still work");
+}
+
+#endif
@@ -2,15 +2,27 @@
 
 #include <string>
 #include <vector>
+#include <limits>
+#include <fstream>
+#include <utility>
+#include <algorithm>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "../misc/file_exists.hpp"
 #include "../misc/mkdir.hpp"
-#include "../misc/vector_load.hpp"
-#include "../misc/vector_save.hpp"
 #include "../misc/get_absolute_path.hpp"
-#include "../math/linear_interpolation_search.hpp"
-#include "../misc/array_slice.hpp"
 #include "Candle.hpp"
+#include "CandleFile.hpp"
+#include "CandleStream.hpp"
+#include "CandleBlockFile.hpp"
+#include "CandleStorage.hpp"
+#include "MappedCandles.hpp"
+#include "CandleColumns.hpp"
+#include "CandleResampler.hpp"
+#include "intervalToSecond.hpp"
 
 using namespace std;
 
@@ -22,51 +34,156 @@ public:
 
     virtual string folder() = 0;
 
+    CandleStorage getStorage() const { return storage; }
+    void setStorage(CandleStorage storage) { this->storage = storage; }
+
+    // With a base interval set, the loads derive every other interval from
+    // the stored base candles (e.g. 15m/1h/4h/1d from 1m) instead of reading
+    // a separately downloaded file. Empty: each interval is stored on its own.
+    string getBaseInterval() const { return baseInterval; }
+    void setBaseInterval(const string& baseInterval) { this->baseInterval = baseInterval; }
+
+    // Keep derived intervals on disk, rebuilt when the base file changes.
+    bool getResampleCache() const { return resampleCache; }
+    void setResampleCache(bool resampleCache) { this->resampleCache = resampleCache; }
+
+    bool isDerived(const string& interval) const {
+        return !baseInterval.empty() && interval != baseInterval;
+    }
+
+    // The interval whose file holds the candles: the base for derived ones.
+    // Updates and repairs of a derived interval are done on its base.
+    string storedInterval(const string& interval) const {
+        return isDerived(interval) ? baseInterval : interval;
+    }
+
     string filename(const string& symbol, const string& interval) {
         string folder = ".data/" + this->folder() + "/candles";
         if (!file_exists(folder) && !mkdir(folder, true))
             throw ERROR("Unable to create folder: " + folder);
         return get_absolute_path(
-            folder + "/" + symbol + "-" + interval + ".dat"
+            folder + "/" + symbol + "-" + interval + 
+            (storage == CandleStorage::BLOCKS ? ".cdat" : ".dat")
         );
     }
     
     vector<Candle> load(const string& symbol, const string& interval) {
-        vector<Candle> candles;
+        if (isDerived(interval)) return loadMapped(symbol, interval).toVector();
         string file = filename(symbol, interval);
         // LOG_DEBUG("Load:" + file);
-        if (file_exists(file)) vector_load<Candle>(candles, file);
-        return candles;
+        if (storage == CandleStorage::BLOCKS) return CandleBlockFile::load(file);
+        return CandleFile::load(file);
     }
 
     vector<Candle> load(
         const string& symbol, const string& interval, time_sec from
     ) {
-        vector<Candle> candles = load(symbol, interval);
-        size_t first = linear_interpolation_search<Candle, time_sec>(
-            candles, from, [](const Candle& candle) -> time_sec {
-                return candle.getTime();
-            }, true
-        );
-        return array_slice(candles, first);
+        return load(symbol, interval, from, numeric_limits<time_sec>::max());
     }
 
+    // Range loads seek through the block or sidecar index and read only
+    // the records of [period_start, period_end] (inclusive).
     vector<Candle> load(
         const string& symbol, const string& interval, 
         time_sec period_start, time_sec period_end
     ) {
-        vector<Candle> candles = load(symbol, interval, period_start);
+        if (isDerived(interval)) return loadMapped(symbol, interval, period_start, period_end).toVector();
+        string file = filename(symbol, interval);
+        if (storage == CandleStorage::BLOCKS)
+            return CandleBlockFile::load(file, period_start, period_end);
+        return CandleFile::load(file, period_start, period_end);
+    }
 
-        size_t last = linear_interpolation_search<Candle, time_sec>(
-            candles, period_end, [](const Candle& candle) -> time_sec {
-                return candle.getTime();
-            }, true
-        );
-        
-        // Include all candles from start to last (inclusive)
-        return array_slice(candles, 0, last + 1);
+    // Zero-copy alternatives of load(): a read-only view over the mapped file.
+    // Compressed storage can not be mapped, the view owns the decoded range instead.
+    MappedCandles loadMapped(const string& symbol, const string& interval) {
+        return loadMapped(symbol, interval, 
+            numeric_limits<time_sec>::min(), numeric_limits<time_sec>::max());
+    }
+
+    MappedCandles loadMapped(
+        const string& symbol, const string& interval, time_sec from
+    ) {
+        return loadMapped(symbol, interval, from, numeric_limits<time_sec>::max());
     }
 
+    MappedCandles loadMapped(
+        const string& symbol, const string& interval, 
+        time_sec period_start, time_sec period_end
+    ) {
+        if (isDerived(interval)) return loadResampled(symbol, interval, period_start, period_end);
+        string file = filename(symbol, interval);
+        if (storage == CandleStorage::BLOCKS)
+            return MappedCandles(CandleBlockFile::load(file, period_start, period_end));
+        return mapRange(file, period_start, period_end);
+    }
+
+    // Streamed alternative of the range loads for periods larger than
+    // memory: chunks read ahead by a background thread into `buffers`
+    // buffers of `chunk` candles. Raw files are read record by record,
+    // compressed and derived candles slice by slice (a chunk's worth of
+    // time, aligned to the interval's candles).
+    unique_ptr<CandleStream> stream(
+        const string& symbol, const string& interval,
+        time_sec period_start, time_sec period_end,
+        size_t chunk = CandleStream::DEFAULT_CHUNK, size_t buffers = 2
+    ) {
+        if (storage == CandleStorage::RAW && !isDerived(interval))
+            return make_unique<CandleStream>(CandleStream::fileReader(filename(symbol, interval), period_start, period_end), chunk, buffers);
+        const CandleResampler buckets(intervalToSecond(interval));
+        return make_unique<CandleStream>(CandleStream::sliceReader(
+            [this, symbol, interval](time_sec from, time_sec to) { return load(symbol, interval, from, to); },
+            period_start, period_end, buckets.getPeriod() * chunk, buckets.bucket(0) // weeks from a Monday
+        ), chunk, buffers);
+    }
+
+    // Candles of `interval` aggregated from the base interval in one pass
+    // over the mapped base candles; only complete buckets are returned.
+    MappedCandles loadResampled(
+        const string& symbol, const string& interval,
+        time_sec period_start, time_sec period_end
+    ) {
+        if (baseInterval.empty()) throw ERROR("No base interval to resample " + interval + " from");
+        CandleResampler resampler(intervalToSecond(interval), intervalToSecond(baseInterval));
+        if (resampleCache) {
+            string file = resampledFilename(symbol, interval);
+            if (!isResampleCacheFresh(symbol, file)) {
+                vector<Candle> candles;
+                MappedCandles base = loadMapped(symbol, baseInterval);
+                CandleResampler::resample(base, resampler.getPeriod(), intervalToSecond(baseInterval), candles);
+                CandleFile::save(file, candles, symbol, interval);
+                ofstream marker(file + ".base", ios::trunc);
+                marker << baseSignature(symbol);
+                marker.close();
+                if (!marker) throw ERROR("Unable to write: " + file + ".base");
+            }
+            return mapRange(file, period_start, period_end);
+        }
+        // base candles of the buckets overlapping the requested window
+        const time_sec from = period_start == numeric_limits<time_sec>::min() ? period_start : resampler.bucket(period_start);
+        const time_sec to = period_end > numeric_limits<time_sec>::max() - resampler.getPeriod() ?
+            period_end : resampler.bucket(period_end) + resampler.getPeriod() - 1;
+        vector<Candle> candles;
+        MappedCandles base = loadMapped(symbol, baseInterval, from, to);
+        for (const Candle& candle: base) resampler.push(candle, candles);
+        resampler.finish(candles);
+        return MappedCandles(move(candles)).slice(period_start, period_end);
+    }
+
+    string resampledFilename(const string& symbol, const string& interval) {
+        string folder = ".data/" + this->folder() + "/resampled";
+        if (!file_exists(folder) && !mkdir(folder, true))
+            throw ERROR("Unable to create folder: " + folder);
+        return get_absolute_path(folder + "/" + symbol + "-" + interval + "-" + baseInterval + ".dat");
+    }
+
+    // Columnar (structure-of-arrays) load, transposed straight from the mapping.
+    CandleColumns loadColumns(
+        const string& symbol, const string& interval, 
+        time_sec period_start, time_sec period_end
+    ) {
+        return CandleColumns(loadMapped(symbol, interval, period_start, period_end));
+    }
 
     void save(
         const vector<Candle>& candles, 
@@ -74,29 +191,161 @@ public:
         const string& interval
     ) {
         string file = filename(symbol, interval);
-        vector_save<Candle>(candles, file);
+        if (storage == CandleStorage::BLOCKS) CandleBlockFile::save(file, candles, symbol, interval);
+        else CandleFile::save(file, candles, symbol, interval);
+    }
+
+    // Writes only the given (newer) candles after the stored ones.
+    void append(
+        const vector<Candle>& candles, 
+        const string& symbol, 
+        const string& interval
+    ) {
+        string file = filename(symbol, interval);
+        if (storage == CandleStorage::BLOCKS) CandleBlockFile::append(file, candles, symbol, interval);
+        else CandleFile::append(file, candles, symbol, interval);
     }
 
+    // Writes the given candles (ordered by time) over the stored ones:
+    // candles at a stored time replace it, the others are inserted in order.
+    // Stored candles inside `periods` ([start, end] inclusive, e.g. the
+    // re-fetched days) are dropped first, so a period republished with
+    // fewer candles keeps only the new ones.
+    // Rewrites the whole file, meant for rare corrections.
+    void replace(
+        const vector<Candle>& candles, 
+        const string& symbol, 
+        const string& interval,
+        const vector<pair<time_sec, time_sec>>& periods = {}
+    ) {
+        if (candles.empty() && periods.empty()) return;
+        vector<Candle> stored = load(symbol, interval);
+        if (!periods.empty()) {
+            vector<pair<time_sec, time_sec>> dropped = periods;
+            sort(dropped.begin(), dropped.end());
+            size_t p = 0;
+            stored.erase(remove_if(stored.begin(), stored.end(), [&](const Candle& candle) {
+                while (p < dropped.size() && dropped[p].second < candle.getTime()) p++;
+                return p < dropped.size() && dropped[p].first <= candle.getTime();
+            }), stored.end());
+        }
+        vector<Candle> merged;
+        merged.reserve(stored.size() + candles.size());
+        size_t i = 0;
+        for (const Candle& candle: candles) {
+            while (i < stored.size() && stored[i].getTime() < candle.getTime()) merged.push_back(stored[i++]);
+            if (i < stored.size() && stored[i].getTime() == candle.getTime()) i++;
+            merged.push_back(candle);
+        }
+        merged.insert(merged.end(), stored.begin() + i, stored.end());
+        save(merged, symbol, interval);
+        dropResampleCaches(symbol, interval);
+    }
+
+    // Time of the last stored candle (0 when there is none), without loading
+    // the history. Derived intervals: the last complete bucket, resampled
+    // from the end of the base only.
+    time_sec lastTime(const string& symbol, const string& interval) {
+        if (isDerived(interval)) {
+            const time_sec base = lastTime(symbol, baseInterval);
+            if (!base) return 0;
+            CandleResampler resampler(intervalToSecond(interval), intervalToSecond(baseInterval));
+            MappedCandles last = loadMapped(symbol, interval, resampler.bucket(base) - resampler.getPeriod());
+            if (last.empty()) last = loadMapped(symbol, interval); // a gap before the end
+            return last.empty() ? 0 : last.back().getTime();
+        }
+        string file = filename(symbol, interval);
+        if (storage == CandleStorage::BLOCKS) return CandleBlockFile::lastTime(file);
+        CandleFileHeader header;
+        if (CandleFile::readHeader(file, header)) return header.lastTime;
+        MappedCandles candles(file);
+        return candles.empty() ? 0 : candles.back().getTime();
+    }
+
+    // Number of stored candles, from the header when there is one. Derived
+    // intervals: the complete buckets, from the resample cache when it is
+    // on, resampled from the base otherwise.
+    size_t count(const string& symbol, const string& interval) {
+        if (isDerived(interval)) return loadMapped(symbol, interval).size();
+        string file = filename(symbol, interval);
+        if (storage == CandleStorage::BLOCKS) {
+            CandleBlockFileHeader header;
+            return CandleBlockFile::readHeader(file, header) ? header.count : 0;
+        }
+        CandleFileHeader header;
+        if (CandleFile::readHeader(file, header)) return header.count;
+        return MappedCandles(file).size();
+    }
+
+    // Downloads the new candles of a stored interval (see storedInterval()).
     virtual void update(const string& symbol, const string& interval) = 0;
 
+    // Re-checks the stored history against its source and fixes what
+    // changed; sources that cannot verify only update.
+    virtual void repair(const string& symbol, const string& interval) {
+        update(symbol, storedInterval(interval));
+    }
+
+    // Same inclusive window as the range loads, found by binary search.
     static vector<Candle> slice(
         const vector<Candle>& candles, 
         time_sec period_start, time_sec period_end
     ) {
-        auto getter = [](const Candle& candle) -> time_sec {
-            return candle.getTime();
-        };
+        span<const Candle> window = CandleFile::range(candles, period_start, period_end);
+        return vector<Candle>(window.begin(), window.end());
+    }
 
-        size_t first = linear_interpolation_search<Candle, time_sec>(
-            candles, period_start, getter, true
-        );
-        size_t last = linear_interpolation_search<Candle, time_sec>(
-            candles, period_end, getter, true
-        );
+protected:
+
+    // Headered files are windowed through their index, legacy ones are searched.
+    static MappedCandles mapRange(const string& file, time_sec period_start, time_sec period_end) {
+        CandleFileHeader header;
+        if (CandleFile::readHeader(file, header)) {
+            auto [first, last] = CandleFile::indexWindow(file, header, period_start, period_end);
+            return MappedCandles(file, sizeof(header), header.count)
+                .window(first, last).slice(period_start, period_end);
+        }
+        return MappedCandles(file).slice(period_start, period_end);
+    }
 
-        // Return contiguous slice from first to last (inclusive)
-        return array_slice(candles, first, (last - first) + 1);
+    // The cache remembers the count and last time of the base file it was built from.
+    bool isResampleCacheFresh(const string& symbol, const string& file) {
+        ifstream in(file + ".base");
+        string signature;
+        if (!getline(in, signature) || !file_exists(file)) return false;
+        return signature == baseSignature(symbol);
     }
+
+    // Identifies the stored base candles: count, last time and records'
+    // checksum of a headered file; size and modification time of the others
+    // (blocks, legacy), whose rewrites replace() reports on its own.
+    string baseSignature(const string& symbol) {
+        const string file = filename(symbol, baseInterval);
+        CandleFileHeader header;
+        if (storage == CandleStorage::RAW && CandleFile::readHeader(file, header))
+            return to_string(header.count) + " " + to_string(header.lastTime) + " " + to_string(header.checksum);
+        struct stat st;
+        if (::stat(file.c_str(), &st)) return "";
+        return to_string(st.st_size) + " " + to_string(st.st_mtim.tv_sec) + "." + to_string(st.st_mtim.tv_nsec);
+    }
+
+    // Rewritten candles may keep the size (and the time stamp on coarse
+    // clocks): the caches resampled from them are rebuilt on their next load.
+    void dropResampleCaches(const string& symbol, const string& interval) {
+        const string folder = ".data/" + this->folder() + "/resampled";
+        DIR* dir = ::opendir(folder.c_str());
+        if (!dir) return;
+        const string prefix = symbol + "-", suffix = "-" + interval + ".dat.base";
+        for (dirent* entry = ::readdir(dir); entry; entry = ::readdir(dir)) {
+            const string name = entry->d_name;
+            if (name.starts_with(prefix) && name.ends_with(suffix)) ::unlink((folder + "/" + name).c_str());
+        }
+        ::closedir(dir);
+    }
+
+    CandleStorage storage = CandleStorage::RAW;
+    string baseInterval;
+    bool resampleCache = false;
 };
 
 
@@ -207,4 +456,238 @@ TEST(test_CandleHistory_save_and_load_roundtrip) {
     }
 }
 
+TEST(test_CandleHistory_loadMapped_matches_load) {
+    MockCandleHistory history;
+    vector<Candle> testCandles = MockCandleHistory::createTestCandles(1000, 2000, 100);
+    history.save(testCandles, "MAPPED", "1m");
+
+    MappedCandles all = history.loadMapped("MAPPED", "1m");
+    assert(all.size() == testCandles.size() && "Mapped view should cover the whole file");
+
+    MappedCandles result = history.loadMapped("MAPPED", "1m", 1200, 1800);
+    vector<Candle> expected = history.load("MAPPED", "1m", 1200, 1800);
+    assert(result.size() == expected.size() && "Mapped range should match loaded range");
+    for (size_t i = 0; i < expected.size(); i++)
+        assert(result[i].getTime() == expected[i].getTime() && "Mapped candles should match loaded candles");
+
+    MappedCandles after = history.loadMapped("MAPPED", "1m", 1500);
+    assert(after.size() == 6 && after.front().getTime() == 1500 && after.back().getTime() == 2000 &&
+           "Mapped view from a start time should run to the end");
+}
+
+TEST(test_CandleHistory_loadMapped_ignores_uncommitted_records) {
+    MockCandleHistory history;
+    history.save(MockCandleHistory::createTestCandles(1000, 2000, 100), "UNCOMMITTED", "1m");
+    // an append interrupted before the header update leaves records past the count
+    vector<Candle> garbage = MockCandleHistory::createTestCandles(2100, 2300, 100);
+    const string file = history.filename("UNCOMMITTED", "1m");
+    int fd = ::open(file.c_str(), O_WRONLY | O_APPEND);
+    assert(fd >= 0 && ::write(fd, garbage.data(), garbage.size() * sizeof(Candle)) == (ssize_t)(garbage.size() * sizeof(Candle)));
+    ::close(fd);
+
+    assert(history.load("UNCOMMITTED", "1m").size() == 11 && "Loads should stop at the committed count");
+    MappedCandles all = history.loadMapped("UNCOMMITTED", "1m");
+    assert(all.size() == 11 && all.back().getTime() == 2000 && "Mapped loads should stop at the committed count too");
+    assert(history.loadMapped("UNCOMMITTED", "1m", 1500).size() == 6 && "Mapped ranges should not reach uncommitted records");
+}
+
+TEST(test_CandleHistory_loadMapped_returns_empty_view_for_nonexistent_file) {
+    MockCandleHistory history;
+    MappedCandles result = history.loadMapped("NONEXISTENT", "1m", 0, 1000);
+    assert(result.empty() && "Should return empty view for nonexistent file");
+}
+
+TEST(test_CandleHistory_loadMapped_slice_outlives_parent_view) {
+    MockCandleHistory history;
+    history.save(MockCandleHistory::createTestCandles(1000, 2000, 100), "MAPPED", "1m");
+    MappedCandles slice;
+    {
+        MappedCandles all = history.loadMapped("MAPPED", "1m");
+        slice = all.slice(1300, 1700);
+    }
+    assert(slice.size() == 5 && slice.front().getTime() == 1300 && slice.back().getTime() == 1700 &&
+           "Slices should keep the mapping alive");
+}
+
+TEST(test_CandleHistory_loadColumns_returns_range_as_columns) {
+    MockCandleHistory history;
+    history.save(MockCandleHistory::createTestCandles(1000, 2000, 100), "COLUMNS", "1m");
+
+    CandleColumns result = history.loadColumns("COLUMNS", "1m", 1200, 1800);
+    assert(result.size() == 7 && "Should return 7 candles for range 1200-1800");
+    assert(result.times().front() == 1200 && result.times().back() == 1800 &&
+           "Columns should cover the requested range");
+}
+
+TEST(test_CandleHistory_append_extends_history) {
+    MockCandleHistory history;
+    history.save(MockCandleHistory::createTestCandles(1000, 1500, 100), "APPEND", "1m");
+    history.append(MockCandleHistory::createTestCandles(1600, 2000, 100), "APPEND", "1m");
+
+    assert(history.lastTime("APPEND", "1m") == 2000 && "Last time should come from the header");
+    vector<Candle> result = history.load("APPEND", "1m");
+    assert(result.size() == 11 && "Should return old and appended candles");
+    MappedCandles mapped = history.loadMapped("APPEND", "1m", 1500, 1600);
+    assert(mapped.size() == 2 && mapped.front().getTime() == 1500 && "Mapped view should skip the header");
+}
+
+TEST(test_CandleHistory_replace_overwrites_and_inserts_by_time) {
+    MockCandleHistory history;
+    history.save(MockCandleHistory::createTestCandles(1000, 2000, 100), "REPLACE", "1m");
+    vector<Candle> fixes = { Candle(1050, 1, 1, 1, 1, 1), Candle(1100, 2, 2, 2, 2, 2), Candle(2100, 3, 3, 3, 3, 3) };
+    history.replace(fixes, "REPLACE", "1m");
+
+    vector<Candle> result = history.load("REPLACE", "1m");
+    assert(result.size() == 13 && "New times should be inserted, existing ones replaced");
+    assert(result[1].getTime() == 1050 && result[2].getTime() == 1100 && result[2].getClose() == 2 &&
+           "Replaced candles should keep the time order");
+    assert(result.back().getTime() == 2100 && history.lastTime("REPLACE", "1m") == 2100 && "Header should follow the rewrite");
+}
+
+TEST(test_CandleHistory_replace_drops_the_republished_periods) {
+    MockCandleHistory history;
+    const time_sec day = 24 * 60 * 60;
+    history.save(MockCandleHistory::createTestCandles(0, 3 * day - 60, 60), "REPUBLISH", "1m");
+    // the second day republished with fewer candles
+    vector<Candle> republished = MockCandleHistory::createTestCandles(day, day + 999 * 60, 60);
+    for (Candle& candle: republished) candle.setClose(7);
+    history.replace(republished, "REPUBLISH", "1m", { { day, 2 * day - 1 } });
+
+    vector<Candle> loaded = history.load("REPUBLISH", "1m", day, 2 * day - 1);
+    assert(loaded.size() == republished.size() && "The republished day should hold only its new candles");
+    for (size_t i = 0; i < loaded.size(); i++)
+        assert(loaded[i].getTime() == republished[i].getTime() && loaded[i].getClose() == 7 && "Republished candles");
+    assert(history.count("REPUBLISH", "1m") == 2 * 1440 + 1000 && "The other days should stay untouched");
+}
+
+TEST(test_CandleHistory_derives_intervals_from_base) {
+    MockCandleHistory history;
+    vector<Candle> minutes;
+    for (int i = 0; i < 240; i++) minutes.push_back(Candle(3600 + i * 60, i, i + 1, i - 1, i + 0.5, 2)); // 4 hours
+    history.save(minutes, "DERIVE", "1m");
+    history.setBaseInterval("1m");
+
+    vector<Candle> hours = history.load("DERIVE", "1h");
+    assert(hours.size() == 4 && hours[1].getTime() == 7200 && "Should aggregate the base into hours");
+    assert(hours[1].getOpen() == 60 && hours[1].getHigh() == 120 && hours[1].getLow() == 59 &&
+           hours[1].getClose() == 119.5 && hours[1].getVolume() == 120 && "Buckets should aggregate their base candles");
+    vector<Candle> window = history.load("DERIVE", "1h", 7300, 10800);
+    assert(window.size() == 1 && window[0].dump() == hours[2].dump() && "Range loads should keep the bucket times inclusive");
+    assert(history.loadMapped("DERIVE", "1m").size() == 240 && "The base interval should load as stored");
+}
+
+TEST(test_CandleHistory_derived_intervals_count_and_repair_through_the_base) {
+    class UpdatedCandleHistory: public MockCandleHistory {
+    public:
+        vector<string> updated;
+        void update(const string& symbol, const string& interval) override {
+            updated.push_back(symbol + " " + interval);
+        }
+    } history;
+    vector<Candle> minutes;
+    const time_sec start = 4 * 3600;
+    for (int i = 0; i < 250; i++) minutes.push_back(Candle(start + i * 60, i, i + 1, i - 1, i, 1)); // 4 hours and 10 minutes
+    history.save(minutes, "DERIVED", "1m");
+    history.setBaseInterval("1m");
+    assert(history.count("DERIVED", "1h") == 4 && history.lastTime("DERIVED", "1h") == start + 3 * 3600 && "Derived counts should be complete buckets");
+    assert(history.count("DERIVED", "4h") == 1 && history.lastTime("DERIVED", "4h") == start && "The unfinished bucket should not count");
+    assert(history.count("DERIVED", "1m") == 250 && history.lastTime("DERIVED", "1m") == start + 249 * 60 && "The base as stored");
+
+    history.repair("DERIVED", "1h");
+    assert((history.updated == vector<string>{ "DERIVED 1m" }) && "Repairs should go to the base");
+    assert(!file_exists(history.filename("DERIVED", "1h")) && "Nothing should be stored for a derived interval");
+}
+
+TEST(test_CandleHistory_resample_cache_is_rebuilt_when_base_grows) {
+    MockCandleHistory history;
+    history.save(MockCandleHistory::createTestCandles(3600, 3600 * 3 - 60, 60), "CACHE", "1m");
+    history.setBaseInterval("1m");
+    history.setResampleCache(true);
+    assert(history.load("CACHE", "1h").size() == 2 && "Should build the cache");
+    assert(file_exists(history.resampledFilename("CACHE", "1h")) && "Cache should be on disk");
+
+    history.append(MockCandleHistory::createTestCandles(3600 * 3, 3600 * 4 - 60, 60), "CACHE", "1m");
+    vector<Candle> hours = history.load("CACHE", "1h");
+    assert(hours.size() == 3 && hours.back().getTime() == 3600 * 3 && "Grown base should rebuild the cache");
+    history.setResampleCache(false);
+    vector<Candle> direct = history.load("CACHE", "1h");
+    for (size_t i = 0; i < hours.size(); i++)
+        assert(hours[i].dump() == direct[i].dump() && "Cached and direct resampling should match");
+}
+
+TEST(test_CandleHistory_resample_cache_follows_replaced_candles) {
+    for (CandleStorage storage: { CandleStorage::RAW, CandleStorage::BLOCKS }) {
+        MockCandleHistory history;
+        history.setStorage(storage);
+        history.save(MockCandleHistory::createTestCandles(3600, 3600 * 3 - 60, 60), "REPAIRED", "1m");
+        history.setBaseInterval("1m");
+        history.setResampleCache(true);
+        const float close = history.load("REPAIRED", "1h").back().getClose();
+
+        // the same candles of the last hour with corrected prices
+        vector<Candle> corrected = MockCandleHistory::createTestCandles(7200, 3600 * 3 - 60, 60);
+        for (Candle& candle: corrected) candle.setClose(candle.getClose() + 1000);
+        history.replace(corrected, "REPAIRED", "1m", { { 7200, 3600 * 3 - 1 } });
+        vector<Candle> hours = history.load("REPAIRED", "1h");
+        assert(history.count("REPAIRED", "1m") == 120 && hours.size() == 2 && "Same count and last time as before");
+        assert(hours.back().getClose() == close + 1000 && "The derived hour should follow the replaced candles");
+    }
+}
+
+TEST(test_CandleHistory_blocks_storage_roundtrip) {
+    MockCandleHistory history;
+    history.setStorage(CandleStorage::BLOCKS);
+    assert(str_contains(history.filename("BTCUSDT", "1h"), "BTCUSDT-1h.cdat") &&
+           "Compressed storage should use its own extension");
+
+    history.save(MockCandleHistory::createTestCandles(1000, 1500, 100), "BLOCKS", "1m");
+    history.append(MockCandleHistory::createTestCandles(1600, 2000, 100), "BLOCKS", "1m");
+    assert(history.load("BLOCKS", "1m").size() == 11 && "Should load all candles");
+    assert(history.lastTime("BLOCKS", "1m") == 2000 && "Last time should come from the index");
+
+    vector<Candle> result = history.load("BLOCKS", "1m", 1200, 1800);
+    assert(result.size() == 7 && result.front().getTime() == 1200 && result.back().getTime() == 1800 &&
+           "Range load should decode the requested window");
+    MappedCandles mapped = history.loadMapped("BLOCKS", "1m", 1500);
+    assert(mapped.size() == 6 && mapped.front().getTime() == 1500 && "View should own the decoded range");
+}
+
+
+TEST(test_CandleHistory_streams_every_storage) {
+    vector<Candle> candles = MockCandleHistory::createTestCandles(60000, 60000 + 9999 * 60, 60);
+    for (CandleStorage storage: { CandleStorage::RAW, CandleStorage::BLOCKS }) {
+        MockCandleHistory history;
+        history.setStorage(storage);
+        history.save(candles, "STREAM", "1m");
+        unique_ptr<CandleStream> stream = history.stream("STREAM", "1m", 60000 + 100 * 60, 60000 + 8000 * 60, 512, 3);
+        vector<Candle> streamed;
+        for (span<const Candle> chunk = stream->next(); !chunk.empty(); chunk = stream->next())
+            streamed.insert(streamed.end(), chunk.begin(), chunk.end());
+        vector<Candle> loaded = history.load("STREAM", "1m", 60000 + 100 * 60, 60000 + 8000 * 60);
+        assert(streamed.size() == 7901 && streamed.size() == loaded.size() && "Stream should hold the range");
+        for (size_t i = 0; i < loaded.size(); i += 97)
+            assert(streamed[i].dump() == loaded[i].dump() && "Stream should give the loaded candles");
+    }
+}
+
+TEST(test_CandleHistory_streams_derived_intervals_from_an_unaligned_start) {
+    MockCandleHistory history;
+    vector<Candle> minutes;
+    for (int i = 0; i < 36 * 24 * 60; i++) minutes.push_back(Candle(i * 60, i, i + 1, i - 1, i, 1)); // 36 days from a Thursday
+    history.save(minutes, "UNALIGNED", "1m");
+    history.setBaseInterval("1m");
+    const time_sec end = 36 * 24 * 3600 - 1;
+    for (auto [interval, chunk]: vector<pair<string, size_t>>{ { "1h", 5 }, { "4h", 7 }, { "1w", 1 } }) {
+        const time_sec start = 3 * 3600 + 1234; // inside a bucket
+        unique_ptr<CandleStream> stream = history.stream("UNALIGNED", interval, start, end, chunk, 2);
+        vector<Candle> streamed;
+        for (span<const Candle> candles = stream->next(); !candles.empty(); candles = stream->next())
+            streamed.insert(streamed.end(), candles.begin(), candles.end());
+        vector<Candle> loaded = history.load("UNALIGNED", interval, start, end);
+        assert(!loaded.empty() && streamed.size() == loaded.size() && "Slices should not lose the buckets at their boundaries");
+        for (size_t i = 0; i < loaded.size(); i++)
+            assert(streamed[i].dump() == loaded[i].dump() && "Streamed buckets should be the loaded ones");
+    }
+}
+
 #endif
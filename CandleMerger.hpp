@@ -0,0 +1,108 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "Candle.hpp"
+
+using namespace std;
+
+// Time-ordered k-way merge of candle streams (one per symbol, each sorted
+// by time). next() returns the candles of the next timestamp, one per
+// stream that has one, in stream order: streams listed later simply join
+// when their first candle comes, gaps leave the stream out of those
+// timestamps, finished streams are dropped. The streams are read in place
+// (mapped views).
+// Streams of one interval share their timestamps, so instead of a heap the
+// next times of the live streams are kept in one flat array: a timestamp
+// is a min pass and a collect pass over it, O(1) per returned candle and
+// sequential in memory. (Universes with mostly disjoint timestamps would
+// pay O(streams) per timestamp.) Nothing is allocated after construction.
+class CandleMerger {
+public:
+    struct Event {
+        uint32_t stream;
+        const Candle* candle;
+    };
+
+    CandleMerger(const vector<span<const Candle>>& streams): streams(streams) {
+        cursors.assign(streams.size(), 0);
+        events.reserve(streams.size());
+        for (uint32_t i = 0; i < streams.size(); i++)
+            if (!streams[i].empty()) {
+                times.push_back(streams[i].front().getTime());
+                live.push_back(i);
+            }
+    }
+
+    virtual ~CandleMerger() {}
+
+    // Candles of the next timestamp; empty when every stream is done.
+    span<const Event> next() {
+        events.clear();
+        if (live.empty()) return events;
+        time = times[0];
+        for (time_sec next: times) time = min(time, next);
+        size_t kept = 0;
+        for (size_t j = 0; j < live.size(); j++) {
+            const uint32_t stream = live[j];
+            if (times[j] == time) {
+                const span<const Candle>& candles = streams[stream];
+                events.push_back({ stream, &candles[cursors[stream]] });
+                if (++cursors[stream] == candles.size()) continue; // finished
+                times[j] = candles[cursors[stream]].getTime();
+                __builtin_prefetch(candles.data() + min(cursors[stream] + PREFETCH, candles.size() - 1));
+            }
+            times[kept] = times[j];
+            live[kept++] = stream;
+        }
+        times.resize(kept);
+        live.resize(kept);
+        return events;
+    }
+
+    // Time of the last next().
+    time_sec getTime() const { return time; }
+
+    size_t getStreamCount() const { return streams.size(); }
+
+private:
+    // Hundreds of streams are more than the hardware prefetcher follows:
+    // every stream prefetches its candles this far ahead.
+    static const size_t PREFETCH = 16;
+
+    vector<span<const Candle>> streams;
+    vector<size_t> cursors;
+    vector<time_sec> times;  // next candle time of each live stream
+    vector<uint32_t> live;   // live streams, in stream order
+    vector<Event> events;
+    time_sec time = 0;
+};
+
+
+#ifdef TEST
+
+TEST(test_CandleMerger_merges_streams_with_listings_and_gaps) {
+    vector<Candle> a = { Candle(60, 1, 1, 1, 1, 1), Candle(120, 2, 2, 2, 2, 1), Candle(240, 4, 4, 4, 4, 1) }; // gap at 180
+    vector<Candle> b = { Candle(180, 3, 3, 3, 3, 1), Candle(240, 4, 4, 4, 4, 1) };                          // listed later
+    vector<Candle> c;                                                                                        // no history
+    vector<Candle> d = { Candle(0, 0, 0, 0, 0, 1), Candle(120, 2, 2, 2, 2, 1) };                             // delisted
+    CandleMerger merger({ a, b, c, d });
+
+    vector<pair<time_sec, vector<uint32_t>>> merged;
+    for (span<const CandleMerger::Event> events = merger.next(); !events.empty(); events = merger.next()) {
+        vector<uint32_t> streams;
+        for (const CandleMerger::Event& event: events) {
+            assert(event.candle->getTime() == merger.getTime() && "Every candle should belong to the timestamp");
+            streams.push_back(event.stream);
+        }
+        merged.push_back({ merger.getTime(), streams });
+    }
+    assert((merged == vector<pair<time_sec, vector<uint32_t>>>{
+        { 0, { 3 } }, { 60, { 0 } }, { 120, { 0, 3 } }, { 180, { 1 } }, { 240, { 0, 1 } }
+    }) && "Timestamps should come in order, the candles of each in stream order");
+}
+
+#endif
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <algorithm>
+
+#include "../misc/ERROR.hpp"
+#include "Candle.hpp"
+
+using namespace std;
+
+// Streaming aggregation of finer candles into a coarser interval (1m into
+// 15m/1h/4h/1d/...): first open, highest high, lowest low, last close and
+// summed volume per bucket. Buckets start at multiples of the period from
+// the epoch; weeks start on Monday like the exchange's weekly candles.
+// The sink is anything with push_back(const Candle&).
+class CandleResampler {
+public:
+    static const time_sec DAY = 24 * 60 * 60;
+    static const time_sec WEEK = 7 * DAY;
+
+    // `base` is the interval of the input candles; it tells whether the last
+    // bucket is complete (0: unknown, the last bucket is never complete).
+    CandleResampler(time_sec period, time_sec base = 0):
+        period(period),
+        base(base),
+        offset(period == WEEK ? 4 * DAY : 0) // 1970-01-01 was a Thursday
+    {
+        if (period <= 0 || (base && (period < base || period % base)))
+            throw ERROR("Invalid resample period: " + to_string(period) + "s from " + to_string(base) + "s");
+    }
+
+    virtual ~CandleResampler() {}
+
+    time_sec getPeriod() const { return period; }
+
+    // Open time of the bucket containing `time`.
+    time_sec bucket(time_sec time) const {
+        time_sec rest = (time - offset) % period;
+        return time - (rest < 0 ? rest + period : rest);
+    }
+
+    template<typename Sink>
+    void push(const Candle& candle, Sink& out) {
+        const time_sec start = bucket(candle.getTime());
+        if (open && start != current.getTime()) emit(out);
+        last = candle.getTime();
+        if (!open) {
+            current = Candle(start, candle.getOpen(), candle.getHigh(), candle.getLow(), candle.getClose(), 0);
+            volume = candle.getVolume();
+            open = true;
+            return;
+        }
+        current.setHigh(max(current.getHigh(), candle.getHigh()));
+        current.setLow(min(current.getLow(), candle.getLow()));
+        current.setClose(candle.getClose());
+        volume += candle.getVolume();
+    }
+
+    // Emits the last bucket if its base candles reach its end (or `partial`).
+    template<typename Sink>
+    void finish(Sink& out, bool partial = false) {
+        if (open && (partial || isComplete())) emit(out);
+        open = false;
+    }
+
+    bool isComplete() const {
+        return open && base && last + base >= current.getTime() + period;
+    }
+
+    template<typename Sink>
+    static void resample(span<const Candle> candles, time_sec period, time_sec base, Sink& out, bool partial = false) {
+        CandleResampler resampler(period, base);
+        for (const Candle& candle: candles) resampler.push(candle, out);
+        resampler.finish(out, partial);
+    }
+
+private:
+
+    template<typename Sink>
+    void emit(Sink& out) {
+        current.setVolume(volume); // summed in double, rounded once
+        out.push_back(current);
+        open = false;
+    }
+
+    time_sec period;
+    time_sec base;
+    time_sec offset;
+    Candle current;
+    double volume = 0;
+    time_sec last = 0;
+    bool open = false;
+};
+
+
+#ifdef TEST
+
+TEST(test_CandleResampler_aggregates_buckets) {
+    vector<Candle> minutes;
+    for (int i = 0; i < 150; i++) // 2.5 hours of 1m candles
+        minutes.push_back(Candle(3600 + i * 60, 100 + i, 101 + i + (i == 30 ? 50 : 0), 99 + i - (i == 70 ? 40 : 0), 100.5 + i, 1));
+    vector<Candle> hours;
+    CandleResampler::resample(minutes, 3600, 60, hours);
+    assert(hours.size() == 2 && "The unfinished last hour should be left out");
+    assert(hours[0].getTime() == 3600 && hours[0].getOpen() == 100 && hours[0].getClose() == 159.5 && "Open and close of the bucket");
+    assert(hours[0].getHigh() == 181 && hours[0].getLow() == 99 && hours[0].getVolume() == 60 && "High, low and volume of the bucket");
+    assert(hours[1].getTime() == 7200 && hours[1].getLow() == 129 && "Second bucket");
+
+    hours.clear();
+    CandleResampler::resample(minutes, 3600, 60, hours, true);
+    assert(hours.size() == 3 && hours[2].getVolume() == 30 && "Partial buckets on request");
+}
+
+TEST(test_CandleResampler_aligns_weeks_to_monday_and_skips_gaps) {
+    CandleResampler weeks(CandleResampler::WEEK, CandleResampler::DAY);
+    const time_sec monday = 1704067200; // 2024-01-01
+    assert(weeks.bucket(monday + 3 * CandleResampler::DAY + 5) == monday && "Weeks should start on Monday");
+    assert(weeks.bucket(monday - 1) == monday - CandleResampler::WEEK && "Previous week");
+
+    vector<Candle> days = { Candle(monday, 1, 2, 1, 2, 1), Candle(monday + 2 * CandleResampler::WEEK, 3, 4, 3, 4, 1) };
+    vector<Candle> out;
+    CandleResampler::resample(days, CandleResampler::WEEK, 0, out, true);
+    assert(out.size() == 2 && out[1].getTime() == monday + 2 * CandleResampler::WEEK && "Empty buckets should not be created");
+
+    bool thrown = false;
+    try {
+        CandleResampler(90, 60);
+    } catch (exception&) {
+        thrown = true;
+    }
+    assert(thrown && "Period should be a multiple of the base");
+}
+
+#endif
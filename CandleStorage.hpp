@@ -0,0 +1,6 @@
+#pragma once
+
+enum class CandleStorage {
+    RAW,    // fixed-size Candle records (.dat), mappable
+    BLOCKS  // compressed blocks with a seek index (.cdat)
+};
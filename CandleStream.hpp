@@ -0,0 +1,285 @@
+#pragma once
+
+#include <span>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../misc/ERROR.hpp"
+#include "Candle.hpp"
+#include "CandleFile.hpp"
+
+using namespace std;
+
+// Candles of a period in fixed-size chunks, read ahead on a background
+// thread: while the backtest consumes one chunk, the loader fills the
+// others (2 buffers: double buffering, 3: triple, to absorb uneven reads).
+// Memory is buffers * chunk candles whatever the length of the period, and
+// a backtest that is faster than the disk runs at the disk's speed instead
+// of waiting for the whole load first.
+// next() returns the next chunk and gives the previous one back to the
+// loader, so a chunk is valid until the following next(). Read errors are
+// rethrown by next().
+class CandleStream {
+public:
+    // Fills `out` with up to `capacity` next candles of the period, returns
+    // how many; 0 at the end.
+    typedef function<size_t(Candle* out, size_t capacity)> Reader;
+
+    struct Stats {
+        uint64_t chunks = 0;
+        uint64_t candles = 0;
+        uint64_t waits = 0;            // next() calls that found no chunk loaded yet
+        uint64_t readNanoseconds = 0;  // spent in the reader
+    };
+
+    static const size_t DEFAULT_CHUNK = 1 << 16; // 2MB of candles
+
+    CandleStream(Reader reader, size_t chunk = DEFAULT_CHUNK, size_t buffers = 2):
+        reader(reader), chunk(chunk)
+    {
+        if (!chunk || buffers < 2)
+            throw ERROR("Candle stream needs a chunk size and at least 2 buffers");
+        this->buffers.resize(buffers);
+        for (Buffer& buffer: this->buffers) buffer.candles.resize(chunk);
+        loader = thread([this]() { load(); });
+    }
+
+    virtual ~CandleStream() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        loader.join();
+    }
+
+    CandleStream(const CandleStream&) = delete;
+    CandleStream& operator=(const CandleStream&) = delete;
+
+    // The next chunk, empty at the end of the period.
+    span<const Candle> next() {
+        unique_lock<mutex> lock(mtx);
+        if (holding) { // give the previous chunk back
+            buffers[consumed++ % buffers.size()].full = false;
+            holding = false;
+            cv.notify_all();
+        }
+        Buffer& buffer = buffers[consumed % buffers.size()];
+        if (!buffer.full && !done) stats.waits++;
+        cv.wait(lock, [&]() { return buffer.full || done; });
+        if (!buffer.full) {
+            if (error) rethrow_exception(error);
+            return {};
+        }
+        holding = true;
+        stats.chunks++;
+        stats.candles += buffer.size;
+        return span<const Candle>(buffer.candles.data(), buffer.size);
+    }
+
+    size_t getChunk() const { return chunk; }
+    size_t getBuffers() const { return buffers.size(); }
+
+    Stats getStats() const {
+        lock_guard<mutex> lock(mtx);
+        return stats;
+    }
+
+    // Reads the records of [from, to] from a candle file (.dat, headered or
+    // legacy) with sequential preads, starting at the record the sidecar
+    // index points to. The checksum covers the whole file, it is not
+    // verified here.
+    static Reader fileReader(const string& file, time_sec from, time_sec to) {
+        struct File {
+            int fd = -1;
+            size_t offset = 0;  // of the first record
+            size_t next = 0;    // record
+            size_t last = 0;    // record, exclusive
+            ~File() { if (fd >= 0) ::close(fd); }
+        };
+        auto f = make_shared<File>();
+        f->fd = ::open(file.c_str(), O_RDONLY);
+        if (f->fd < 0) throw ERROR("Unable to open: " + file);
+        CandleFileHeader header;
+        if (CandleFile::readHeader(file, header)) {
+            f->offset = sizeof(header);
+            tie(f->next, f->last) = CandleFile::indexWindow(file, header, from, to);
+        } else {
+            struct stat st;
+            if (::fstat(f->fd, &st)) throw ERROR("Unable to stat: " + file);
+            f->last = st.st_size / sizeof(Candle);
+        }
+        ::posix_fadvise(f->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        return [f, file, from, to](Candle* out, size_t capacity) -> size_t {
+            while (f->next < f->last) {
+                const size_t count = min(capacity, f->last - f->next);
+                if (!CandleFile::readAll(f->fd, out, count * sizeof(Candle), f->offset + f->next * sizeof(Candle)))
+                    throw ERROR("Truncated candle file: " + file);
+                f->next += count;
+                span<const Candle> window = CandleFile::range(span<const Candle>(out, count), from, to);
+                if (window.data() + window.size() < out + count)
+                    f->next = f->last; // past the period
+                if (window.empty()) continue; // before the period
+                if (window.data() != out) memmove((void*)out, window.data(), window.size_bytes());
+                return window.size();
+            }
+            return 0;
+        };
+    }
+
+    // Loads the period slice by slice with `load(from, to)`, for storage
+    // that can not be read by records (compressed blocks, resampled).
+    // Slices are `seconds` long (e.g. the chunk's worth of candles of the
+    // interval) and end on the grid of `origin` + n * `seconds`, so with a
+    // multiple of the interval no slice splits a candle (resampled buckets
+    // would be lost at the boundaries); only the first slice is shorter.
+    static Reader sliceReader(
+        function<vector<Candle>(time_sec from, time_sec to)> load,
+        time_sec from, time_sec to, time_sec seconds, time_sec origin = 0
+    ) {
+        if (seconds <= 0) throw ERROR("Invalid slice: " + to_string(seconds));
+        struct Slices {
+            time_sec next;
+            bool finished = false;
+            vector<Candle> pending;
+            size_t pos = 0;
+        };
+        auto s = make_shared<Slices>();
+        s->next = from;
+        return [s, load, to, seconds, origin](Candle* out, size_t capacity) -> size_t {
+            while (s->pos == s->pending.size()) {
+                if (s->finished) return 0;
+                time_sec rest = (s->next - origin) % seconds;
+                if (rest < 0) rest += seconds;
+                const time_sec start = s->next - rest; // of the slice on the grid
+                const time_sec end = start > to - seconds + 1 ? to : start + seconds - 1;
+                s->pending = load(s->next, end);
+                s->pos = 0;
+                s->finished = end == to;
+                if (!s->finished) s->next = end + 1;
+            }
+            const size_t count = min(capacity, s->pending.size() - s->pos);
+            memcpy((void*)out, s->pending.data() + s->pos, count * sizeof(Candle));
+            s->pos += count;
+            return count;
+        };
+    }
+
+protected:
+
+    struct Buffer {
+        vector<Candle> candles;
+        size_t size = 0;
+        bool full = false;
+    };
+
+    // Loader thread: fills the free buffers in order until the end.
+    void load() {
+        for (size_t loaded = 0;; loaded++) {
+            Buffer* buffer;
+            {
+                unique_lock<mutex> lock(mtx);
+                cv.wait(lock, [&]() { return stopping || !buffers[loaded % buffers.size()].full; });
+                if (stopping) return;
+                buffer = &buffers[loaded % buffers.size()];
+            }
+            size_t size = 0;
+            exception_ptr failed;
+            auto start = chrono::steady_clock::now();
+            try {
+                size = reader(buffer->candles.data(), chunk);
+            } catch (...) {
+                failed = current_exception();
+            }
+            auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+            {
+                lock_guard<mutex> lock(mtx);
+                stats.readNanoseconds += elapsed;
+                if (failed || !size) {
+                    error = failed;
+                    done = true;
+                } else {
+                    buffer->size = size;
+                    buffer->full = true;
+                }
+            }
+            cv.notify_all();
+            if (failed || !size) return;
+        }
+    }
+
+    Reader reader;
+    size_t chunk;
+    vector<Buffer> buffers;
+    size_t consumed = 0;  // chunks given back by the consumer
+    bool holding = false; // the consumer has a chunk
+    bool done = false;
+    bool stopping = false;
+    exception_ptr error;
+    Stats stats;
+    mutable mutex mtx;
+    condition_variable cv;
+    thread loader;
+};
+
+
+#ifdef TEST
+
+TEST(test_CandleStream_streams_a_period_in_chunks) {
+    const string file = CandleFile_test_file("stream");
+    vector<Candle> candles;
+    for (size_t i = 0; i < 20000; i++) candles.emplace_back(i * 60, i, i + 1, i - 1, i, 1);
+    CandleFile::save(file, candles, "BTCUSDT", "1m");
+
+    for (size_t buffers: { 2, 3 }) {
+        CandleStream stream(CandleStream::fileReader(file, 100 * 60, 15000 * 60 + 30), 1000, buffers);
+        vector<Candle> streamed;
+        size_t chunks = 0;
+        for (span<const Candle> chunk = stream.next(); !chunk.empty(); chunk = stream.next(), chunks++) {
+            assert(chunk.size() <= stream.getChunk() && "Chunks should fit the buffers");
+            streamed.insert(streamed.end(), chunk.begin(), chunk.end());
+        }
+        assert(streamed.size() == 14901 && streamed.front().getTime() == 100 * 60 && streamed.back().getTime() == 15000 * 60 &&
+               "The stream should hold the period, in order");
+        assert(chunks == stream.getStats().chunks && stream.getStats().candles == streamed.size() && "Stats");
+        for (size_t i = 0; i < streamed.size(); i++)
+            assert(streamed[i].getOpen() == i + 100 && "Every candle once");
+        assert(stream.next().empty() && "The end should stay the end");
+    }
+
+    auto slices = CandleStream::sliceReader([&](time_sec from, time_sec to) { return CandleFile::load(file, from, to); }, 0, 19999 * 60, 777 * 60);
+    CandleStream sliced(slices, 500, 2);
+    size_t count = 0;
+    for (span<const Candle> chunk = sliced.next(); !chunk.empty(); chunk = sliced.next()) {
+        assert(chunk.front().getOpen() == count && "Slices should follow each other");
+        count += chunk.size();
+    }
+    assert(count == candles.size() && "Slices should cover the period");
+
+    CandleStream failing([](Candle*, size_t) -> size_t { throw ERROR("disk gone"); }, 10, 2);
+    bool thrown = false;
+    try {
+        failing.next();
+    } catch (exception&) {
+        thrown = true;
+    }
+    assert(thrown && "Read errors should reach the consumer");
+
+    CandleStream abandoned(CandleStream::fileReader(file, 0, 19999 * 60), 100, 3);
+    abandoned.next(); // destroyed with the loader waiting for a free buffer
+}
+
+#endif
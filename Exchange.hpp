@@ -2,6 +2,7 @@
 
 #include "Candle.hpp"
 #include "AccountData.hpp"
+#include "OrderResult.hpp"
 #include "../misc/Logger.hpp"
 // #include "../misc/EGA_COLORS.hpp"
 
@@ -67,76 +68,44 @@ public:
         return accountData;
     }
 
-    [[nodiscard]] bool buy(float quoted) {
-        bool success = true;
-        string label = "BUY quoted: " + to_string(quoted);
-        try {
-            if (!buyProtected(quoted)) 
-                throw ERROR("Failed order");
-        } catch (exception &e) {
-            label += " (failed)";
-            this->error(ERROR(label + EWHAT));
-            success = false;
-        }
-        // charts->addLabel(
-        //     charts->getPriceChart(), charts->getPriceCandleScale(),
-        //     getTime(), getPrice(), label, EGA_LIGHT_RED
-        // );
-        return success;
+    // Orders return a result code; the message is only formatted when the
+    // failure is logged, shown or thrown (see error()).
+    [[nodiscard]] OrderResult buy(float quoted) {
+        return placed(buyProtected(quoted), OrderSide::BUY, quoted);
     }
 
-    [[nodiscard]] bool sell(float amount) {
-        bool success = true;
-        string label = "SELL amount: " + to_string(amount);
-        try {
-            if (!sellProtected(amount))
-                throw ERROR("Failed order");
-        } catch (exception &e) {
-            label += " (failed)";
-            this->error(ERROR(label + EWHAT));
-            success = false;
-        }
-        // charts->addLabel(
-        //     charts->getPriceChart(), charts->getPriceCandleScale(),
-        //     getTime(), getPrice(), label, EGA_LIGHT_GREEN
-        // );
-        return success;
+    [[nodiscard]] OrderResult sell(float amount) {
+        return placed(sellProtected(amount), OrderSide::SELL, amount);
     }
 
-    [[nodiscard]] bool buyLimit(float quoted, float limitPriced) {
-        bool success = true;
-        string label = "BUY quoted: " + to_string(quoted) + ", LIMIT: " + to_string(limitPriced);
-        try {
-            if (!buyLimitProtected(quoted, limitPriced))
-                throw ERROR("Failed order");
-        } catch (exception &e) {
-            label += " (failed)";
-            this->error(ERROR(label + EWHAT));
-            success = false;
-        }
-        // charts->addLabel(
-        //     charts->getPriceChart(), charts->getPriceCandleScale(),
-        //     getTime(), getPrice(), label, EGA_LIGHT_RED
-        // );
-        return success;
+    [[nodiscard]] OrderResult buyLimit(float quoted, float limitPriced) {
+        return placed(buyLimitProtected(quoted, limitPriced), OrderSide::BUY_LIMIT, quoted, limitPriced);
     }
 
-    [[nodiscard]] bool sellLimit(float amount, float limitPriced) {
-        bool success = true;
-        string label = "SELL amount: " + to_string(amount) + ", LIMIT: " + to_string(limitPriced);
-        try {
-            if (!sellLimitProtected(amount, limitPriced))
-                throw ERROR("Failed order");
-        } catch (exception &e) {
-            label += " (failed)";
-            this->error(ERROR(label + EWHAT));
-            success = false;
-        }
-        // charts->addLabel(
-        //     charts->getPriceChart(), charts->getPriceCandleScale(),
-        //     getTime(), getPrice(), label, EGA_LIGHT_GREEN
-        // );
-        return success;
+    [[nodiscard]] OrderResult sellLimit(float amount, float limitPriced) {
+        return placed(sellLimitProtected(amount, limitPriced), OrderSide::SELL_LIMIT, amount, limitPriced);
+    }
+
+    // The whole free balance (held asset): exact where a float amount could
+    // round past what is held (a fixed-point ledger).
+    [[nodiscard]] OrderResult buyAll() {
+        const float quoted = getBalanceFree();
+        return placed(buyAllProtected(), OrderSide::BUY, quoted);
+    }
+
+    [[nodiscard]] OrderResult sellAll() {
+        const float amount = getAssetUsed();
+        return placed(sellAllProtected(), OrderSide::SELL, amount);
+    }
+
+    [[nodiscard]] OrderResult buyLimitAll(float limitPriced) {
+        const float quoted = getBalanceFree();
+        return placed(buyLimitAllProtected(limitPriced), OrderSide::BUY_LIMIT, quoted, limitPriced);
+    }
+
+    [[nodiscard]] OrderResult sellLimitAll(float limitPriced) {
+        const float amount = getAssetUsed();
+        return placed(sellLimitAllProtected(limitPriced), OrderSide::SELL_LIMIT, amount, limitPriced);
     }
 
     virtual size_t getPendingOrderCount() const = 0;
@@ -157,14 +126,33 @@ protected:
     bool showsOnError = true;
     bool throwsOnError = true;
 
-    [[nodiscard]] virtual bool buyProtected(float quoted) = 0;
-    [[nodiscard]] virtual bool sellProtected(float amount) = 0;
-    [[nodiscard]] virtual bool buyLimitProtected(float quoted, float limitPriced) = 0;
-    [[nodiscard]] virtual bool sellLimitProtected(float amount, float limitPriced) = 0;
+    [[nodiscard]] virtual OrderResult buyProtected(float quoted) = 0;
+    [[nodiscard]] virtual OrderResult sellProtected(float amount) = 0;
+    [[nodiscard]] virtual OrderResult buyLimitProtected(float quoted, float limitPriced) = 0;
+    [[nodiscard]] virtual OrderResult sellLimitProtected(float amount, float limitPriced) = 0;
+
+    // Float amounts by default, exchanges with exact units override them.
+    [[nodiscard]] virtual OrderResult buyAllProtected() { return buyProtected(getBalanceFree()); }
+    [[nodiscard]] virtual OrderResult sellAllProtected() { return sellProtected(getAssetUsed()); }
+    [[nodiscard]] virtual OrderResult buyLimitAllProtected(float limitPriced) { return buyLimitProtected(getBalanceFree(), limitPriced); }
+    [[nodiscard]] virtual OrderResult sellLimitAllProtected(float limitPriced) { return sellLimitProtected(getAssetUsed(), limitPriced); }
     
     virtual uint32_t getTime() = 0;
     virtual float getPrice() = 0;
 
+    OrderResult placed(OrderResult result, OrderSide side, float amount, float limit = 0) {
+        result.side = side;
+        result.amount = amount;
+        result.limit = limit;
+        if (!result && (logsOnError || showsOnError || throwsOnError))
+            error(ERROR(result.message()));
+        // charts->addLabel(
+        //     charts->getPriceChart(), charts->getPriceCandleScale(),
+        //     getTime(), getPrice(), result.message(), EGA_LIGHT_RED / EGA_LIGHT_GREEN
+        // );
+        return result;
+    }
+
     // virtual bool error(const string& errmsg) {
     virtual bool error(const runtime_error& e) {
         string errmsg = "Exchange error" + EWHAT;
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+using namespace std;
+
+// Keep-alive connections shared by any number of concurrent downloads.
+// Each request leases an idle connection (waiting while all are busy) and
+// returns it afterwards, so connections stay open across requests, symbols
+// and intervals. Requests to the same host are spaced to at most `rate`
+// per second (0: unlimited), on the pool's clock.
+class FetcherPool {
+public:
+    typedef function<void(const string& chunk)> Chunk;
+    // GETs the url passing the body to `chunk` as it arrives, returns false on failure.
+    typedef function<bool(const string& url, Chunk chunk)> Fetcher;
+    // Opens one connection.
+    typedef function<Fetcher()> FetcherFactory;
+
+    // Time source of the rate limit, replaceable (e.g. by a simulated one in tests).
+    struct Clock {
+        function<chrono::steady_clock::time_point()> now;
+        function<void(chrono::steady_clock::time_point)> sleepUntil;
+
+        Clock():
+            now([]() { return chrono::steady_clock::now(); }),
+            sleepUntil([](chrono::steady_clock::time_point at) { this_thread::sleep_until(at); }) {}
+    };
+
+    FetcherPool(FetcherFactory connect, size_t connections = 8, double rate = 0, Clock clock = Clock()):
+        connect(connect),
+        connections(connections ? connections : 1),
+        rate(rate),
+        clock(clock)
+    {
+        opened.reserve(this->connections); // leased connections are never moved
+    }
+
+    virtual ~FetcherPool() {}
+
+    bool fetch(const string& url, Chunk chunk) {
+        throttle(host(url));
+        Lease lease(*this);
+        requests++;
+        return (*lease.fetcher)(url, [&](const string& data) {
+            bytes += data.size();
+            chunk(data);
+        });
+    }
+
+    // Fetchers for the downloaders: every one of them goes through the shared connections.
+    FetcherFactory fetchers() {
+        return [this]() -> Fetcher {
+            return [this](const string& url, Chunk chunk) { return fetch(url, chunk); };
+        };
+    }
+
+    size_t getConnections() const { return connections; }
+    size_t getOpened() const { lock_guard<mutex> lock(mtx); return opened.size(); }
+    size_t getRequests() const { return requests; }
+    size_t getBytes() const { return bytes; }
+
+    static string host(const string& url) {
+        size_t start = url.find("://");
+        start = start == string::npos ? 0 : start + 3;
+        return url.substr(start, url.find('/', start) - start);
+    }
+
+private:
+
+    struct Lease {
+        FetcherPool& pool;
+        size_t slot;
+        Fetcher* fetcher;
+
+        Lease(FetcherPool& pool): pool(pool) {
+            unique_lock<mutex> lock(pool.mtx);
+            pool.cv.wait(lock, [&]() { return !pool.idle.empty() || pool.opened.size() < pool.connections; });
+            if (pool.idle.empty()) {
+                pool.opened.push_back(pool.connect());
+                pool.idle.push_back(pool.opened.size() - 1);
+            }
+            slot = pool.idle.back();
+            pool.idle.pop_back();
+            fetcher = &pool.opened[slot];
+        }
+
+        ~Lease() {
+            lock_guard<mutex> lock(pool.mtx);
+            pool.idle.push_back(slot);
+            pool.cv.notify_one();
+        }
+    };
+
+    // Reserves the next request slot of the host and waits for it.
+    void throttle(const string& host) {
+        if (rate <= 0) return;
+        const auto gap = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1 / rate));
+        chrono::steady_clock::time_point at;
+        {
+            lock_guard<mutex> lock(mtx);
+            chrono::steady_clock::time_point& next = nextRequest[host];
+            at = max(clock.now(), next);
+            next = at + gap;
+        }
+        clock.sleepUntil(at);
+    }
+
+    FetcherFactory connect;
+    size_t connections;
+    double rate;
+    Clock clock;
+
+    mutable mutex mtx;
+    condition_variable cv;
+    vector<Fetcher> opened;
+    vector<size_t> idle;
+    map<string, chrono::steady_clock::time_point> nextRequest;
+    atomic<size_t> requests = 0;
+    atomic<size_t> bytes = 0;
+};
+
+
+#ifdef TEST
+
+TEST(test_FetcherPool_shares_a_bounded_set_of_connections) {
+    atomic<int> busy = 0;
+    atomic<int> maxBusy = 0;
+    FetcherPool pool([&]() -> FetcherPool::Fetcher {
+        return [&](const string& url, FetcherPool::Chunk chunk) {
+            int now = ++busy;
+            for (int seen = maxBusy; now > seen && !maxBusy.compare_exchange_weak(seen, now);) {}
+            this_thread::sleep_for(chrono::milliseconds(2));
+            chunk(url);
+            busy--;
+            return true;
+        };
+    }, 3);
+
+    vector<thread> threads;
+    for (int t = 0; t < 8; t++)
+        threads.emplace_back([&pool]() {
+            FetcherPool::Fetcher fetch = pool.fetchers()();
+            for (int i = 0; i < 5; i++) fetch("http://host/" + to_string(i), [](const string&) {});
+        });
+    for (thread& t: threads) t.join();
+    assert(pool.getOpened() == 3 && maxBusy <= 3 && "Requests should share at most the configured connections");
+    assert(pool.getRequests() == 40 && pool.getBytes() == 40 * 13 && "Requests and bytes should be counted");
+}
+
+TEST(test_FetcherPool_rate_limits_per_host) {
+    // simulated time: sleeping moves it to the wake-up time at once
+    mutex mtx;
+    chrono::steady_clock::time_point now;
+    FetcherPool::Clock clock;
+    clock.now = [&]() { lock_guard<mutex> lock(mtx); return now; };
+    clock.sleepUntil = [&](chrono::steady_clock::time_point at) { lock_guard<mutex> lock(mtx); now = max(now, at); };
+    FetcherPool pool([]() -> FetcherPool::Fetcher {
+        return [](const string&, FetcherPool::Chunk) { return true; };
+    }, 4, 200, clock);
+    const chrono::steady_clock::time_point start = now;
+    for (int i = 0; i < 5; i++) pool.fetch("https://a.example/x", [](const string&) {});
+    assert(now - start == 4 * chrono::milliseconds(5) && "Requests to one host should be spaced by the rate");
+
+    const chrono::steady_clock::time_point later = now;
+    for (int i = 0; i < 5; i++) pool.fetch("https://host" + to_string(i) + ".example/x", [](const string&) {});
+    assert(now == later && "Different hosts should not wait for each other");
+    assert(FetcherPool::host("https://data.binance.vision/data/x.zip") == "data.binance.vision" && "Host should be parsed");
+}
+
+#endif
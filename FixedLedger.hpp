@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "../misc/ERROR.hpp"
+
+using namespace std;
+
+// Integer fixed-point arithmetic of a test exchange account. Amounts are
+// int64 counts of their smallest unit (1e-<decimals>); prices and fees are
+// converted when used. Products and quotients are computed in integers,
+// 128 bit only when 64 bit would overflow, and rounded toward zero: the
+// same trades give bit-identical, exactly comparable balances on every
+// build and thread count. Values and results that do not fit in int64
+// units throw instead of wrapping.
+class FixedLedger {
+public:
+    // Decimal places of each kind of number.
+    struct Scales {
+        int price = 8;
+        int quantity = 8; // asset amounts
+        int quoted = 8;   // quoted (cash) amounts
+        int fee = 8;      // fee rates
+    };
+
+    FixedLedger() {}
+
+    FixedLedger(const Scales& scales): enabled(true), scales(scales) {
+        const int cross = scales.price + scales.quantity - scales.quoted;
+        if (min({ scales.price, scales.quantity, scales.quoted, scales.fee, cross }) < 0 ||
+            max({ scales.price, scales.quantity, scales.quoted, scales.fee, cross }) > 18)
+            throw ERROR("Invalid fixed-point scales: price " + to_string(scales.price) + ", quantity " + to_string(scales.quantity) +
+                ", quoted " + to_string(scales.quoted) + ", fee " + to_string(scales.fee));
+        priceScale = pow10(scales.price);
+        quantityScale = pow10(scales.quantity);
+        quotedScale = pow10(scales.quoted);
+        feeScale = pow10(scales.fee);
+        crossScale = pow10(cross);
+    }
+
+    virtual ~FixedLedger() {}
+
+    bool isEnabled() const { return enabled; }
+    const Scales& getScales() const { return scales; }
+
+    int64_t priceUnits(double price) const { return units(price, priceScale, "price"); }
+    int64_t quantityUnits(double quantity) const { return units(quantity, quantityScale, "quantity"); }
+    int64_t quotedUnits(double quoted) const { return units(quoted, quotedScale, "quoted amount"); }
+    int64_t feeUnits(double feePc) const { return units(feePc, feeScale, "fee"); }
+
+    double quantityValue(int64_t units) const { return (double)units / quantityScale; }
+    double quotedValue(int64_t units) const { return (double)units / quotedScale; }
+
+    // Asset bought for a quoted amount at a price.
+    int64_t assetFor(int64_t quoted, int64_t price) const { return mulDiv(quoted, crossScale, price); }
+
+    // Quoted amount an asset amount is worth at a price.
+    int64_t quotedFor(int64_t quantity, int64_t price) const { return mulDiv(quantity, price, crossScale); }
+
+    // Fee of an amount (in the amount's units).
+    int64_t feeOf(int64_t amount, int64_t fee) const { return mulDiv(amount, fee, feeScale); }
+
+    // a * b / c rounded toward zero, for positive c: in 64 bit when the
+    // product fits, in 128 bit otherwise. Throws when the result does not
+    // fit in 64 bit.
+    static int64_t mulDiv(int64_t a, int64_t b, int64_t c) {
+        int64_t product;
+        if (!__builtin_mul_overflow(a, b, &product)) return product / c;
+        const __int128 quotient = (__int128)a * b / c;
+        if (quotient > INT64_MAX || quotient < INT64_MIN)
+            throw ERROR("Result out of the fixed-point range: " + to_string(a) + " * " + to_string(b) + " / " + to_string(c));
+        return (int64_t)quotient;
+    }
+
+private:
+
+    // value * scale rounded half away from zero (without the libm call of
+    // llround()), if it fits in int64.
+    static int64_t units(double value, int64_t scale, const char* what) {
+        const double scaled = value * scale;
+        const double rounded = scaled < 0 ? scaled - 0.5 : scaled + 0.5;
+        if (!(rounded > -LIMIT && rounded < LIMIT)) // NaN too
+            throw ERROR("The " + string(what) + " " + to_string(value) + " does not fit the fixed-point ledger (1e-" +
+                to_string((int)log10((double)scale)) + " units)");
+        return (int64_t)rounded;
+    }
+
+    static constexpr double LIMIT = 9223372036854775808.0; // 2^63
+
+    static int64_t pow10(int decimals) {
+        int64_t result = 1;
+        while (decimals--) result *= 10;
+        return result;
+    }
+
+    bool enabled = false;
+    Scales scales;
+    int64_t priceScale = 1;
+    int64_t quantityScale = 1;
+    int64_t quotedScale = 1;
+    int64_t feeScale = 1;
+    int64_t crossScale = 1; // price * quantity / quoted scale
+};
+
+
+#ifdef TEST
+
+TEST(test_FixedLedger_converts_and_rounds_toward_zero) {
+    FixedLedger ledger(FixedLedger::Scales{ 2, 6, 8, 6 });
+    assert(ledger.priceUnits(64123.45) == 6412345 && ledger.quantityUnits(0.5) == 500000 && "Values should become units");
+    assert(ledger.quotedValue(ledger.quotedUnits(123.45678901)) == 123.45678901 && "Quoted units should round trip");
+    assert(ledger.assetFor(ledger.quotedUnits(100), ledger.priceUnits(3)) == 33333333 && "Bought asset should round down");
+    assert(ledger.quotedFor(ledger.quantityUnits(2), ledger.priceUnits(64123.45)) == ledger.quotedUnits(128246.9) && "Asset value should be exact");
+    assert(ledger.feeOf(ledger.quotedUnits(500), ledger.feeUnits(0.001)) == ledger.quotedUnits(0.5) && "Fee should be exact");
+    assert(FixedLedger::mulDiv(INT64_MAX / 2, 6, 4) == INT64_MAX / 2 / 2 * 3 + 1 && "Overflowing products should go through 128 bit");
+    assert(FixedLedger::mulDiv(-7, 1, 2) == -3 && "Negative results should round toward zero");
+    bool thrown = false;
+    try {
+        FixedLedger(FixedLedger::Scales{ 2, 2, 8, 8 });
+    } catch (exception&) {
+        thrown = true;
+    }
+    assert(thrown && "Quoted decimals should not exceed price and quantity decimals");
+}
+
+TEST(test_FixedLedger_rejects_values_out_of_range) {
+    auto throws = [](auto convert) {
+        try {
+            convert();
+        } catch (exception& e) {
+            return string(e.what()).find("fixed-point") != string::npos;
+        }
+        return false;
+    };
+    FixedLedger ledger(FixedLedger::Scales{ 2, 8, 8, 8 });
+    assert(ledger.quotedUnits(9e10) == 9000000000000000000 && "The largest balances of 8 decimals should fit");
+    assert(throws([&]() { return ledger.quotedUnits(1e11); }) && throws([&]() { return ledger.quantityUnits(-1e11); }) &&
+           "Amounts beyond int64 units should throw, not wrap");
+    assert(throws([&]() { return ledger.priceUnits(NAN); }) && "NaN has no units");
+    FixedLedger fine(FixedLedger::Scales{ 0, 18, 18, 0 });
+    assert(fine.quotedUnits(9) == 9000000000000000000 && throws([&]() { return fine.quotedUnits(10); }) &&
+           "At 18 decimals a balance of 10 should not fit");
+    assert(throws([]() { return FixedLedger::mulDiv(INT64_MAX, 4, 2); }) && "Results beyond 64 bit should throw");
+    assert(FixedLedger::mulDiv(INT64_MAX, 4, 8) == INT64_MAX / 2 && "Products beyond 64 bit are fine when the result fits");
+}
+
+#endif
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include "CandleHistory.hpp"
+#include "FetcherPool.hpp"
+
+using namespace std;
+
+// Keeps many symbol/interval pairs fresh in one run: `parallel` pairs are
+// updated at a time, all of them fetching through one shared FetcherPool.
+// Each pair is reported as it finishes (progress and throughput); a failing
+// pair is reported with its error and does not stop the others.
+// Histories that download implement FleetCandleHistory to run the pairs
+// this way; any other history is updated pair by pair (updateAll()).
+class FleetUpdater {
+public:
+    struct Pair {
+        string symbol;
+        string interval;
+    };
+
+    struct Report {
+        string symbol;
+        string interval;
+        size_t candles = 0;  // new candles stored
+        size_t requests = 0;
+        size_t bytes = 0;    // downloaded
+        double seconds = 0;
+        string error;        // empty on success
+
+        double candlesPerSecond() const { return seconds > 0 ? candles / seconds : 0; }
+        double bytesPerSecond() const { return seconds > 0 ? bytes / seconds : 0; }
+    };
+
+    struct Settings {
+        size_t parallel = 4;     // pairs updated at once
+        size_t connections = 8;  // shared keep-alive connections
+        double rate = 0;         // requests per second per host, 0: unlimited
+        size_t workers = 8;      // archive downloads at once per pair
+    };
+
+    // Updates one pair fetching through `fetchers`, returns the number of new candles.
+    typedef function<size_t(const Pair& pair, FetcherPool::FetcherFactory fetchers)> Update;
+    typedef function<void(const Report& report, size_t done, size_t total)> OnProgress;
+
+    FleetUpdater(FetcherPool& pool, size_t parallel = 4):
+        pool(pool), parallel(parallel ? parallel : 1) {}
+
+    virtual ~FleetUpdater() {}
+
+    // Reports are returned in the order of `pairs`; `onProgress` is called
+    // (serialized) in completion order.
+    vector<Report> run(const vector<Pair>& pairs, Update update, OnProgress onProgress = nullptr) {
+        vector<Report> reports(pairs.size());
+        atomic<size_t> next = 0;
+        size_t done = 0;
+        mutex mtx;
+        vector<thread> threads;
+        for (size_t t = 0; t < min(parallel, pairs.size()); t++)
+            threads.emplace_back([&]() {
+                for (size_t i = next++; i < pairs.size(); i = next++) {
+                    atomic<size_t> requests = 0;
+                    atomic<size_t> bytes = 0;
+                    FetcherPool::FetcherFactory fetchers = [&]() -> FetcherPool::Fetcher {
+                        return [&](const string& url, FetcherPool::Chunk chunk) {
+                            requests++;
+                            return pool.fetch(url, [&](const string& data) {
+                                bytes += data.size();
+                                chunk(data);
+                            });
+                        };
+                    };
+                    Report report = measure(pairs[i], [&]() { return update(pairs[i], fetchers); });
+                    report.requests = requests;
+                    report.bytes = bytes;
+                    lock_guard<mutex> lock(mtx);
+                    reports[i] = report;
+                    done++;
+                    if (onProgress) onProgress(report, done, pairs.size());
+                }
+            });
+        for (thread& t: threads) t.join();
+        return reports;
+    }
+
+    // Times one update, turning its exception into the report's error.
+    static Report measure(const Pair& pair, function<size_t()> update) {
+        Report report;
+        report.symbol = pair.symbol;
+        report.interval = pair.interval;
+        auto start = chrono::steady_clock::now();
+        try {
+            report.candles = update();
+        } catch (exception& e) {
+            report.error = e.what();
+        }
+        report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return report;
+    }
+
+    // The pairs of the stored intervals, derived ones replaced by their
+    // base (see CandleHistory::storedInterval()), each once, in order.
+    static vector<Pair> storedPairs(const CandleHistory& history, const vector<Pair>& pairs) {
+        vector<Pair> stored;
+        for (const Pair& pair: pairs) {
+            Pair base{ pair.symbol, history.storedInterval(pair.interval) };
+            if (none_of(stored.begin(), stored.end(), [&](const Pair& p) { return p.symbol == base.symbol && p.interval == base.interval; }))
+                stored.push_back(base);
+        }
+        return stored;
+    }
+
+    // Brings many pairs of the history up to date, reporting each as it
+    // finishes. Derived intervals update their base, once for all of them.
+    // Defined below FleetCandleHistory, with the default arguments.
+    static vector<Report> updateAll(
+        CandleHistory& history,
+        const vector<Pair>& pairs,
+        const Settings& settings,
+        OnProgress onProgress
+    );
+
+    // Every symbol with every interval.
+    static vector<Pair> pairs(const vector<string>& symbols, const vector<string>& intervals) {
+        vector<Pair> result;
+        for (const string& symbol: symbols)
+            for (const string& interval: intervals) result.push_back({ symbol, interval });
+        return result;
+    }
+
+private:
+    FetcherPool& pool;
+    size_t parallel;
+};
+
+// A history that updates many pairs at once, e.g. in parallel over shared
+// connections with a FleetUpdater.
+class FleetCandleHistory {
+public:
+    virtual ~FleetCandleHistory() {}
+
+    virtual vector<FleetUpdater::Report> updateAll(
+        const vector<FleetUpdater::Pair>& pairs,
+        const FleetUpdater::Settings& settings = FleetUpdater::Settings(),
+        FleetUpdater::OnProgress onProgress = nullptr
+    ) = 0;
+};
+
+// Any other history: the stored pairs one by one.
+inline vector<FleetUpdater::Report> FleetUpdater::updateAll(
+    CandleHistory& history,
+    const vector<Pair>& pairs,
+    const Settings& settings = Settings(),
+    OnProgress onProgress = nullptr
+) {
+    if (FleetCandleHistory* fleet = dynamic_cast<FleetCandleHistory*>(&history))
+        return fleet->updateAll(pairs, settings, onProgress);
+    vector<Pair> stored = storedPairs(history, pairs);
+    vector<Report> reports;
+    for (const Pair& pair: stored) {
+        reports.push_back(measure(pair, [&]() {
+            size_t before = history.count(pair.symbol, pair.interval);
+            history.update(pair.symbol, pair.interval);
+            return history.count(pair.symbol, pair.interval) - before;
+        }));
+        if (onProgress) onProgress(reports.back(), reports.size(), stored.size());
+    }
+    return reports;
+}
+
+
+#ifdef TEST
+
+#include "BinanceKlineDownloader.hpp"
+
+TEST(test_FleetUpdater_updates_pairs_over_shared_connections) {
+    BinanceKlineStandIn standIn;
+    for (string symbol: { "BTCUSDT", "ETHUSDT" })
+        for (string interval: { "1m", "1h" })
+            for (string date: { "2024-01-01", "2024-01-02" }) standIn.serveDay(date, 1440, symbol, interval);
+    atomic<size_t> connections = 0;
+    BinanceKlineDownloader::FetcherFactory standInFetchers = standIn.fetchers();
+    FetcherPool pool([&]() {
+        connections++;
+        return standInFetchers();
+    }, 2);
+
+    vector<FleetUpdater::Pair> pairs = FleetUpdater::pairs({ "BTCUSDT", "ETHUSDT", "XRPUSDT" }, { "1m", "1h" });
+    vector<size_t> progress;
+    FleetUpdater fleet(pool, 3);
+    vector<FleetUpdater::Report> reports = fleet.run(pairs, [](const FleetUpdater::Pair& pair, FetcherPool::FetcherFactory fetchers) {
+        if (pair.symbol == "XRPUSDT" && pair.interval == "1h") throw ERROR("Unknown symbol");
+        BinanceKlineDownloader downloader(2, fetchers, "http://stand-in/list", "http://stand-in/data");
+        BinanceKlineManifest manifest;
+        return downloader.sync(pair.symbol, pair.interval, datetime_to_sec("2023-12-31") + 86340, manifest, nullptr,
+            datetime_to_sec("2024-01-03") + 3600).size();
+    }, [&progress](const FleetUpdater::Report&, size_t done, size_t total) {
+        assert(total == 6 && "Progress should know the fleet size");
+        progress.push_back(done);
+    });
+
+    assert(reports.size() == 6 && reports[1].symbol == "BTCUSDT" && reports[1].interval == "1h" && "Reports should follow the pairs");
+    for (size_t i = 0; i < 4; i++)
+        assert(reports[i].candles == 2 * 1440 && reports[i].bytes > 0 && reports[i].error.empty() && "Served pairs should update");
+    assert(reports[4].candles == 0 && reports[4].requests > 0 && reports[4].error.empty() && "Unpublished pair should just find nothing");
+    assert(reports[5].error.find("Unknown symbol") != string::npos && "A failing pair should be reported, not abort the run");
+    assert((progress == vector<size_t>{ 1, 2, 3, 4, 5, 6 }) && "Progress should be reported per pair");
+    assert(connections <= 2 && pool.getRequests() == standIn.requests.size() && "Pairs should share the pooled connections");
+}
+
+TEST(test_FleetUpdater_updateAll_reports_new_candles_per_pair) {
+    class GrowingCandleHistory: public MockCandleHistory {
+    public:
+        vector<string> updated;
+        void update(const string& symbol, const string& interval) override {
+            updated.push_back(symbol + " " + interval);
+            if (symbol == "BAD") throw ERROR("Unavailable");
+            append(createTestCandles(lastTime(symbol, interval) + 100, lastTime(symbol, interval) + 300, 100), symbol, interval);
+        }
+    } history;
+    history.save(MockCandleHistory::createTestCandles(1000, 2000, 100), "FLEET", "1m");
+    vector<FleetUpdater::Report> reports = FleetUpdater::updateAll(history, FleetUpdater::pairs({ "FLEET", "BAD" }, { "1m" }));
+    assert(reports.size() == 2 && reports[0].candles == 3 && history.count("FLEET", "1m") == 14 && "Should count the new candles");
+    assert(reports[1].error.find("Unavailable") != string::npos && "A failing pair should be reported");
+
+    history.updated.clear();
+    history.setBaseInterval("1m");
+    reports = FleetUpdater::updateAll(history, FleetUpdater::pairs({ "FLEET" }, { "1m", "1h", "4h" }));
+    assert((history.updated == vector<string>{ "FLEET 1m" }) && reports.size() == 1 && reports[0].interval == "1m" &&
+           "Derived intervals should update their base, once");
+}
+
+#endif
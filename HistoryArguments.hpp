@@ -36,17 +36,26 @@ public:
     CandleHistory* getHistory() const { return history; }
 
 
-    vector<Candle> loadCandles(time_sec first, time_sec last) const {
+    // Memory-mapped view, no copy. Use toVector() where ownership is needed.
+    MappedCandles loadCandles(time_sec first, time_sec last) const {
         CandleHistory* history = getHistory();
         string symbol = getSymbol();
         string interval = getInterval();
-        vector<Candle> candles = history->load(
+        MappedCandles candles = history->loadMapped(
             symbol, interval, 
             first, last
         );
         return candles;
     }
 
+    // One view per symbol of the interval, for a PortfolioRunner universe.
+    vector<MappedCandles> loadCandles(const vector<string>& symbols, time_sec first, time_sec last) const {
+        vector<MappedCandles> universe;
+        for (const string& symbol: symbols)
+            universe.push_back(getHistory()->loadMapped(symbol, getInterval(), first, last));
+        return universe;
+    }
+
 protected:
 
     DynLoader& loader;
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "../misc/ERROR.hpp"
+#include "Candle.hpp"
+
+using namespace std;
+
+// Computed indicator series shared across backtests: optimizer candidates
+// that use the same indicator of the same candles (e.g. EMA(50) of the
+// closes) get one computation instead of one per candidate.
+// The index is split in shards by key hash, each with its own read-write
+// lock and hit counter. A hit takes its shard's lock shared (no other
+// shard and no global lock is touched) plus a refcount bump, so readers
+// of different keys rarely meet; readers of one hot key still share its
+// shard's cache lines, the lookups are not lock-free. An insert locks one
+// shard and is O(1). The first reader of a missing series computes it,
+// the others wait for that result (shared_future) instead of computing it
+// again; a failed computation is not cached. When the series exceed the
+// memory budget, the least recently used ones are evicted; holders keep
+// theirs alive (shared_ptr).
+class IndicatorCache {
+public:
+    typedef vector<float> Series;
+    typedef shared_ptr<const Series> SeriesPtr;
+    typedef function<Series()> Compute;
+
+    // Identifies a series: the candles (symbol, interval, range) and the
+    // indicator with its parameters (and output, e.g. "bollinger.upper").
+    struct Key {
+        string symbol;
+        string interval;
+        time_sec from = 0;
+        time_sec to = 0;
+        string indicator;
+        vector<double> params;
+
+        // Unambiguous: the strings are length-prefixed (any character may
+        // appear in them) and the parameters are written exactly (hex float).
+        string str() const {
+            string key;
+            for (const string* field: { &symbol, &interval, &indicator })
+                key += to_string(field->size()) + ":" + *field;
+            key += to_string(from) + ":" + to_string(to);
+            char param[32];
+            for (double value: params) {
+                snprintf(param, sizeof(param), "|%a", value);
+                key += param;
+            }
+            return key;
+        }
+    };
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;    // computations
+        uint64_t evictions = 0;
+        size_t bytes = 0;       // of the cached series
+        size_t entries = 0;
+    };
+
+    IndicatorCache(size_t maxBytes = DEFAULT_MAX_BYTES): maxBytes(maxBytes) {}
+    virtual ~IndicatorCache() {}
+
+    // One cache per process.
+    static IndicatorCache& shared() {
+        static IndicatorCache cache;
+        return cache;
+    }
+
+    // The series of the key, computed (once) if not cached.
+    SeriesPtr get(const Key& key, Compute compute) {
+        return get(key.str(), compute);
+    }
+
+    SeriesPtr get(const string& key, Compute compute) {
+        Shard& shard = shardOf(key);
+        shared_ptr<Entry> entry;
+        {
+            shared_lock<shared_mutex> lock(shard.mtx);
+            auto found = shard.entries.find(key);
+            if (found != shard.entries.end()) entry = found->second;
+        }
+        if (entry) {
+            shard.hits.fetch_add(1, memory_order_relaxed);
+            return entry->use();
+        }
+
+        promise<SeriesPtr> computed;
+        bool owner = false;
+        {
+            unique_lock<shared_mutex> lock(shard.mtx);
+            shared_ptr<Entry>& slot = shard.entries[key];
+            if (!slot) { // not inserted meanwhile
+                slot = make_shared<Entry>(computed.get_future().share());
+                owner = true;
+            }
+            entry = slot;
+        }
+        if (!owner) {
+            shard.hits.fetch_add(1, memory_order_relaxed);
+            return entry->use();
+        }
+
+        misses.fetch_add(1, memory_order_relaxed);
+        SeriesPtr series;
+        try {
+            series = make_shared<const Series>(compute());
+        } catch (...) {
+            computed.set_exception(current_exception());
+            erase(shard, key, entry);
+            throw;
+        }
+        computed.set_value(series);
+
+        lock_guard<mutex> lock(mtx);
+        entry->bytes = series->size() * sizeof(float);
+        entry->ready = true;
+        entry->lastUsed.store(now(), memory_order_relaxed);
+        bytes += entry->bytes;
+        evict(entry);
+        return series;
+    }
+
+    // Drops every series (holders keep theirs).
+    void clear() {
+        lock_guard<mutex> lock(mtx);
+        for (Shard& shard: shards) {
+            unique_lock<shared_mutex> shardLock(shard.mtx);
+            erase_if(shard.entries, [](const auto& item) { return item.second->ready; }); // not the ones being computed
+        }
+        bytes = 0;
+    }
+
+    void setMaxBytes(size_t maxBytes) {
+        lock_guard<mutex> lock(mtx);
+        this->maxBytes = maxBytes;
+        evict(nullptr);
+    }
+
+    size_t getMaxBytes() const { return maxBytes; }
+
+    Stats getStats() const {
+        lock_guard<mutex> lock(mtx);
+        Stats stats;
+        for (const Shard& shard: shards) {
+            shared_lock<shared_mutex> shardLock(shard.mtx);
+            stats.hits += shard.hits.load(memory_order_relaxed);
+            stats.entries += shard.entries.size();
+        }
+        stats.misses = misses.load(memory_order_relaxed);
+        stats.evictions = evictions;
+        stats.bytes = bytes;
+        return stats;
+    }
+
+    static const size_t DEFAULT_MAX_BYTES = 1ul << 30; // 1GB
+    static const size_t SHARDS = 64;
+
+protected:
+
+    struct Entry {
+        shared_future<SeriesPtr> series;
+        atomic<uint64_t> lastUsed{ 0 };
+        size_t bytes = 0;   // under the cache's lock
+        bool ready = false; // under the cache's lock, counted in bytes
+
+        Entry(shared_future<SeriesPtr> series): series(series) {}
+
+        SeriesPtr use() {
+            lastUsed.store(now(), memory_order_relaxed);
+            return series.get(); // waits if being computed, rethrows its failure
+        }
+    };
+
+    struct alignas(64) Shard {
+        mutable shared_mutex mtx;
+        unordered_map<string, shared_ptr<Entry>> entries;
+        atomic<uint64_t> hits{ 0 };
+    };
+
+    // Use time for the LRU order: a clock read instead of a shared counter.
+    static uint64_t now() {
+        return chrono::steady_clock::now().time_since_epoch().count();
+    }
+
+    Shard& shardOf(const string& key) {
+        return shards[hash<string>()(key) % SHARDS];
+    }
+
+    // Under the lock: least recently used ready series out until the budget
+    // fits, except the one just added.
+    void evict(const shared_ptr<Entry>& keep) {
+        if (bytes <= maxBytes) return;
+        struct Candidate {
+            uint64_t lastUsed;
+            Shard* shard;
+            string key;
+            shared_ptr<Entry> entry;
+        };
+        vector<Candidate> candidates;
+        for (Shard& shard: shards) {
+            shared_lock<shared_mutex> shardLock(shard.mtx);
+            for (const auto& [key, entry]: shard.entries)
+                if (entry->ready && entry != keep)
+                    candidates.push_back({ entry->lastUsed.load(memory_order_relaxed), &shard, key, entry });
+        }
+        sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.lastUsed < b.lastUsed; });
+        for (size_t i = 0; i < candidates.size() && bytes > maxBytes; i++) {
+            erase(*candidates[i].shard, candidates[i].key, candidates[i].entry);
+            bytes -= candidates[i].entry->bytes;
+            evictions++;
+        }
+    }
+
+    // The entry of the key, if it is still that one.
+    void erase(Shard& shard, const string& key, const shared_ptr<Entry>& entry) {
+        unique_lock<shared_mutex> lock(shard.mtx);
+        auto found = shard.entries.find(key);
+        if (found != shard.entries.end() && found->second == entry) shard.entries.erase(found);
+    }
+
+    mutable mutex mtx; // byte accounting and eviction, taken before a shard's
+    array<Shard, SHARDS> shards;
+    atomic<uint64_t> misses{ 0 };
+    uint64_t evictions = 0;
+    size_t bytes = 0;
+    size_t maxBytes;
+};
+
+
+#ifdef TEST
+
+#include <thread>
+
+TEST(test_IndicatorCache_computes_each_series_once) {
+    IndicatorCache cache;
+    IndicatorCache::Key key{ "BTCUSDT", "1h", 0, 3600 * 1000, "ema", { 50 } };
+    atomic<int> computed{ 0 };
+    vector<IndicatorCache::SeriesPtr> results(8);
+    vector<thread> threads;
+    for (size_t t = 0; t < results.size(); t++)
+        threads.emplace_back([&, t]() {
+            results[t] = cache.get(key, [&]() {
+                computed++;
+                this_thread::sleep_for(chrono::milliseconds(20)); // others arrive meanwhile
+                return IndicatorCache::Series(1000, 1.5f);
+            });
+        });
+    for (thread& t: threads) t.join();
+    assert(computed == 1 && "Concurrent readers should share one computation");
+    for (const IndicatorCache::SeriesPtr& series: results)
+        assert(series == results[0] && "Every reader should get the same series");
+
+    key.params = { 20 };
+    assert(cache.get(key, []() { return IndicatorCache::Series(10, 2); })->at(0) == 2 && "Parameters should be part of the key");
+    IndicatorCache::Stats stats = cache.getStats();
+    assert(stats.misses == 2 && stats.hits == 7 && stats.entries == 2 && stats.bytes == 1010 * sizeof(float) && "Stats");
+
+    bool thrown = false;
+    try {
+        cache.get("failing", []() -> IndicatorCache::Series { throw ERROR("no candles"); });
+    } catch (exception&) {
+        thrown = true;
+    }
+    assert(thrown && cache.get("failing", []() { return IndicatorCache::Series(1, 3); })->at(0) == 3 && "Failures should not be cached");
+}
+
+TEST(test_IndicatorCache_keys_are_exact) {
+    IndicatorCache::Key a{ "BTCUSDT", "1h", 0, 3600, "bollinger", { 0.1 + 0.2 } };
+    IndicatorCache::Key b = a;
+    b.params = { 0.3 }; // equal in 6 decimals
+    assert(a.str() != b.str() && "Parameters should not be rounded");
+    IndicatorCache::Key c{ "BTC|USDT", "1h", 0, 3600, "ema", {} };
+    IndicatorCache::Key d{ "BTC", "USDT|1h", 0, 3600, "ema", {} };
+    assert(c.str() != d.str() && "Separators in the fields should not collide");
+    IndicatorCache::Key e = a;
+    assert(a.str() == e.str() && "Equal keys should match");
+}
+
+TEST(test_IndicatorCache_evicts_least_recently_used) {
+    IndicatorCache cache(3000 * sizeof(float));
+    auto series = [](float value) { return [value]() { return IndicatorCache::Series(1000, value); }; };
+    IndicatorCache::SeriesPtr first = cache.get("a", series(1));
+    cache.get("b", series(2));
+    cache.get("c", series(3));
+    cache.get("a", series(0)); // used again, "b" is the oldest now
+    cache.get("d", series(4));
+    IndicatorCache::Stats stats = cache.getStats();
+    assert(stats.evictions == 1 && stats.entries == 3 && stats.bytes <= cache.getMaxBytes() && "Memory should stay in the budget");
+    assert(cache.get("a", series(0))->at(0) == 1 && cache.get("b", series(5))->at(0) == 5 && "The least recently used series should go");
+
+    cache.clear();
+    assert(cache.getStats().entries == 0 && first->size() == 1000 && first->at(0) == 1 && "Holders should keep evicted series");
+}
+
+#endif
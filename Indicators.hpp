@@ -0,0 +1,724 @@
+#pragma once
+
+#include <span>
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "../misc/ERROR.hpp"
+#include "Candle.hpp"
+#include "CandleColumns.hpp"
+
+using namespace std;
+
+// Technical indicators in two forms with identical numerics:
+//   update(...)  streaming, O(1) per candle, no allocation (strategies)
+//   bulk(...)    a whole series from column arrays (CandleColumns) into an
+//                output array, for precomputing in optimizers
+// bulk() starts from a reset state and leaves the indicator as if every
+// value had been passed to update(), so live updates can continue after a
+// precomputed history. Values before the indicator is ready are NaN.
+// The recurrences (running sums, EMA and Wilder smoothing) are sequential,
+// so bulk() splits every chunk into an element-wise pass (differences,
+// true ranges, price * volume: no dependencies, vectorized by the
+// compiler) and a scalar scan of it. Both forms do the arithmetic with the
+// same double operations in the same order, that keeps them bit-identical.
+
+namespace indicators {
+
+    // Element-wise passes run over chunks of this many values (on the stack).
+    static const size_t CHUNK = 256;
+
+    inline void checkPeriod(size_t period) {
+        if (!period) throw ERROR("Indicator period should be positive");
+    }
+
+    inline void checkSizes(size_t in, size_t out) {
+        if (in != out) throw ERROR("Indicator output size (" + to_string(out) + ") should match the input (" + to_string(in) + ")");
+    }
+
+}
+
+// Simple moving average, a running double sum over a ring of the last values.
+class SMA {
+public:
+    SMA(size_t period): period(period), window(period) { indicators::checkPeriod(period); }
+    virtual ~SMA() {}
+
+    float update(float value) {
+        const double delta = count >= period ? (double)value - window[pos] : (double)value;
+        push(value);
+        sum += delta;
+        return current();
+    }
+
+    void bulk(span<const float> values, span<float> out) {
+        indicators::checkSizes(values.size(), out.size());
+        reset();
+        double delta[indicators::CHUNK];
+        for (size_t begin = 0; begin < values.size(); begin += indicators::CHUNK) {
+            const size_t end = min(values.size(), begin + indicators::CHUNK);
+            for (size_t i = begin; i < end; i++)
+                delta[i - begin] = i >= period ? (double)values[i] - values[i - period] : (double)values[i];
+            for (size_t i = begin; i < end; i++) delta[i - begin] = sum += delta[i - begin]; // the only sequential pass
+            for (size_t i = begin; i < end; i++) out[i] = mean(delta[i - begin]);
+        }
+        for (size_t i = 0; i + 1 < period && i < out.size(); i++) out[i] = NAN;
+        restore(values);
+    }
+
+    float current() const { return ready() ? mean(sum) : NAN; }
+    bool ready() const { return count >= period; }
+    size_t getPeriod() const { return period; }
+
+    void reset() {
+        sum = 0;
+        count = pos = 0;
+    }
+
+protected:
+    float mean(double sum) const { return (float)(sum / period); }
+
+    void push(float value) {
+        window[pos] = value;
+        if (++pos == period) pos = 0;
+        count++;
+    }
+
+    // Ring state after a whole series.
+    void restore(span<const float> values) {
+        count = values.size();
+        pos = count % period;
+        for (size_t i = count > period ? count - period : 0; i < count; i++) window[i % period] = values[i];
+    }
+
+    size_t period;
+    vector<float> window;
+    size_t pos = 0;
+    size_t count = 0;
+    double sum = 0;
+};
+
+// Exponential moving average, alpha = 2 / (period + 1), seeded with the
+// SMA of the first period values.
+class EMA {
+public:
+    EMA(size_t period): period(period), alpha(2.0 / (period + 1)) { indicators::checkPeriod(period); }
+    virtual ~EMA() {}
+
+    float update(float value) {
+        step(value);
+        return current();
+    }
+
+    void bulk(span<const float> values, span<float> out) {
+        indicators::checkSizes(values.size(), out.size());
+        reset();
+        for (size_t i = 0; i < values.size(); i++) {
+            step(values[i]);
+            out[i] = current();
+        }
+    }
+
+    float current() const { return ready() ? (float)ema : NAN; }
+    bool ready() const { return count >= period; }
+    size_t getPeriod() const { return period; }
+
+    void reset() {
+        ema = 0;
+        count = 0;
+    }
+
+protected:
+    void step(float value) {
+        if (++count < period) ema += value;
+        else if (count == period) ema = (ema + value) / period;
+        else ema += alpha * (value - ema);
+    }
+
+    size_t period;
+    double alpha;
+    size_t count = 0;
+    double ema = 0; // sum of the values until ready
+};
+
+// Wilder's smoothing: the mean of the first period inputs, then
+// avg = (avg * (period - 1) + input) / period.
+class WilderAverage {
+public:
+    WilderAverage(size_t period): period(period) { indicators::checkPeriod(period); }
+    virtual ~WilderAverage() {}
+
+    void update(double input) {
+        if (++count < period) avg += input;
+        else if (count == period) avg = (avg + input) / period;
+        else avg = (avg * (period - 1) + input) / period;
+    }
+
+    double current() const { return avg; }
+    bool ready() const { return count >= period; }
+
+    void reset() {
+        avg = 0;
+        count = 0;
+    }
+
+protected:
+    size_t period;
+    size_t count = 0;
+    double avg = 0;
+};
+
+// Relative strength index of the closes (Wilder), ready after period + 1
+// values (period changes).
+class RSI {
+public:
+    RSI(size_t period): period(period), gains(period), losses(period) {}
+    virtual ~RSI() {}
+
+    float update(float close) {
+        if (count++) {
+            const double change = (double)close - previous;
+            gains.update(max(change, 0.0));
+            losses.update(max(-change, 0.0));
+        }
+        previous = close;
+        return current();
+    }
+
+    void bulk(span<const float> closes, span<float> out) {
+        indicators::checkSizes(closes.size(), out.size());
+        reset();
+        if (closes.empty()) return;
+        out[0] = update(closes[0]);
+        double up[indicators::CHUNK], down[indicators::CHUNK];
+        for (size_t begin = 1; begin < closes.size(); begin += indicators::CHUNK) {
+            const size_t end = min(closes.size(), begin + indicators::CHUNK);
+            for (size_t i = begin; i < end; i++) {
+                const double change = (double)closes[i] - closes[i - 1];
+                up[i - begin] = max(change, 0.0);
+                down[i - begin] = max(-change, 0.0);
+            }
+            for (size_t i = begin; i < end; i++) {
+                gains.update(up[i - begin]);
+                losses.update(down[i - begin]);
+                out[i] = current();
+            }
+        }
+        count = closes.size();
+        previous = closes.back();
+    }
+
+    // 0..100, 100 without losses, 50 without any change.
+    float current() const {
+        if (!ready()) return NAN;
+        const double gain = gains.current(), loss = losses.current();
+        if (loss == 0) return gain == 0 ? 50 : 100;
+        return (float)(100 - 100 / (1 + gain / loss));
+    }
+
+    bool ready() const { return gains.ready(); }
+    size_t getPeriod() const { return period; }
+
+    void reset() {
+        gains.reset();
+        losses.reset();
+        count = 0;
+        previous = 0;
+    }
+
+protected:
+    size_t period;
+    WilderAverage gains, losses;
+    size_t count = 0;
+    float previous = 0;
+};
+
+// Average true range (Wilder); the first true range is high - low.
+class ATR {
+public:
+    ATR(size_t period): period(period), average(period) {}
+    virtual ~ATR() {}
+
+    float update(float high, float low, float close) {
+        average.update(trueRange(high, low, count++ ? previous : NAN));
+        previous = close;
+        return current();
+    }
+
+    float update(const Candle& candle) { return update(candle.getHigh(), candle.getLow(), candle.getClose()); }
+
+    void bulk(span<const float> highs, span<const float> lows, span<const float> closes, span<float> out) {
+        indicators::checkSizes(highs.size(), out.size());
+        indicators::checkSizes(lows.size(), out.size());
+        indicators::checkSizes(closes.size(), out.size());
+        reset();
+        double ranges[indicators::CHUNK];
+        for (size_t begin = 0; begin < out.size(); begin += indicators::CHUNK) {
+            const size_t end = min(out.size(), begin + indicators::CHUNK);
+            for (size_t i = begin; i < end; i++)
+                ranges[i - begin] = trueRange(highs[i], lows[i], i ? closes[i - 1] : NAN);
+            for (size_t i = begin; i < end; i++) {
+                average.update(ranges[i - begin]);
+                out[i] = current();
+            }
+        }
+        count = out.size();
+        if (count) previous = closes.back();
+    }
+
+    void bulk(const CandleColumns& candles, span<float> out) {
+        bulk(candles.highs(), candles.lows(), candles.closes(), out);
+    }
+
+    float current() const { return ready() ? (float)average.current() : NAN; }
+    bool ready() const { return average.ready(); }
+    size_t getPeriod() const { return period; }
+
+    void reset() {
+        average.reset();
+        count = 0;
+        previous = 0;
+    }
+
+protected:
+    // previous close, NaN for the first candle
+    static double trueRange(float high, float low, float previous) {
+        const double range = (double)high - low;
+        if (isnan(previous)) return range;
+        return max(range, max(abs((double)high - previous), abs((double)low - previous)));
+    }
+
+    size_t period;
+    WilderAverage average;
+    size_t count = 0;
+    float previous = 0;
+};
+
+// Bollinger bands: SMA -/+ deviations * population standard deviation of
+// the window. The mean and the sum of squared deviations (m2) are updated
+// Welford style, the value leaving the window taken out as the new one
+// comes in: no difference of two large sums of squares, which cancels
+// catastrophically at high prices (e.g. BTC's 60000 with cents of spread).
+// Every period values both are summed again from the window (two passes),
+// so rounding can not drift over long series.
+class Bollinger {
+public:
+    struct Bands {
+        float lower;
+        float middle;
+        float upper;
+    };
+
+    Bollinger(size_t period, double deviations = 2):
+        period(period), deviations(deviations), window(period)
+    {
+        indicators::checkPeriod(period);
+    }
+
+    virtual ~Bollinger() {}
+
+    Bands update(float value) {
+        const double old = count >= period ? window[pos] : 0;
+        window[pos] = value;
+        if (++pos == period) pos = 0;
+        count++;
+        add(value, old);
+        if (!pos) resum(window.data()); // in order: the oldest value is at 0
+        return current();
+    }
+
+    void bulk(span<const float> values, span<float> lower, span<float> middle, span<float> upper) {
+        indicators::checkSizes(values.size(), lower.size());
+        indicators::checkSizes(values.size(), middle.size());
+        indicators::checkSizes(values.size(), upper.size());
+        reset();
+        double means[indicators::CHUNK], m2s[indicators::CHUNK];
+        for (size_t begin = 0; begin < values.size(); begin += indicators::CHUNK) {
+            const size_t end = min(values.size(), begin + indicators::CHUNK);
+            for (size_t i = begin; i < end; i++) { // the sequential pass
+                count = i + 1;
+                add(values[i], i >= period ? values[i - period] : 0);
+                if (count % period == 0) resum(values.data() + count - period);
+                means[i - begin] = mean;
+                m2s[i - begin] = m2;
+            }
+            for (size_t i = begin; i < end; i++) {
+                const Bands bands = of(means[i - begin], m2s[i - begin]);
+                lower[i] = bands.lower;
+                middle[i] = bands.middle;
+                upper[i] = bands.upper;
+            }
+        }
+        for (size_t i = 0; i + 1 < period && i < values.size(); i++) lower[i] = middle[i] = upper[i] = NAN;
+        count = values.size();
+        pos = count % period;
+        for (size_t i = count > period ? count - period : 0; i < count; i++) window[i % period] = values[i];
+    }
+
+    Bands current() const { return ready() ? of(mean, m2) : Bands{ NAN, NAN, NAN }; }
+
+    // Population standard deviation of the window, in double.
+    double getStandardDeviation() const { return ready() ? sqrt(max(m2 / period, 0.0)) : NAN; }
+
+    bool ready() const { return count >= period; }
+    size_t getPeriod() const { return period; }
+
+    void reset() {
+        mean = m2 = 0;
+        count = pos = 0;
+    }
+
+protected:
+    Bands of(double mean, double m2) const {
+        const double deviation = deviations * sqrt(max(m2 / period, 0.0));
+        return { (float)(mean - deviation), (float)mean, (float)(mean + deviation) };
+    }
+
+    // The count-th value in, `old` out once the window is full.
+    void add(double value, double old) {
+        if (count <= period) {
+            const double delta = value - mean;
+            mean += delta / count;
+            m2 += delta * (value - mean);
+            return;
+        }
+        const double delta = value - old, previous = mean;
+        mean += delta / period;
+        m2 += delta * ((value - mean) + (old - previous));
+    }
+
+    // Exact state of the period values of the window, oldest first.
+    void resum(const float* values) {
+        double sum = 0;
+        for (size_t i = 0; i < period; i++) sum += values[i];
+        mean = sum / period;
+        m2 = 0;
+        for (size_t i = 0; i < period; i++) m2 += (values[i] - mean) * (values[i] - mean);
+    }
+
+    size_t period;
+    double deviations;
+    vector<float> window;
+    size_t pos = 0;
+    size_t count = 0;
+    double mean = 0;
+    double m2 = 0;    // sum of the squared deviations from the mean
+};
+
+// Lowest (or highest) value of the last period values. Streaming keeps a
+// monotonic deque (a ring of period slots, candidates in the order they
+// came, each better than the ones before it), amortized O(1). bulk() uses
+// van Herk / Gil-Werman instead: per block of period values a running
+// minimum from the left and from the right, every window is then the
+// minimum of two of them, a branch-free pass that vectorizes. Min and max
+// are exact, so both give the same values.
+template<bool Max>
+class RollingExtreme {
+public:
+    RollingExtreme(size_t period): period(period), slots(period) { indicators::checkPeriod(period); }
+    virtual ~RollingExtreme() {}
+
+    float update(float value) {
+        while (size && !better(slots[back()].value, value)) size--; // dominated
+        if (size && slots[head].index + period <= count) { // fell out of the window
+            if (++head == period) head = 0;
+            size--;
+        }
+        slots[(head + size++) % period] = { count++, value };
+        return current();
+    }
+
+    void bulk(span<const float> values, span<float> out) {
+        indicators::checkSizes(values.size(), out.size());
+        reset();
+        const size_t n = values.size();
+        if (!n) return;
+        vector<float> left(n), right(n);
+        for (size_t i = 0; i < n; i++)
+            left[i] = i % period ? pick(left[i - 1], values[i]) : values[i];
+        for (size_t i = n; i-- > 0;)
+            right[i] = i % period == period - 1 || i == n - 1 ? values[i] : pick(right[i + 1], values[i]);
+        for (size_t i = 0; i + 1 < period && i < n; i++) out[i] = NAN;
+        for (size_t i = period - 1; i < n; i++)
+            out[i] = pick(right[i + 1 - period], left[i]);
+        // the deque state of the last window
+        count = n > period ? n - period : 0;
+        for (size_t i = count; i < n; i++) update(values[i]);
+    }
+
+    float current() const { return count >= period ? slots[head].value : NAN; }
+    bool ready() const { return count >= period; }
+    size_t getPeriod() const { return period; }
+
+    void reset() {
+        head = size = count = 0;
+    }
+
+protected:
+    struct Slot {
+        size_t index;
+        float value;
+    };
+
+    static bool better(float a, float b) { return Max ? a > b : a < b; }
+    static float pick(float a, float b) { return Max ? max(a, b) : min(a, b); }
+    size_t back() const { return (head + size - 1) % period; }
+
+    size_t period;
+    vector<Slot> slots;
+    size_t head = 0;
+    size_t size = 0;
+    size_t count = 0;
+};
+
+typedef RollingExtreme<false> RollingMin;
+typedef RollingExtreme<true> RollingMax;
+
+// Volume weighted average of the typical price (high + low + close) / 3
+// over the last period candles; NaN while the window has no volume.
+class VWAP {
+public:
+    VWAP(size_t period): period(period), priceVolumes(period), volumes(period) { indicators::checkPeriod(period); }
+    virtual ~VWAP() {}
+
+    float update(float high, float low, float close, float volume) {
+        const double priceVolume = typical(high, low, close) * volume;
+        const double oldPriceVolume = count >= period ? priceVolumes[pos] : 0, oldVolume = count >= period ? volumes[pos] : 0;
+        accumulate(priceVolume - oldPriceVolume, (double)volume - oldVolume);
+        priceVolumes[pos] = priceVolume;
+        volumes[pos] = volume;
+        if (++pos == period) pos = 0;
+        count++;
+        return current();
+    }
+
+    float update(const Candle& candle) {
+        return update(candle.getHigh(), candle.getLow(), candle.getClose(), candle.getVolume());
+    }
+
+    void bulk(span<const float> highs, span<const float> lows, span<const float> closes, span<const float> volumes, span<float> out) {
+        const size_t n = out.size();
+        indicators::checkSizes(highs.size(), n);
+        indicators::checkSizes(lows.size(), n);
+        indicators::checkSizes(closes.size(), n);
+        indicators::checkSizes(volumes.size(), n);
+        reset();
+        double deltaPriceVolume[indicators::CHUNK], deltaVolume[indicators::CHUNK];
+        for (size_t begin = 0; begin < n; begin += indicators::CHUNK) {
+            const size_t end = min(n, begin + indicators::CHUNK);
+            for (size_t i = begin; i < end; i++) {
+                const double priceVolume = typical(highs[i], lows[i], closes[i]) * volumes[i];
+                const double old = i >= period ? typical(highs[i - period], lows[i - period], closes[i - period]) * volumes[i - period] : 0;
+                deltaPriceVolume[i - begin] = priceVolume - old;
+                deltaVolume[i - begin] = (double)volumes[i] - (i >= period ? (double)volumes[i - period] : 0);
+            }
+            for (size_t i = begin; i < end; i++) {
+                accumulate(deltaPriceVolume[i - begin], deltaVolume[i - begin]);
+                deltaPriceVolume[i - begin] = sumPriceVolume;
+                deltaVolume[i - begin] = sumVolume;
+            }
+            for (size_t i = begin; i < end; i++) out[i] = average(deltaPriceVolume[i - begin], deltaVolume[i - begin]);
+        }
+        for (size_t i = 0; i + 1 < period && i < n; i++) out[i] = NAN;
+        count = n;
+        pos = count % period;
+        for (size_t i = count > period ? count - period : 0; i < count; i++) {
+            priceVolumes[i % period] = typical(highs[i], lows[i], closes[i]) * volumes[i];
+            this->volumes[i % period] = volumes[i];
+        }
+    }
+
+    void bulk(const CandleColumns& candles, span<float> out) {
+        bulk(candles.highs(), candles.lows(), candles.closes(), candles.volumes(), out);
+    }
+
+    float current() const { return ready() ? average(sumPriceVolume, sumVolume) : NAN; }
+    bool ready() const { return count >= period; }
+    size_t getPeriod() const { return period; }
+
+    void reset() {
+        sumPriceVolume = sumVolume = 0;
+        count = pos = 0;
+    }
+
+protected:
+    static float average(double priceVolume, double volume) { return volume > 0 ? (float)(priceVolume / volume) : NAN; }
+
+    static double typical(float high, float low, float close) {
+        return ((double)high + low + close) / 3;
+    }
+
+    void accumulate(double priceVolume, double volume) {
+        sumPriceVolume += priceVolume;
+        sumVolume += volume;
+    }
+
+    size_t period;
+    vector<double> priceVolumes;
+    vector<float> volumes;
+    size_t pos = 0;
+    size_t count = 0;
+    double sumPriceVolume = 0;
+    double sumVolume = 0;
+};
+
+
+#ifdef TEST
+
+#include <chrono>
+#include <random>
+#include <cstring>
+
+// Bit-identical, NaNs included.
+inline bool test_Indicators_same(span<const float> a, span<const float> b) {
+    return a.size() == b.size() && !memcmp(a.data(), b.data(), a.size() * sizeof(float));
+}
+
+TEST(test_Indicators_known_values) {
+    vector<float> values = { 1, 2, 3, 4, 5, 4, 3 };
+    SMA sma(3);
+    vector<float> out(values.size());
+    sma.bulk(values, out);
+    assert(isnan(out[1]) && out[2] == 2 && out[4] == 4 && out[6] == 4 && "SMA of the last 3 values");
+
+    EMA ema(3);
+    ema.bulk(values, out);
+    assert(out[2] == 2 && out[3] == 3 && out[4] == 4 && out[5] == 4 && "EMA seeded with the SMA, alpha 0.5");
+
+    RollingMin low(3);
+    RollingMax high(3);
+    vector<float> lows(values.size());
+    low.bulk(values, lows);
+    high.bulk(values, out);
+    assert(lows[4] == 3 && out[4] == 5 && lows[6] == 3 && out[6] == 5 && "Rolling extremes");
+
+    RSI rsi(3);
+    vector<float> rising = { 1, 2, 3, 4, 5 };
+    rsi.bulk(rising, span<float>(out).first(5));
+    assert(isnan(out[2]) && out[3] == 100 && "RSI without losses");
+    assert(rsi.update(2) == 40 && "RSI should fall after a loss");
+
+    Bollinger bollinger(2, 2);
+    Bollinger::Bands bands = { 0, 0, 0 };
+    for (float value: { 1.0f, 3.0f }) bands = bollinger.update(value);
+    assert(bands.middle == 2 && bands.lower == 0 && bands.upper == 4 && "Bands two deviations away");
+
+    ATR atr(2);
+    atr.update(Candle(0, 10, 12, 9, 11, 1));
+    assert(atr.update(Candle(60, 11, 16, 13, 15, 1)) == 4 && "True range should reach the previous close");
+
+    VWAP vwap(2);
+    vwap.update(Candle(0, 3, 3, 3, 3, 1));
+    assert(vwap.update(Candle(60, 6, 6, 6, 6, 2)) == 5 && "VWAP weighted by volume");
+    assert(isnan(VWAP(1).update(Candle(0, 1, 1, 1, 1, 0))) && "No volume, no VWAP");
+}
+
+TEST(test_Indicators_bulk_and_streaming_are_identical) {
+    mt19937 rng(7);
+    normal_distribution<float> step(0, 1);
+    CandleColumns candles;
+    float price = 1000;
+    for (int i = 0; i < 5000; i++) {
+        const float open = price;
+        price = max(1.0f, price + step(rng));
+        const float spread = abs(step(rng));
+        candles.push_back(Candle(i * 60, open, max(open, price) + spread, min(open, price) - spread, price, abs(step(rng)) * 10));
+    }
+    const size_t n = candles.size(), split = 3001;
+    span<const float> closes = candles.closes();
+    vector<float> bulk(n), stream(n), lower(n), upper(n);
+
+    // bulk over the first part, streaming continues from its state
+    auto check = [&](auto indicator, auto run, auto step, const char* name) {
+        auto streaming = indicator;
+        for (size_t i = 0; i < n; i++) stream[i] = step(streaming, i);
+        run(indicator, n);
+        bool same = test_Indicators_same(bulk, stream);
+        run(indicator, split);
+        for (size_t i = split; i < n; i++) bulk[i] = step(indicator, i);
+        if (!same || !test_Indicators_same(bulk, stream)) cerr << name << " differs" << endl;
+        assert(same && test_Indicators_same(bulk, stream) && "Bulk and streaming should be bit-identical, also when continued");
+    };
+    auto closed = [&](auto& indicator, size_t size) { indicator.bulk(closes.first(size), span<float>(bulk).first(size)); };
+    auto onClose = [&](auto& indicator, size_t i) { return indicator.update(closes[i]); };
+    check(SMA(20), closed, onClose, "SMA");
+    check(EMA(20), closed, onClose, "EMA");
+    check(RSI(14), closed, onClose, "RSI");
+    check(RollingMin(50), closed, onClose, "RollingMin");
+    check(RollingMax(7), closed, onClose, "RollingMax");
+    check(ATR(14),
+        [&](ATR& atr, size_t size) { atr.bulk(candles.highs().first(size), candles.lows().first(size), closes.first(size), span<float>(bulk).first(size)); },
+        [&](ATR& atr, size_t i) { return atr.update(candles.at(i)); }, "ATR");
+    check(VWAP(30),
+        [&](VWAP& vwap, size_t size) {
+            vwap.bulk(candles.highs().first(size), candles.lows().first(size), closes.first(size), candles.volumes().first(size), span<float>(bulk).first(size));
+        },
+        [&](VWAP& vwap, size_t i) { return vwap.update(candles.at(i)); }, "VWAP");
+    float Bollinger::Bands::* bands[] = { &Bollinger::Bands::lower, &Bollinger::Bands::middle, &Bollinger::Bands::upper };
+    vector<float> middle(n);
+    for (float Bollinger::Bands::* band: bands) {
+        vector<float>& series = band == bands[0] ? lower : band == bands[1] ? middle : upper;
+        check(Bollinger(20),
+            [&](Bollinger& bollinger, size_t size) {
+                bollinger.bulk(closes.first(size), span<float>(lower).first(size), span<float>(middle).first(size), span<float>(upper).first(size));
+                copy(series.begin(), series.begin() + size, bulk.begin());
+            },
+            [&](Bollinger& bollinger, size_t i) { return bollinger.update(closes[i]).*band; }, "Bollinger");
+    }
+
+    // rolling extremes against a brute force window
+    RollingMin low(50);
+    low.bulk(closes, bulk);
+    for (size_t i = 49; i < n; i += 97)
+        assert(bulk[i] == *min_element(closes.begin() + i - 49, closes.begin() + i + 1) && "Rolling minimum of the window");
+
+}
+
+TEST(test_Indicators_bollinger_is_precise_at_high_prices) {
+    // a long series around 60000 moving by a float step: the variance is
+    // tiny next to the squared prices
+    mt19937 rng(11);
+    uniform_int_distribution<int> steps(-3, 3);
+    vector<float> values;
+    float price = 60000;
+    for (int i = 0; i < 200000; i++) values.push_back(price += steps(rng) / 256.0f); // exact in float
+    const size_t period = 20;
+    Bollinger bollinger(period, 2);
+    for (size_t i = 0; i < values.size(); i++) {
+        bollinger.update(values[i]);
+        if (i + 1 < period || i % 101) continue;
+        long double sum = 0, squares = 0;
+        for (size_t j = i + 1 - period; j <= i; j++) sum += values[j];
+        const long double mean = sum / period;
+        for (size_t j = i + 1 - period; j <= i; j++) squares += (values[j] - mean) * (values[j] - mean);
+        assert(abs(bollinger.getStandardDeviation() - sqrt((double)(squares / period))) < 1e-9 &&
+               "The deviation should not lose the digits of the prices");
+    }
+}
+
+#ifdef BENCHMARK
+
+TEST(test_Indicators_benchmark_sma_bulk_and_streaming) {
+    vector<float> closes(5000);
+    for (size_t i = 0; i < closes.size(); i++) closes[i] = 1000 + 10 * sin(i / 50.0f);
+    const size_t n = closes.size();
+    vector<float> bulk(n), stream(n);
+    auto start = chrono::steady_clock::now();
+    SMA sma(50);
+    for (int repeat = 0; repeat < 100; repeat++) sma.bulk(closes, bulk);
+    auto bulkNanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for (int repeat = 0; repeat < 100; repeat++) {
+        sma.reset();
+        for (size_t i = 0; i < n; i++) stream[i] = sma.update(closes[i]);
+    }
+    auto streamNanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    assert(test_Indicators_same(bulk, stream));
+    cout << "  SMA: " << (double)bulkNanos / (100 * n) << " ns/value bulk, " << (double)streamNanos / (100 * n) << " ns/value streaming" << endl;
+}
+
+#endif // BENCHMARK
+
+#endif
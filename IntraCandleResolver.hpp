@@ -0,0 +1,57 @@
+#pragma once
+
+#include <span>
+#include <functional>
+
+#include "Candle.hpp"
+#include "MappedCandles.hpp"
+
+using namespace std;
+
+// Finer candles (1m, 1s, ...) inside a coarse backtest candle, for the rare
+// candles where the order of limit fills is ambiguous (see
+// TestExchange::setIntraCandleResolver()). Nothing is loaded until the
+// first question; then a chunk of fine history around it is loaded at once
+// (typically a CandleHistory::loadMapped() view) and reused for the
+// following candles in it.
+class IntraCandleResolver {
+public:
+    // Fine candles within [from, to], inclusive.
+    typedef function<MappedCandles(time_sec from, time_sec to)> Loader;
+
+    IntraCandleResolver(time_sec period, Loader loader, time_sec chunk = 24 * 60 * 60):
+        period(period), chunk(max(chunk, period)), loader(loader)
+    {}
+
+    virtual ~IntraCandleResolver() {}
+
+    time_sec getPeriod() const { return period; }
+
+    // Fine candles of the coarse candle opening at `time`, in time order
+    // (empty when the finer history has none).
+    span<const Candle> candles(time_sec time) {
+        const time_sec end = time + period - 1;
+        if (!loads || time < from || end > to) {
+            from = time;
+            to = time + chunk - 1;
+            window = loader(from, to);
+            loads++;
+        }
+        resolved++;
+        return MappedCandles::range(window, time, end);
+    }
+
+    size_t getLoads() const { return loads; }
+    size_t getResolved() const { return resolved; }
+
+private:
+    time_sec period;
+    time_sec chunk;
+    Loader loader;
+
+    MappedCandles window;
+    time_sec from = 0;
+    time_sec to = 0;
+    size_t loads = 0;
+    size_t resolved = 0;
+};
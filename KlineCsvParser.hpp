@@ -0,0 +1,179 @@
+#pragma once
+
+#include <string>
+#include <charconv>
+#include <cstring>
+
+#include "../misc/ERROR.hpp"
+#include "Candle.hpp"
+
+using namespace std;
+
+// Streaming parser of Binance kline CSV (open time, open, high, low,
+// close, volume, ...). Chunks may split lines anywhere; only the partial
+// last line is carried over. Numbers are parsed in place with from_chars,
+// no per-line strings or vectors are created.
+// The sink is anything with push_back(const Candle&) (vector<Candle>, CandleColumns).
+class KlineCsvParser {
+public:
+    KlineCsvParser() {}
+
+    virtual ~KlineCsvParser() {}
+
+    template<typename Sink>
+    void feed(const char* data, size_t size, Sink& out) {
+        const char* end = data + size;
+        if (!rest.empty()) { // complete the line split by the previous chunk
+            const char* nl = (const char*)memchr(data, '\n', size);
+            if (!nl) {
+                rest.append(data, size);
+                return;
+            }
+            rest.append(data, nl - data);
+            parseLine(rest.data(), rest.data() + rest.size(), out);
+            rest.clear();
+            data = nl + 1;
+        }
+        while (data < end) {
+            const char* nl = (const char*)memchr(data, '\n', end - data);
+            if (!nl) {
+                rest.assign(data, end - data);
+                return;
+            }
+            parseLine(data, nl, out);
+            data = nl + 1;
+        }
+    }
+
+    template<typename Sink>
+    void finish(Sink& out) {
+        if (!rest.empty()) parseLine(rest.data(), rest.data() + rest.size(), out);
+        rest.clear();
+    }
+
+    template<typename Sink>
+    static void parse(const string& csv, Sink& out) {
+        KlineCsvParser parser;
+        parser.feed(csv.data(), csv.size(), out);
+        parser.finish(out);
+    }
+
+private:
+
+    template<typename Sink>
+    static void parseLine(const char* p, const char* end, Sink& out) {
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        while (end > p && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) end--;
+        if (p == end) return;
+        if (*p < '0' || *p > '9') return; // header line
+
+        // open time: the first 10 digits are seconds (ms and us timestamps alike)
+        const char* comma = (const char*)memchr(p, ',', end - p);
+        if (!comma) throw ERROR("Invalid kline line: " + string(p, end));
+        time_sec time = 0;
+        from_chars(p, min(comma, p + 10), time);
+        p = comma + 1;
+
+        float values[5];
+        for (int i = 0; i < 5; i++) {
+            double value = 0;
+            auto result = from_chars(p, end, value);
+            if (result.ec != errc()) throw ERROR("Invalid kline number: " + string(p, end));
+            values[i] = (float)value;
+            p = result.ptr;
+            if (i < 4) {
+                if (p >= end || *p != ',') throw ERROR("Invalid kline line: missing column");
+                p++;
+            }
+        }
+        out.push_back(Candle(time, values[0], values[1], values[2], values[3], values[4]));
+    }
+
+    string rest;
+};
+
+
+#ifdef TEST
+
+#include <chrono>
+#include <vector>
+#include "../misc/explode.hpp"
+#include "../misc/trim.hpp"
+#include "CandleColumns.hpp"
+
+inline string KlineCsvParser_test_csv(time_sec start, int count) {
+    string csv;
+    for (int i = 0; i < count; i++)
+        csv += to_string((start + i * 60) * 1000) + "," + to_string(27000 + i % 100) + ".12000000," +
+            to_string(27100 + i % 100) + ".50000000,26950.01000000," + to_string(27050 + i % 50) + ".99000000," +
+            "123.45678000," + to_string((start + i * 60 + 59) * 1000 + 999) + ",3345678.12345678,1234,61.2,1659123.5,0\r\n";
+    return csv;
+}
+
+// The explode/atof based parsing it replaces, kept as reference.
+inline vector<Candle> KlineCsvParser_test_legacy(const string& csv) {
+    vector<Candle> candles;
+    vector<string> lines = explode("\n", csv);
+    for (const string& line: lines) {
+        if (trim(line).empty()) continue;
+        vector<string> cols = explode(",", trim(line));
+        Candle candle;
+        candle.setTime(atoll(cols[0].substr(0, 10).c_str()));
+        candle.setOpen(atof(cols[1].c_str()));
+        candle.setHigh(atof(cols[2].c_str()));
+        candle.setLow(atof(cols[3].c_str()));
+        candle.setClose(atof(cols[4].c_str()));
+        candle.setVolume(atof(cols[5].c_str()));
+        candles.push_back(candle);
+    }
+    return candles;
+}
+
+TEST(test_KlineCsvParser_matches_legacy_parsing_across_chunks) {
+    const string csv = KlineCsvParser_test_csv(1700000000, 500);
+    vector<Candle> expected = KlineCsvParser_test_legacy(csv);
+    for (size_t chunk: { (size_t)1, (size_t)7, (size_t)4096, csv.size() }) {
+        KlineCsvParser parser;
+        vector<Candle> result;
+        for (size_t i = 0; i < csv.size(); i += chunk)
+            parser.feed(csv.data() + i, min(chunk, csv.size() - i), result);
+        parser.finish(result);
+        assert(result.size() == expected.size() && "Should parse every line");
+        for (size_t i = 0; i < result.size(); i++)
+            assert(result[i].dump() == expected[i].dump() && "Should match the legacy parser exactly");
+    }
+}
+
+TEST(test_KlineCsvParser_handles_header_microseconds_and_columns) {
+    const string csv =
+        "open_time,open,high,low,close,volume,close_time,quote_volume,count,taker_buy_volume,taker_buy_quote_volume,ignore\n"
+        "1735689600000000,1.5,2.5,0.5,2,100,1735689659999999,150,10,50,75,0";
+    CandleColumns columns;
+    KlineCsvParser::parse(csv, columns);
+    assert(columns.size() == 1 && "Header line should be skipped");
+    assert(columns.times()[0] == 1735689600 && "Microsecond timestamps should become seconds");
+    assert(columns.closes()[0] == 2 && columns.volumes()[0] == 100 && "Columns should be filled");
+}
+
+#ifdef BENCHMARK
+
+TEST(test_KlineCsvParser_benchmark_parse_throughput) {
+    const string csv = KlineCsvParser_test_csv(1600000000, 200000);
+    auto measure = [](function<void()> f) {
+        auto start = chrono::steady_clock::now();
+        f();
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+    vector<Candle> candles;
+    candles.reserve(200000);
+    double parserSec = measure([&]() { KlineCsvParser::parse(csv, candles); });
+    vector<Candle> legacy;
+    double legacySec = measure([&]() { legacy = KlineCsvParser_test_legacy(csv); });
+    assert(candles.size() == legacy.size());
+    const double mb = csv.size() / 1e6;
+    cout << "  KlineCsvParser: " << mb / parserSec << " MB/s, explode/atof: " << mb / legacySec << " MB/s" << endl;
+}
+
+#endif // BENCHMARK
+
+#endif
@@ -1,12 +1,15 @@
 #pragma once
 
+#include <cstdint>
+
 #include "OrderType.hpp"
 
 struct LimitOrder {
     OrderType type;
     float price;
     float amount;  // For buy: cash amount, For sell: asset amount
+    int64_t units; // The reserved amount in fixed-point ledger units (see FixedLedger)
     
-    LimitOrder(OrderType type, float price, float amount):
-        type(type), price(price), amount(amount) {}
+    LimitOrder(OrderType type, float price, float amount, int64_t units = 0):
+        type(type), price(price), amount(amount), units(units) {}
 };
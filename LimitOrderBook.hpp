@@ -0,0 +1,229 @@
+#pragma once
+
+#include <set>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <memory_resource>
+
+#include "LimitOrder.hpp"
+
+using namespace std;
+
+// Resting limit orders indexed by price: buys from the highest price down,
+// sells from the lowest up, so a candle crosses a prefix of each side and
+// fill() costs O(log n + fills) instead of a scan of every order. Nodes
+// come from a pool, placing and filling orders does not hit the heap in
+// steady state. Every order keeps its placement sequence; fills and
+// orders() are returned in placement order, the order the fills were
+// applied in before, so float results stay bit-identical.
+class LimitOrderBook {
+public:
+    LimitOrderBook() {}
+
+    LimitOrderBook(const LimitOrderBook& other) { assign(other.orders()); }
+
+    LimitOrderBook& operator=(const LimitOrderBook& other) {
+        if (this != &other) assign(other.orders());
+        return *this;
+    }
+
+    virtual ~LimitOrderBook() {}
+
+    void add(const LimitOrder& order) {
+        if (order.type == OrderType::BUY_LIMIT) buys.insert({ order.price, next++, order.amount, order.units });
+        else sells.insert({ order.price, next++, order.amount, order.units });
+        reserve(order, 1);
+    }
+
+    size_t size() const { return buys.size() + sells.size(); }
+
+    // What the orders of a side hold back: cash of the buys, asset of the
+    // sells (amounts, and units for the fixed-point ledger).
+    double getReserved(OrderType type) const { return type == OrderType::BUY_LIMIT ? reservedBuys : reservedSells; }
+    int64_t getReservedUnits(OrderType type) const { return type == OrderType::BUY_LIMIT ? reservedBuyUnits : reservedSellUnits; }
+
+    // Whether the range crosses a buy and a sell too (fill order is ambiguous).
+    bool crossesBoth(float low, float high) const {
+        return !buys.empty() && low <= buys.begin()->price && !sells.empty() && high >= sells.begin()->price;
+    }
+    bool empty() const { return buys.empty() && sells.empty(); }
+
+    // Removes and returns the orders the candle range crosses: buys at or
+    // above `low`, sells at or below `high`. The result is reused by the next call.
+    const vector<LimitOrder>& fill(float low, float high) {
+        filled.clear();
+        auto buy = buys.begin();
+        for (; buy != buys.end() && low <= buy->price; ++buy)
+            filled.push_back({ buy->seq, LimitOrder(OrderType::BUY_LIMIT, buy->price, buy->amount, buy->units) });
+        buys.erase(buys.begin(), buy);
+        auto sell = sells.begin();
+        for (; sell != sells.end() && high >= sell->price; ++sell)
+            filled.push_back({ sell->seq, LimitOrder(OrderType::SELL_LIMIT, sell->price, sell->amount, sell->units) });
+        sells.erase(sells.begin(), sell);
+        for (const auto& [seq, order]: filled) reserve(order, -1);
+        return inPlacementOrder();
+    }
+
+    // All orders in placement order. The result is reused by the next call.
+    const vector<LimitOrder>& orders() const {
+        filled.clear();
+        for (const Entry& buy: buys) filled.push_back({ buy.seq, LimitOrder(OrderType::BUY_LIMIT, buy.price, buy.amount, buy.units) });
+        for (const Entry& sell: sells) filled.push_back({ sell.seq, LimitOrder(OrderType::SELL_LIMIT, sell.price, sell.amount, sell.units) });
+        return inPlacementOrder();
+    }
+
+    void clear() {
+        buys.clear();
+        sells.clear();
+        reservedBuys = reservedSells = 0;
+        reservedBuyUnits = reservedSellUnits = 0;
+    }
+
+    void assign(const vector<LimitOrder>& orders) {
+        clear();
+        for (const LimitOrder& order: orders) add(order);
+    }
+
+private:
+
+    struct Entry {
+        float price;
+        uint64_t seq;
+        float amount;
+        int64_t units;
+    };
+
+    struct Descending {
+        bool operator()(const Entry& a, const Entry& b) const {
+            return a.price > b.price || (a.price == b.price && a.seq < b.seq);
+        }
+    };
+
+    struct Ascending {
+        bool operator()(const Entry& a, const Entry& b) const {
+            return a.price < b.price || (a.price == b.price && a.seq < b.seq);
+        }
+    };
+
+    void reserve(const LimitOrder& order, int sign) {
+        if (order.type == OrderType::BUY_LIMIT) {
+            reservedBuys = buys.empty() ? 0 : reservedBuys + sign * (double)order.amount; // no rounding left over
+            reservedBuyUnits += sign * order.units;
+        } else {
+            reservedSells = sells.empty() ? 0 : reservedSells + sign * (double)order.amount;
+            reservedSellUnits += sign * order.units;
+        }
+    }
+
+    const vector<LimitOrder>& inPlacementOrder() const {
+        sort(filled.begin(), filled.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        result.clear();
+        for (const auto& [seq, order]: filled) result.push_back(order);
+        return result;
+    }
+
+    pmr::unsynchronized_pool_resource pool;
+    pmr::set<Entry, Descending> buys{ &pool };
+    pmr::set<Entry, Ascending> sells{ &pool };
+    uint64_t next = 0;
+    double reservedBuys = 0;
+    double reservedSells = 0;
+    int64_t reservedBuyUnits = 0;
+    int64_t reservedSellUnits = 0;
+
+    mutable vector<pair<uint64_t, LimitOrder>> filled;
+    mutable vector<LimitOrder> result;
+};
+
+
+#ifdef TEST
+
+#include <chrono>
+#include <random>
+
+// The scan it replaces: every order checked, filled ones erased in place.
+inline vector<LimitOrder> LimitOrderBook_test_scan(vector<LimitOrder>& orders, float low, float high) {
+    vector<LimitOrder> filled;
+    auto it = orders.begin();
+    while (it != orders.end()) {
+        bool fills = it->type == OrderType::BUY_LIMIT ? low <= it->price : high >= it->price;
+        if (fills) {
+            filled.push_back(*it);
+            it = orders.erase(it);
+        } else ++it;
+    }
+    return filled;
+}
+
+TEST(test_LimitOrderBook_fills_crossed_orders_in_placement_order) {
+    LimitOrderBook book;
+    book.add(LimitOrder(OrderType::SELL_LIMIT, 110, 1));
+    book.add(LimitOrder(OrderType::BUY_LIMIT, 90, 100));
+    book.add(LimitOrder(OrderType::BUY_LIMIT, 95, 200));
+    book.add(LimitOrder(OrderType::SELL_LIMIT, 105, 2));
+    book.add(LimitOrder(OrderType::BUY_LIMIT, 95, 300));
+
+    const vector<LimitOrder>& filled = book.fill(94, 106);
+    assert(filled.size() == 3 && book.size() == 2 && "Only the crossed orders should fill");
+    assert(filled[0].amount == 200 && filled[1].amount == 2 && filled[2].amount == 300 && "Fills should keep placement order");
+    const vector<LimitOrder>& rest = book.orders();
+    assert(rest.size() == 2 && rest[0].price == 110 && rest[1].price == 90 && "Resting orders should keep placement order");
+    assert(book.fill(91, 109).empty() && "Nothing else is crossed");
+}
+
+// A grid of resting orders around 100 and a random walk of candles.
+inline void LimitOrderBook_test_grid(vector<LimitOrder>& orders, LimitOrderBook& book, vector<pair<float, float>>& candles) {
+    mt19937 random(42);
+    uniform_real_distribution<float> offset(-50, 50);
+    for (int i = 0; i < 5000; i++) {
+        LimitOrder order(i % 2 ? OrderType::BUY_LIMIT : OrderType::SELL_LIMIT, 100 + (i % 2 ? -1 : 1) * (1 + i % 2500 * 0.02f), 1 + i);
+        orders.push_back(order);
+        book.add(order);
+    }
+    float price = 100;
+    for (int i = 0; i < 20000; i++) {
+        price = max(10.0f, price + offset(random) * 0.01f);
+        candles.push_back({ price * 0.995f, price * 1.005f });
+    }
+}
+
+TEST(test_LimitOrderBook_matches_scan_with_many_resting_orders) {
+    vector<LimitOrder> orders;
+    LimitOrderBook book;
+    vector<pair<float, float>> candles;
+    LimitOrderBook_test_grid(orders, book, candles);
+
+    double scanFilled = 0, bookFilled = 0;
+    for (auto [low, high]: candles)
+        for (const LimitOrder& order: LimitOrderBook_test_scan(orders, low, high)) scanFilled = scanFilled * 0.5 + order.amount * order.price;
+    for (auto [low, high]: candles)
+        for (const LimitOrder& order: book.fill(low, high)) bookFilled = bookFilled * 0.5 + order.amount * order.price;
+    assert(scanFilled == bookFilled && orders.size() == book.size() && "Fills should be identical to the scan, in the same order");
+}
+
+#ifdef BENCHMARK
+
+TEST(test_LimitOrderBook_benchmark_against_scan) {
+    vector<LimitOrder> orders;
+    LimitOrderBook book;
+    vector<pair<float, float>> candles;
+    LimitOrderBook_test_grid(orders, book, candles);
+
+    double filled = 0;
+    auto start = chrono::steady_clock::now();
+    for (auto [low, high]: candles)
+        for (const LimitOrder& order: LimitOrderBook_test_scan(orders, low, high)) filled += order.amount;
+    double scanSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for (auto [low, high]: candles)
+        for (const LimitOrder& order: book.fill(low, high)) filled -= order.amount;
+    double bookSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    assert(filled == 0);
+    cout << "  LimitOrderBook: " << candles.size() / bookSec / 1e6 << "M candles/s, scan: "
+         << candles.size() / scanSec / 1e6 << "M candles/s (" << book.size() << " resting)" << endl;
+}
+
+#endif // BENCHMARK
+
+#endif
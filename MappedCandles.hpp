@@ -0,0 +1,152 @@
+#pragma once
+
+#include <span>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../misc/ERROR.hpp"
+#include "Candle.hpp"
+
+using namespace std;
+
+// Read-only view over a memory-mapped candle file (or over candles decoded
+// from a compressed one). Copies and slices share the same storage, so a
+// range query only touches the pages it actually reads and never copies.
+class MappedCandles {
+public:
+    MappedCandles() {}
+
+    // Maps the file, skipping `offset` bytes of header (if any) and showing
+    // at most `limit` candles. A missing or empty file gives an empty view.
+    MappedCandles(const string& file, size_t offset = 0, size_t limit = SIZE_MAX):
+        mapping(make_shared<Mapping>(file, offset, limit)),
+        view(mapping->candles())
+    {}
+
+    // Takes ownership of already decoded candles.
+    MappedCandles(vector<Candle>&& candles):
+        owned(make_shared<const vector<Candle>>(move(candles))),
+        view(*owned)
+    {}
+
+    virtual ~MappedCandles() {}
+
+    span<const Candle> candles() const { return view; }
+    operator span<const Candle>() const { return view; }
+
+    size_t size() const { return view.size(); }
+    bool empty() const { return view.empty(); }
+    const Candle* begin() const { return view.data(); }
+    const Candle* end() const { return view.data() + view.size(); }
+    const Candle& operator[](size_t i) const { return view[i]; }
+    const Candle& front() const { return view.front(); }
+    const Candle& back() const { return view.back(); }
+
+    // Explicit copy for callers that need to own (or modify) the candles
+    vector<Candle> toVector() const {
+        return vector<Candle>(view.begin(), view.end());
+    }
+
+    // Narrows the view to the records [first, last) of the current view.
+    MappedCandles window(size_t first, size_t last) const {
+        MappedCandles result = *this;
+        last = min(last, view.size());
+        result.view = view.subspan(min(first, last), last - min(first, last));
+        return result;
+    }
+
+    // Narrows the view to candles within [period_start, period_end] (inclusive)
+    // and hints the kernel to read ahead that window only.
+    MappedCandles slice(time_sec period_start, time_sec period_end) const {
+        MappedCandles result = *this;
+        result.view = range(view, period_start, period_end);
+        if (mapping) mapping->willneed(result.view);
+        return result;
+    }
+
+    // Binary search for the contiguous [period_start, period_end] window.
+    static span<const Candle> range(
+        span<const Candle> candles,
+        time_sec period_start, time_sec period_end
+    ) {
+        auto first = lower_bound(candles.begin(), candles.end(), period_start,
+            [](const Candle& candle, time_sec time) {
+                return candle.getTime() < time;
+            });
+        auto last = upper_bound(first, candles.end(), period_end,
+            [](time_sec time, const Candle& candle) {
+                return time < candle.getTime();
+            });
+        return candles.subspan(first - candles.begin(), last - first);
+    }
+
+private:
+
+    class Mapping {
+    public:
+        Mapping(const string& file, size_t offset, size_t limit) {
+            int fd = ::open(file.c_str(), O_RDONLY);
+            if (fd < 0) return; // nothing to map
+            struct stat st;
+            if (::fstat(fd, &st) < 0) {
+                ::close(fd);
+                throw ERROR("Unable to stat: " + file);
+            }
+            length = st.st_size;
+            if (length <= offset) {
+                ::close(fd);
+                length = 0;
+                return;
+            }
+            if (limit == SIZE_MAX && (length - offset) % sizeof(Candle)) {
+                ::close(fd);
+                throw ERROR("Corrupted candle file (size mismatch): " + file);
+            }
+            address = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd); // mapping stays valid after close
+            if (address == MAP_FAILED) {
+                address = nullptr;
+                throw ERROR("Unable to mmap: " + file);
+            }
+            first = reinterpret_cast<const Candle*>(
+                static_cast<const char*>(address) + offset);
+            count = min((length - offset) / sizeof(Candle), limit);
+        }
+
+        Mapping(const Mapping&) = delete;
+        Mapping& operator=(const Mapping&) = delete;
+
+        ~Mapping() {
+            if (address) ::munmap(address, length);
+        }
+
+        span<const Candle> candles() const { return { first, count }; }
+
+        void willneed(span<const Candle> window) const {
+            if (!address || window.empty()) return;
+            const size_t page = ::sysconf(_SC_PAGESIZE);
+            uintptr_t from = reinterpret_cast<uintptr_t>(window.data());
+            uintptr_t to = from + window.size_bytes();
+            from -= from % page;
+            ::madvise(reinterpret_cast<void*>(from), to - from, MADV_WILLNEED);
+        }
+
+    private:
+        void* address = nullptr;
+        size_t length = 0;
+        const Candle* first = nullptr;
+        size_t count = 0;
+    };
+
+    shared_ptr<const Mapping> mapping;
+    shared_ptr<const vector<Candle>> owned;
+    span<const Candle> view;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "BacktestArguments.hpp"
+#include "BacktestPool.hpp"
 
 #include "../opt/Optimizer.hpp"
 
@@ -31,6 +32,22 @@ public:
     string getOptimizerIni() const { return optimizerIni; }
     Optimizer* getOptimizer() const { return SAFE(optimizer); }
 
+    // Parallel candidate evaluation: every worker loads its own strategy and
+    // exchange from the plugins (owned by the loader), all of them share the
+    // loaded candles.
+    template<typename Params = vector<double>, typename Result = double>
+    unique_ptr<BacktestPool<Params, Result>> createBacktestPool(
+        typename BacktestPool<Params, Result>::Evaluate evaluate,
+        size_t workers = thread::hardware_concurrency()
+    ) {
+        return make_unique<BacktestPool<Params, Result>>(
+            loadCandles(),
+            [this]() { return shared_ptr<Strategy>(loadStrategy(), [](Strategy*) {}); },
+            [this]() { return shared_ptr<TestExchange>(loadExchange(), [](TestExchange*) {}); },
+            evaluate, workers
+        );
+    }
+
 private:
 
     string optimizerLib;
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+enum class OrderStatus: uint8_t {
+    OK,
+    INVALID_PRICE,
+    INVALID_AMOUNT,
+    INSUFFICIENT_BALANCE,
+    INSUFFICIENT_ASSET
+};
+
+enum class OrderSide: uint8_t {
+    BUY,
+    SELL,
+    BUY_LIMIT,
+    SELL_LIMIT
+};
+
+// Outcome of an order: a status code and the numbers behind it. Nothing
+// is formatted until message() is asked for, so placing or rejecting an
+// order does not allocate. Converts to bool (true: accepted).
+struct OrderResult {
+    OrderStatus status = OrderStatus::OK;
+    OrderSide side = OrderSide::BUY;
+    float amount = 0;     // quoted for buys, asset amount for sells
+    float limit = 0;      // limit price of limit orders
+    float value = 0;      // the rejected value (price or amount)
+    float available = 0;  // balance or asset that was not enough
+
+    static OrderResult ok() { return OrderResult(); }
+
+    static OrderResult fail(OrderStatus status, float value, float available = 0) {
+        OrderResult result;
+        result.status = status;
+        result.value = value;
+        result.available = available;
+        return result;
+    }
+
+    operator bool() const { return status == OrderStatus::OK; }
+
+    const char* reason() const {
+        switch (status) {
+            case OrderStatus::OK: return "OK";
+            case OrderStatus::INVALID_PRICE: return "Negative price";
+            case OrderStatus::INVALID_AMOUNT: return "Negative amount";
+            case OrderStatus::INSUFFICIENT_BALANCE: return "Insufficient balance";
+            case OrderStatus::INSUFFICIENT_ASSET: return "Insufficient amount";
+        }
+        return "Unknown";
+    }
+
+    // e.g. "BUY quoted: 500.000000 (failed): Insufficient balance: 500.000000 > 100.000000"
+    string message() const {
+        const bool buy = side == OrderSide::BUY || side == OrderSide::BUY_LIMIT;
+        string msg = string(buy ? "BUY quoted: " : "SELL amount: ") + to_string(amount);
+        if (side == OrderSide::BUY_LIMIT || side == OrderSide::SELL_LIMIT) msg += ", LIMIT: " + to_string(limit);
+        if (status == OrderStatus::OK) return msg;
+        msg += " (failed): " + string(reason()) + ": " + to_string(value);
+        if (status == OrderStatus::INSUFFICIENT_BALANCE || status == OrderStatus::INSUFFICIENT_ASSET)
+            msg += " > " + to_string(available);
+        return msg;
+    }
+};
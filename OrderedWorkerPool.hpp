@@ -0,0 +1,152 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <optional>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+using namespace std;
+
+// Bounded worker pool that produces results concurrently and hands them
+// to the consumer (on the calling thread) strictly in index order.
+// At most `window` results are in flight or waiting, so memory stays
+// bounded even when the consumer is slower than the producers.
+template<typename T>
+class OrderedWorkerPool {
+public:
+    typedef function<T(size_t index, size_t worker)> Producer;
+    typedef function<void(size_t index, T& result)> Consumer;
+
+    OrderedWorkerPool(size_t workers, size_t window = 0):
+        workers(workers ? workers : 1),
+        window(window ? window : 2 * (workers ? workers : 1))
+    {}
+
+    virtual ~OrderedWorkerPool() {}
+
+    size_t getWorkers() const { return workers; }
+    size_t getWindow() const { return window; }
+
+    // Runs produce(i, worker) for i in [0, count) and consume(i, result)
+    // in ascending i. The first exception stops the pool and is rethrown.
+    void run(size_t count, Producer produce, Consumer consume) {
+        vector<optional<T>> slots(window);
+        mutex mtx;
+        condition_variable cv;
+        size_t next = 0;
+        size_t consumed = 0;
+        bool failed = false;
+        exception_ptr error;
+
+        auto fail = [&]() {
+            lock_guard<mutex> lock(mtx);
+            if (!error) error = current_exception();
+            failed = true;
+            cv.notify_all();
+        };
+
+        vector<thread> threads;
+        for (size_t worker = 0; worker < min(workers, count); worker++)
+            threads.emplace_back([&, worker]() {
+                while (true) {
+                    size_t i;
+                    {
+                        unique_lock<mutex> lock(mtx);
+                        cv.wait(lock, [&]() {
+                            return failed || next >= count || next < consumed + window;
+                        });
+                        if (failed || next >= count) return;
+                        i = next++;
+                    }
+                    try {
+                        T result = produce(i, worker);
+                        lock_guard<mutex> lock(mtx);
+                        slots[i % window] = move(result);
+                        cv.notify_all();
+                    } catch (...) {
+                        fail();
+                        return;
+                    }
+                }
+            });
+
+        try {
+            for (size_t i = 0; i < count; i++) {
+                optional<T> result;
+                {
+                    unique_lock<mutex> lock(mtx);
+                    cv.wait(lock, [&]() { return failed || slots[i % window].has_value(); });
+                    if (failed) break;
+                    result = move(slots[i % window]);
+                    slots[i % window].reset();
+                    consumed = i + 1;
+                    cv.notify_all();
+                }
+                consume(i, *result);
+            }
+        } catch (...) {
+            fail();
+        }
+
+        for (thread& t: threads) t.join();
+        if (error) rethrow_exception(error);
+    }
+
+private:
+    size_t workers;
+    size_t window;
+};
+
+
+#ifdef TEST
+
+#include <atomic>
+#include <chrono>
+#include "../misc/ERROR.hpp"
+#include "../misc/str_contains.hpp"
+
+TEST(test_OrderedWorkerPool_consumes_in_index_order) {
+    OrderedWorkerPool<size_t> pool(4);
+    vector<size_t> results;
+    pool.run(50, [](size_t i, size_t) {
+        this_thread::sleep_for(chrono::microseconds((i * 7919) % 500)); // uneven runtimes
+        return i * i;
+    }, [&results](size_t, size_t& result) {
+        results.push_back(result);
+    });
+    assert(results.size() == 50 && "Every result should be consumed");
+    for (size_t i = 0; i < results.size(); i++)
+        assert(results[i] == i * i && "Results should arrive in index order");
+}
+
+TEST(test_OrderedWorkerPool_bounds_results_in_flight) {
+    OrderedWorkerPool<int> pool(4, 3);
+    atomic<int> produced(0);
+    int maxAhead = 0;
+    pool.run(30, [&produced](size_t, size_t) {
+        return ++produced;
+    }, [&](size_t i, int&) {
+        this_thread::sleep_for(chrono::microseconds(200)); // slow consumer
+        maxAhead = max(maxAhead, produced.load() - (int)(i + 1)); // produced beyond the consumed one
+    });
+    assert(maxAhead <= 3 && "Producers should not run further ahead than the window");
+}
+
+TEST(test_OrderedWorkerPool_rethrows_producer_error) {
+    OrderedWorkerPool<int> pool(3);
+    bool thrown = false;
+    try {
+        pool.run(20, [](size_t i, size_t) -> int {
+            if (i == 7) throw ERROR("broken day");
+            return (int)i;
+        }, [](size_t, int&) {});
+    } catch (exception& e) {
+        thrown = str_contains(e.what(), "broken day");
+    }
+    assert(thrown && "Producer error should reach the caller");
+}
+
+#endif
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+// Online backtest statistics in O(1) memory: fed with the equity once per
+// candle and with every fill, no equity curve is stored. Returns are per
+// candle (simple returns, no risk-free rate); Sharpe and Sortino are
+// scaled by sqrt(periods) when the candles per year are given.
+// Trades are closed by sells against the average cost of the position; a
+// trade wins when it sells above that cost (fees included).
+class PerformanceMetrics {
+public:
+    PerformanceMetrics() {}
+    virtual ~PerformanceMetrics() {}
+
+    // Equity (TestExchange::getEquity(), pending orders included) at a
+    // candle close, and whether any asset is held.
+    void onEquity(double equity, bool exposed) {
+        candles++;
+        if (exposed) exposedCandles++;
+        if (candles == 1) {
+            first = last = peak = equity;
+            return;
+        }
+        if (last > 0) { // Welford's running mean and variance
+            const double r = equity / last - 1;
+            returns++;
+            const double delta = r - mean;
+            mean += delta / returns;
+            m2 += delta * (r - mean);
+            if (r < 0) downside += r * r;
+        }
+        last = equity;
+        if (equity > peak) peak = equity;
+        else if (peak > 0) maxDrawdown = max(maxDrawdown, (peak - equity) / peak);
+    }
+
+    // An open position: asset amount and what it cost.
+    struct Position {
+        double amount = 0;
+        double cost = 0;
+    };
+
+    // A fill: quoted amount paid (buy) or received (sell) and the asset
+    // amount received or given, fees included.
+    void onFill(bool buy, double quoted, double amount) {
+        onFill(position, buy, quoted, amount);
+    }
+
+    // A fill of one of many positions (e.g. one per symbol) the caller keeps.
+    void onFill(Position& position, bool buy, double quoted, double amount) {
+        fills++;
+        if (buy) {
+            position.amount += amount;
+            position.cost += quoted;
+            return;
+        }
+        if (position.amount <= 0 || amount <= 0) return;
+        const double sold = min(amount, position.amount);
+        const double basis = position.cost * (sold / position.amount);
+        position.cost -= basis;
+        position.amount -= sold;
+        trades++;
+        if (quoted * (sold / amount) > basis) wins++;
+    }
+
+    void reset() { *this = PerformanceMetrics(); }
+
+    uint64_t getCandles() const { return candles; }
+    uint64_t getFills() const { return fills; }
+    uint64_t getTrades() const { return trades; }
+    uint64_t getWins() const { return wins; }
+
+    double getReturn() const { return first > 0 ? last / first - 1 : 0; }
+    double getMeanReturn() const { return mean; }
+    double getVolatility() const { return returns > 1 ? sqrt(m2 / (returns - 1)) : 0; }
+    double getMaxDrawdown() const { return maxDrawdown; } // fraction of the peak
+    double getWinRate() const { return trades ? (double)wins / trades : 0; }
+    double getExposure() const { return candles ? (double)exposedCandles / candles : 0; }
+
+    double getSharpe(double periods = 1) const {
+        const double volatility = getVolatility();
+        return volatility > 0 ? mean / volatility * sqrt(periods) : 0;
+    }
+
+    double getSortino(double periods = 1) const {
+        const double deviation = returns ? sqrt(downside / returns) : 0;
+        return deviation > 0 ? mean / deviation * sqrt(periods) : 0;
+    }
+
+private:
+    uint64_t candles = 0;
+    uint64_t exposedCandles = 0;
+    uint64_t returns = 0;
+    double first = 0;
+    double last = 0;
+    double peak = 0;
+    double maxDrawdown = 0;
+    double mean = 0;
+    double m2 = 0;
+    double downside = 0;
+
+    uint64_t fills = 0;
+    uint64_t trades = 0;
+    uint64_t wins = 0;
+    Position position;
+};
+
+
+#ifdef TEST
+
+TEST(test_PerformanceMetrics_equity_statistics) {
+    PerformanceMetrics metrics;
+    const double equity[] = { 100, 110, 99, 99, 121, 110 };
+    for (int i = 0; i < 6; i++) metrics.onEquity(equity[i], i >= 2);
+
+    // returns: .1, -.1, 0, .2222.., -.0909..
+    const double r[] = { 0.1, -0.1, 0, 22.0 / 99, -11.0 / 121 };
+    double mean = 0, var = 0, down = 0;
+    for (double x: r) mean += x / 5;
+    for (double x: r) var += (x - mean) * (x - mean) / 4;
+    for (double x: r) down += x < 0 ? x * x / 5 : 0;
+    assert(abs(metrics.getMeanReturn() - mean) < 1e-12 && abs(metrics.getVolatility() - sqrt(var)) < 1e-12 && "Running mean and volatility");
+    assert(abs(metrics.getSharpe(4) - mean / sqrt(var) * 2) < 1e-12 && "Sharpe should be scaled by sqrt(periods)");
+    assert(abs(metrics.getSortino() - mean / sqrt(down)) < 1e-12 && "Sortino should use the downside deviation");
+    assert(abs(metrics.getMaxDrawdown() - 0.1) < 1e-12 && abs(metrics.getReturn() - 0.1) < 1e-12 && "Drawdown from the peak and the total return");
+    assert(metrics.getCandles() == 6 && abs(metrics.getExposure() - 4.0 / 6) < 1e-12 && "Exposure is the share of candles holding asset");
+}
+
+TEST(test_PerformanceMetrics_trades_against_average_cost) {
+    PerformanceMetrics metrics;
+    metrics.onFill(true, 100, 1);   // 1 @ 100
+    metrics.onFill(true, 300, 2);   // 3 @ 133.33
+    metrics.onFill(false, 150, 1);  // win
+    metrics.onFill(false, 250, 2);  // loss: 250 < 266.67
+    metrics.onFill(false, 100, 1);  // nothing held, not a trade
+    assert(metrics.getFills() == 5 && metrics.getTrades() == 2 && metrics.getWins() == 1 && "Sells should close trades");
+    assert(metrics.getWinRate() == 0.5 && "Win rate");
+    metrics.reset();
+    assert(metrics.getFills() == 0 && metrics.getWinRate() == 0 && metrics.getSharpe() == 0 && "Reset should clear everything");
+}
+
+#endif
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../misc/ERROR.hpp"
+#include "../misc/Logger.hpp"
+#include "Candle.hpp"
+#include "LimitOrder.hpp"
+#include "LimitOrderBook.hpp"
+#include "FixedLedger.hpp"
+#include "SpotAccount.hpp"
+#include "OrderResult.hpp"
+#include "PerformanceMetrics.hpp"
+#include "IntraCandleResolver.hpp"
+
+using namespace std;
+
+// Simulated multi-asset account: one quote balance and a position, a price
+// and a limit order book per symbol (symbols are addressed by index, in
+// the order given). Every symbol trades through a SpotAccount over the
+// shared balance, so orders, fees, the fixed-point ledger, intra-candle
+// resolution and the fills reported to the metrics follow the same rules
+// as TestExchange. The per-symbol prices and positions are kept in flat
+// arrays so the per-candle loop of many symbols stays in cache.
+class PortfolioExchange {
+public:
+    PortfolioExchange(
+        const vector<string>& symbols,
+        bool logsOnError,
+        bool showsOnError,
+        bool throwsOnError
+    ):
+        symbols(symbols),
+        assets(symbols.size(), 0),
+        assetUnits(symbols.size(), 0),
+        prices(symbols.size(), 0),
+        books(symbols.size()),
+        positions(symbols.size()),
+        resolvers(symbols.size()),
+        logsOnError(logsOnError),
+        showsOnError(showsOnError),
+        throwsOnError(throwsOnError)
+    {}
+
+    virtual ~PortfolioExchange() {}
+
+    size_t getSymbolCount() const { return symbols.size(); }
+    const string& getSymbol(size_t symbol) const { return symbols[symbol]; }
+
+    // Index of a symbol, getSymbolCount() if unknown.
+    size_t find(const string& symbol) const {
+        return std::find(symbols.begin(), symbols.end(), symbol) - symbols.begin();
+    }
+
+    float getBalance() const { return ledger.isEnabled() ? ledger.quotedValue(balanceUnits) : balance; }
+    float getAsset(size_t symbol) const { return ledger.isEnabled() ? ledger.quantityValue(assetUnits[symbol]) : assets[symbol]; }
+    float getPrice(size_t symbol) const { return prices[symbol]; }
+
+    // Quoted value of the positions (at their last prices).
+    float getBalanceUsed() const {
+        float used = 0;
+        for (size_t i = 0; i < assets.size(); i++) used += getAsset(i) * prices[i];
+        return used;
+    }
+
+    float getBalanceTotal() const { return getBalance() + getBalanceUsed(); }
+
+    // Account value at the last prices, the cash and assets reserved by
+    // pending limit orders included.
+    float getEquity() {
+        float equity = getBalance();
+        for (size_t i = 0; i < symbols.size(); i++) equity += account(i).getReservedAndAssetValue(prices[i]);
+        return equity;
+    }
+
+    // Whether any asset is held, in the account or in pending sells.
+    bool isExposed() {
+        for (size_t i = 0; i < symbols.size(); i++) if (account(i).isExposed()) return true;
+        return false;
+    }
+
+    [[nodiscard]] OrderResult buy(size_t symbol, float quoted) {
+        return placed(symbol, account(symbol).buy(quoted, prices[symbol]), OrderSide::BUY, quoted);
+    }
+
+    [[nodiscard]] OrderResult sell(size_t symbol, float amount) {
+        return placed(symbol, account(symbol).sell(amount, prices[symbol]), OrderSide::SELL, amount);
+    }
+
+    [[nodiscard]] OrderResult buyLimit(size_t symbol, float quoted, float limitPrice) {
+        return placed(symbol, account(symbol).buyLimit(quoted, limitPrice), OrderSide::BUY_LIMIT, quoted, limitPrice);
+    }
+
+    [[nodiscard]] OrderResult sellLimit(size_t symbol, float amount, float limitPrice) {
+        return placed(symbol, account(symbol).sellLimit(amount, limitPrice), OrderSide::SELL_LIMIT, amount, limitPrice);
+    }
+
+    // The whole balance (position) of a symbol, see Exchange::buyAll().
+    [[nodiscard]] OrderResult buyAll(size_t symbol) {
+        const float quoted = getBalance();
+        return placed(symbol, account(symbol).buyAll(prices[symbol]), OrderSide::BUY, quoted);
+    }
+
+    [[nodiscard]] OrderResult sellAll(size_t symbol) {
+        const float amount = getAsset(symbol);
+        return placed(symbol, account(symbol).sellAll(prices[symbol]), OrderSide::SELL, amount);
+    }
+
+    [[nodiscard]] OrderResult buyLimitAll(size_t symbol, float limitPrice) {
+        const float quoted = getBalance();
+        return placed(symbol, account(symbol).buyLimitAll(limitPrice), OrderSide::BUY_LIMIT, quoted, limitPrice);
+    }
+
+    [[nodiscard]] OrderResult sellLimitAll(size_t symbol, float limitPrice) {
+        const float amount = getAsset(symbol);
+        return placed(symbol, account(symbol).sellLimitAll(limitPrice), OrderSide::SELL_LIMIT, amount, limitPrice);
+    }
+
+    size_t getPendingOrderCount() const { return pending; }
+    size_t getPendingOrderCount(size_t symbol) const { return books[symbol].size(); }
+
+    // Cancel the pending orders of a symbol (return reserved funds/assets)
+    void cancelAllOrders(size_t symbol) {
+        pending -= books[symbol].size();
+        account(symbol).cancelAll();
+    }
+
+    void cancelAllOrders() {
+        for (size_t i = 0; i < books.size(); i++) cancelAllOrders(i);
+    }
+
+    // Switches the account to the fixed-point ledger (see TestExchange::setFixedPoint()).
+    void setFixedPoint(const FixedLedger::Scales& scales) {
+        if (pending) throw ERROR("Fixed-point ledger can not be set with pending orders");
+        const FixedLedger fixed(scales);
+        const int64_t balance = fixed.quotedUnits(getBalance());
+        vector<int64_t> units(symbols.size());
+        for (size_t i = 0; i < symbols.size(); i++) units[i] = fixed.quantityUnits(getAsset(i));
+        ledger = fixed;
+        balanceUnits = balance;
+        assetUnits.swap(units);
+        fees.convert(ledger);
+    }
+
+    bool isFixedPoint() const { return ledger.isEnabled(); }
+    const FixedLedger& getLedger() const { return ledger; }
+
+    // Fills of every symbol are reported to the metrics (not owned,
+    // nullptr: none), trades closed against the position of their symbol.
+    void setMetrics(PerformanceMetrics* metrics) {
+        this->metrics = metrics;
+        positions.assign(symbols.size(), PerformanceMetrics::Position());
+    }
+
+    PerformanceMetrics* getMetrics() const { return metrics; }
+
+    // Finer history of a symbol for its ambiguous candles (nullptr: off).
+    void setIntraCandleResolver(size_t symbol, shared_ptr<IntraCandleResolver> resolver) { resolvers[symbol] = resolver; }
+
+
+    // ============ Internal use only, DO NOT call in strategy! ============
+
+    void setTime(time_sec time) { this->time = time; }
+    void setPrice(size_t symbol, float price) { prices[symbol] = price; }
+    void setBalance(float balance) {
+        if (ledger.isEnabled()) balanceUnits = ledger.quotedUnits(balance);
+        else this->balance = balance;
+    }
+    void setAsset(size_t symbol, float asset) {
+        if (ledger.isEnabled()) assetUnits[symbol] = ledger.quantityUnits(asset);
+        else assets[symbol] = asset;
+    }
+    time_sec getTime() const { return time; }
+
+    void setFeeMakerBuyPc(float feeMakerBuyPc) { fees.makerBuyPc = feeMakerBuyPc; fees.convert(ledger); }
+    void setFeeMakerSellPc(float feeMakerSellPc) { fees.makerSellPc = feeMakerSellPc; fees.convert(ledger); }
+    void setFeeTakerBuyPc(float feeTakerBuyPc) { fees.takerBuyPc = feeTakerBuyPc; fees.convert(ledger); }
+    void setFeeTakerSellPc(float feeTakerSellPc) { fees.takerSellPc = feeTakerSellPc; fees.convert(ledger); }
+
+    // Fills the orders of the symbol the candle crosses, in placement order.
+    void processLimitOrders(size_t symbol, const Candle& candle) {
+        if (books[symbol].empty()) return;
+        pending -= account(symbol).process(candle, resolvers[symbol].get());
+    }
+
+protected:
+
+    // The order rules of a symbol over the shared balance.
+    SpotAccount account(size_t symbol) {
+        return SpotAccount(balance, balanceUnits, assets[symbol], assetUnits[symbol], books[symbol], ledger, fees,
+            metrics, &positions[symbol]);
+    }
+
+    // Same reporting as Exchange::error(), the message names the symbol.
+    OrderResult placed(size_t symbol, OrderResult result, OrderSide side, float amount, float limit = 0) {
+        result.side = side;
+        result.amount = amount;
+        result.limit = limit;
+        if (result) {
+            if (side == OrderSide::BUY_LIMIT || side == OrderSide::SELL_LIMIT) pending++;
+            return result;
+        }
+        if (!(logsOnError || showsOnError || throwsOnError)) return result;
+        string errmsg = "Exchange error: " + symbols[symbol] + " " + result.message();
+        if (logsOnError)
+            LOG_ERROR(errmsg);
+        if (showsOnError)
+            cerr << ERROR(errmsg).what() << endl;
+        if (throwsOnError)
+            throw ERROR(errmsg);
+        return result;
+    }
+
+    vector<string> symbols;
+    vector<float> assets;
+    vector<int64_t> assetUnits;
+    vector<float> prices;
+    vector<LimitOrderBook> books;
+    vector<PerformanceMetrics::Position> positions;
+    vector<shared_ptr<IntraCandleResolver>> resolvers;
+    size_t pending = 0;
+
+    time_sec time = 0;
+    float balance = 0;
+    int64_t balanceUnits = 0;
+    FixedLedger ledger; // disabled unless setFixedPoint()
+    SpotAccount::Fees fees; // converted for the ledger
+    PerformanceMetrics* metrics = nullptr;
+
+    bool logsOnError = true;
+    bool showsOnError = true;
+    bool throwsOnError = true;
+};
+
+
+#ifdef TEST
+
+#include "TestExchange.hpp"
+
+TEST(test_PortfolioExchange_keeps_positions_per_symbol) {
+    PortfolioExchange exchange({ "BTCUSDT", "ETHUSDT", "SOLUSDT" }, false, false, false);
+    exchange.setBalance(1000);
+    exchange.setPrice(0, 50000);
+    exchange.setPrice(1, 2000);
+    exchange.setFeeTakerBuyPc(0.01);
+    assert(exchange.find("ETHUSDT") == 1 && exchange.find("XRPUSDT") == 3 && "Symbols should be found by name");
+
+    assert(exchange.buy(0, 500) && exchange.buy(1, 200));
+    assert(abs(exchange.getBalance() - 300) < 0.001f && "One quote balance pays for every symbol");
+    assert(abs(exchange.getAsset(0) - 0.0099f) < 1e-6f && abs(exchange.getAsset(1) - 0.099f) < 1e-6f && exchange.getAsset(2) == 0 &&
+           "Each symbol should have its own position");
+    OrderResult noPrice = exchange.buy(2, 100);
+    assert(noPrice.status == OrderStatus::INVALID_PRICE && "A symbol without a price yet can not be traded");
+    assert(exchange.sell(1, 1).status == OrderStatus::INSUFFICIENT_ASSET && "Positions should not be shared");
+
+    exchange.setPrice(1, 3000);
+    assert(abs(exchange.getBalanceTotal() - (300 + 0.0099f * 50000 + 0.099f * 3000)) < 0.01f && "Total should value every position");
+
+    assert(exchange.sellLimit(1, 0.099f, 3100) && exchange.buyLimit(0, 300, 45000));
+    assert(exchange.getPendingOrderCount() == 2 && exchange.getPendingOrderCount(1) == 1 && "Orders should be kept per symbol");
+    exchange.processLimitOrders(0, Candle(0, 50000, 51000, 49000, 50000, 1));
+    exchange.processLimitOrders(1, Candle(0, 3000, 3200, 2950, 3100, 1));
+    assert(exchange.getPendingOrderCount() == 1 && abs(exchange.getAsset(1)) < 1e-6f && abs(exchange.getBalance() - 306.9f) < 0.01f &&
+           "A candle should only fill the orders of its symbol");
+    exchange.cancelAllOrders();
+    assert(exchange.getPendingOrderCount() == 0 && abs(exchange.getBalance() - 606.9f) < 0.01f && "Cancel should return the reservations");
+}
+
+TEST(test_PortfolioExchange_follows_the_single_asset_rules) {
+    PortfolioExchange portfolio({ "BTCUSDT", "ETHUSDT" }, false, false, false);
+    TestExchangeMock single(false, false, false);
+    PerformanceMetrics portfolioMetrics, singleMetrics;
+    portfolio.setMetrics(&portfolioMetrics);
+    single.setMetrics(&singleMetrics);
+    for (bool fixed: { false, true }) {
+        portfolio.setBalance(1000);
+        single.setBalance(1000);
+        if (fixed) {
+            portfolio.setFixedPoint(FixedLedger::Scales());
+            single.setFixedPoint(FixedLedger::Scales());
+        }
+        portfolio.setFeeTakerBuyPc(0.001);
+        portfolio.setFeeMakerSellPc(0.002);
+        single.setFeeTakerBuyPc(0.001);
+        single.setFeeMakerSellPc(0.002);
+        portfolio.setPrice(1, 2000);
+        single.setPrice(2000);
+        assert(portfolio.buy(1, 500) && single.buy(500));
+        assert(portfolio.sellLimit(1, portfolio.getAsset(1) / 2, 2100) && single.sellLimit(single.getAsset() / 2, 2100));
+        assert(portfolio.getEquity() == single.getEquity() && "Reserved assets should count in the equity");
+        Candle candle(60, 2000, 2200, 1990, 2150, 1);
+        portfolio.processLimitOrders(1, candle);
+        single.processLimitOrders(candle);
+        portfolio.setPrice(1, 1800);
+        single.setPrice(1800);
+        assert(portfolio.sellAll(1) && single.sellAll());
+        assert(portfolio.getBalance() == single.getBalance() && portfolio.getAsset(1) == single.getAsset() && portfolio.getAsset(0) == 0 &&
+               "A symbol should trade like a single-asset exchange");
+        assert(portfolio.isFixedPoint() == fixed && portfolio.getPendingOrderCount() == 0);
+    }
+    assert(portfolioMetrics.getFills() == 6 && portfolioMetrics.getTrades() == 4 && portfolioMetrics.getWins() == 2 &&
+           portfolioMetrics.getTrades() == singleMetrics.getTrades() && portfolioMetrics.getWins() == singleMetrics.getWins() &&
+           "Fills should reach the metrics");
+}
+
+#endif
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <span>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+#include "../misc/ERROR.hpp"
+#include "Candle.hpp"
+#include "CandleMerger.hpp"
+#include "PortfolioExchange.hpp"
+#include "PortfolioStrategy.hpp"
+#include "PerformanceMetrics.hpp"
+
+using namespace std;
+
+// Drives a portfolio strategy over a universe of symbols in one process.
+// The candle streams (one per exchange symbol, in the same order) are
+// merged by time; for every timestamp:
+//   exchange.setTime, then for each candle of it: exchange.setPrice(symbol,
+//   close), exchange.processLimitOrders(symbol, candle);
+//   strategy.onCandlesClose(time, candles), metrics.onEquity
+// Symbols without a candle at the timestamp keep their last price.
+class PortfolioRunner {
+public:
+    struct Stats {
+        uint64_t timestamps = 0;
+        uint64_t candles = 0;
+        uint64_t nanoseconds = 0;
+
+        double nanosPerCandle() const { return candles ? (double)nanoseconds / candles : 0; }
+    };
+
+    PortfolioRunner(PortfolioStrategy& strategy, PortfolioExchange& exchange):
+        strategy(strategy), exchange(exchange)
+    {
+        strategy.setExchange(&exchange);
+    }
+
+    virtual ~PortfolioRunner() {}
+
+    // Equity of every timestamp and the fills of every symbol (not owned,
+    // nullptr: none).
+    void setMetrics(PerformanceMetrics* metrics) {
+        this->metrics = metrics;
+        exchange.setMetrics(metrics);
+    }
+
+    // Returns the number of timestamps passed to onCandlesClose.
+    size_t run(const vector<span<const Candle>>& streams) {
+        if (streams.size() != exchange.getSymbolCount())
+            throw ERROR("Candle streams (" + to_string(streams.size()) + ") should match the symbols (" + to_string(exchange.getSymbolCount()) + ")");
+        auto start = chrono::steady_clock::now();
+
+        CandleMerger merger(streams);
+        size_t timestamps = 0;
+        for (span<const CandleMerger::Event> candles = merger.next(); !candles.empty(); candles = merger.next()) {
+            exchange.setTime(merger.getTime());
+            for (const CandleMerger::Event& event: candles) {
+                exchange.setPrice(event.stream, event.candle->getClose());
+                exchange.processLimitOrders(event.stream, *event.candle);
+            }
+            strategy.onCandlesClose(merger.getTime(), candles);
+            if (metrics) metrics->onEquity(exchange.getEquity(), exchange.isExposed());
+            stats.candles += candles.size();
+            timestamps++;
+        }
+
+        stats.timestamps += timestamps;
+        stats.nanoseconds += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        return timestamps;
+    }
+
+    const Stats& getStats() const { return stats; }
+    void resetStats() { stats = Stats(); }
+
+protected:
+    PortfolioStrategy& strategy;
+    PortfolioExchange& exchange;
+    PerformanceMetrics* metrics = nullptr;
+    Stats stats;
+};
+
+
+#ifdef TEST
+
+// Rotates into the symbol that rose the most since its previous candle.
+class PortfolioRunnerRotationStrategy: public PortfolioStrategy {
+public:
+    vector<float> previous;
+    vector<pair<time_sec, size_t>> seen;
+    size_t held = SIZE_MAX;
+    size_t rotations = 0;
+
+    void onCandlesClose(time_sec time, span<const CandleMerger::Event> candles) override {
+        previous.resize(exchange->getSymbolCount(), 0);
+        seen.push_back({ time, candles.size() });
+        size_t best = SIZE_MAX;
+        float bestChange = 0;
+        for (const CandleMerger::Event& event: candles) {
+            float close = event.candle->getClose();
+            float change = previous[event.stream] > 0 ? close / previous[event.stream] - 1 : 0;
+            previous[event.stream] = close;
+            if (change > bestChange) {
+                best = event.stream;
+                bestChange = change;
+            }
+        }
+        if (best == SIZE_MAX || best == held) return;
+        if (held != SIZE_MAX) (void)exchange->sellAll(held);
+        (void)exchange->buyAll(best);
+        held = best;
+        rotations++;
+    }
+};
+
+TEST(test_PortfolioRunner_merges_the_universe_in_time_order) {
+    vector<vector<Candle>> data(3);
+    for (int i = 0; i < 10; i++) data[0].push_back(Candle(i * 60, 10, 11, 9, 10 + i, 1));     // rising
+    for (int i = 4; i < 10; i++) data[1].push_back(Candle(i * 60, 20, 22, 18, 20 + 5 * i, 1)); // listed later, rises faster
+    for (int i = 0; i < 10; i += 3) data[2].push_back(Candle(i * 60, 5, 6, 4, 5, 1));         // gaps
+    PortfolioExchange exchange({ "A", "B", "C" }, false, false, true);
+    exchange.setBalance(1000);
+    PortfolioRunnerRotationStrategy strategy;
+    PortfolioRunner runner(strategy, exchange);
+    PerformanceMetrics metrics;
+    runner.setMetrics(&metrics);
+
+    assert(runner.run({ data[0], data[1], data[2] }) == 10 && "Every timestamp should be passed once");
+    typedef pair<time_sec, size_t> Seen;
+    assert(strategy.seen[0] == Seen(0, 2) && strategy.seen[4] == Seen(240, 2) && strategy.seen[6] == Seen(360, 3) &&
+           "Listed and gapped symbols should be left out");
+    assert(strategy.held == 1 && strategy.rotations == 2 && exchange.getAsset(0) == 0 && "Strategy should rotate into the later listing");
+    assert(runner.getStats().candles == 10 + 6 + 4 && metrics.getCandles() == 10 && metrics.getReturn() > 0 && "Stats and metrics");
+    assert(metrics.getFills() == 3 && metrics.getTrades() == 1 && metrics.getWinRate() == 1 && "Fills should reach the metrics");
+    assert(exchange.getPrice(2) == 5 && exchange.getPrice(0) == 19 && "Prices should follow the candles of each symbol");
+}
+
+#ifdef BENCHMARK
+
+TEST(test_PortfolioRunner_benchmark_a_large_universe) {
+    const size_t symbols = 200, candles = 5000;
+    vector<vector<Candle>> data(symbols);
+    vector<string> names;
+    for (size_t s = 0; s < symbols; s++) {
+        names.push_back("S" + to_string(s));
+        for (size_t i = s % 50; i < candles; i++) { // staggered listings
+            float price = 100 + 10 * sin(i / (20.0f + s));
+            data[s].push_back(Candle(i * 60, price, price * 1.01f, price * 0.99f, price, 1));
+        }
+    }
+    vector<span<const Candle>> streams(data.begin(), data.end());
+    PortfolioExchange exchange(names, false, false, false);
+    exchange.setBalance(10000);
+    PortfolioRunnerRotationStrategy strategy;
+    PortfolioRunner runner(strategy, exchange);
+    assert(runner.run(streams) == candles && strategy.rotations > 0 && "The whole universe should run in one pass");
+    cout << "  PortfolioRunner: " << runner.getStats().nanosPerCandle() << " ns/candle over "
+         << symbols << " symbols" << endl;
+}
+
+#endif // BENCHMARK
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <span>
+
+#include "CandleMerger.hpp"
+#include "PortfolioExchange.hpp"
+
+using namespace std;
+
+// Strategy over a universe of symbols (see PortfolioRunner).
+class PortfolioStrategy {
+public:
+
+    PortfolioStrategy() {}
+    
+    virtual ~PortfolioStrategy() {}
+
+    void setExchange(PortfolioExchange* exchange) {
+        this->exchange = exchange;
+    }
+
+    // Called when the candles of a timestamp close: one candle per symbol
+    // that has one (event.stream is the symbol index), in symbol order.
+    // Symbols not listed yet, delisted or in a gap are left out.
+    virtual void onCandlesClose(time_sec time, span<const CandleMerger::Event> candles) = 0;
+
+    // Back to the state before the first candles, keeping the parameters.
+    virtual void reset() {}
+
+protected:
+    PortfolioExchange* exchange = nullptr;
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <functional>
+
+using namespace std;
+
+// Streaming parser of S3 ListObjects (v1) XML pages. Chunks are consumed as
+// they arrive; only an unfinished element is kept between chunks, so a
+// page is never collected into one string.
+class S3ListingParser {
+public:
+    typedef function<void(const string& key)> KeyCallback;
+
+    S3ListingParser(KeyCallback onKey): onKey(onKey) {}
+
+    virtual ~S3ListingParser() {}
+
+    void feed(const string& chunk) {
+        buffer += chunk;
+        size_t pos = 0;
+        while (true) {
+            size_t open = buffer.find('<', pos);
+            if (open == string::npos) {
+                pos = buffer.size();
+                break;
+            }
+            size_t close = buffer.find('>', open);
+            if (close == string::npos) {
+                pos = open;
+                break;
+            }
+            const string tag = buffer.substr(open + 1, close - open - 1);
+            if (tag != "Key" && tag != "NextMarker" && tag != "IsTruncated") {
+                pos = close + 1;
+                continue;
+            }
+            const string end = "</" + tag + ">";
+            size_t stop = buffer.find(end, close + 1);
+            if (stop == string::npos) {
+                pos = open;
+                break;
+            }
+            const string value = buffer.substr(close + 1, stop - close - 1);
+            if (tag == "Key") {
+                lastKey = value;
+                onKey(value);
+            } else if (tag == "NextMarker") nextMarker = value;
+            else truncated = value == "true";
+            pos = stop + end.size();
+        }
+        buffer.erase(0, pos);
+    }
+
+    bool isTruncated() const { return truncated; }
+
+    // Marker of the next page (S3 omits NextMarker without a delimiter,
+    // then the last key is the marker).
+    string getNextMarker() const { return nextMarker.empty() ? lastKey : nextMarker; }
+
+private:
+    KeyCallback onKey;
+    string buffer;
+    string lastKey;
+    string nextMarker;
+    bool truncated = false;
+};
+
+
+#ifdef TEST
+
+#include <vector>
+
+TEST(test_S3ListingParser_parses_keys_across_chunk_boundaries) {
+    const string xml =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?><ListBucketResult><Name>data.binance.vision</Name>"
+        "<IsTruncated>true</IsTruncated><NextMarker>a/b/c-2.zip</NextMarker>"
+        "<Contents><Key>a/b/c-1.zip</Key><Size>10</Size></Contents>"
+        "<Contents><Key>a/b/c-1.zip.CHECKSUM</Key><Size>10</Size></Contents>"
+        "<Contents><Key>a/b/c-2.zip</Key><Size>10</Size></Contents></ListBucketResult>";
+    for (size_t chunk: { (size_t)1, (size_t)5, xml.size() }) {
+        vector<string> keys;
+        S3ListingParser parser([&keys](const string& key) { keys.push_back(key); });
+        for (size_t i = 0; i < xml.size(); i += chunk) parser.feed(xml.substr(i, chunk));
+        assert((keys == vector<string>{ "a/b/c-1.zip", "a/b/c-1.zip.CHECKSUM", "a/b/c-2.zip" }) && "Should find every key");
+        assert(parser.isTruncated() && parser.getNextMarker() == "a/b/c-2.zip" && "Should read the paging fields");
+    }
+}
+
+TEST(test_S3ListingParser_falls_back_to_last_key_as_marker) {
+    S3ListingParser parser([](const string&) {});
+    parser.feed("<ListBucketResult><IsTruncated>false</IsTruncated><Contents><Key>x/1</Key></Contents>"
+                "<Contents><Key>x/2</Key></Contents></ListBucketResult>");
+    assert(!parser.isTruncated() && parser.getNextMarker() == "x/2" && "Last key should be the marker");
+}
+
+#endif
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+// SHA-256 (FIPS 180-4), incremental.
+class Sha256 {
+public:
+    Sha256() { reset(); }
+
+    virtual ~Sha256() {}
+
+    void reset() {
+        static const uint32_t H0[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        memcpy(h, H0, sizeof(h));
+        length = 0;
+        used = 0;
+    }
+
+    void update(const void* data, size_t size) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        length += size;
+        if (used) {
+            size_t take = min(size, sizeof(block) - used);
+            memcpy(block + used, p, take);
+            used += take;
+            p += take;
+            size -= take;
+            if (used < sizeof(block)) return;
+            compress(block);
+            used = 0;
+        }
+        for (; size >= sizeof(block); p += sizeof(block), size -= sizeof(block)) compress(p);
+        memcpy(block, p, size);
+        used = size;
+    }
+
+    void update(const string& data) { update(data.data(), data.size()); }
+
+    // Lowercase hex digest; the hasher has to be reset() before reuse.
+    string hex() {
+        uint64_t bits = length * 8;
+        uint8_t pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (used != 56) update(&pad, 1);
+        uint8_t size[8];
+        for (int i = 0; i < 8; i++) size[i] = bits >> (56 - 8 * i);
+        update(size, 8);
+
+        static const char* digits = "0123456789abcdef";
+        string out;
+        for (uint32_t word: h)
+            for (int shift = 28; shift >= 0; shift -= 4) out.push_back(digits[(word >> shift) & 0xf]);
+        return out;
+    }
+
+    static string hash(const string& data) {
+        Sha256 sha;
+        sha.update(data);
+        return sha.hex();
+    }
+
+private:
+
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void compress(const uint8_t* chunk) {
+        static const uint32_t K[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint32_t)chunk[4 * i] << 24 | (uint32_t)chunk[4 * i + 1] << 16 |
+                (uint32_t)chunk[4 * i + 2] << 8 | (uint32_t)chunk[4 * i + 3];
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            hh = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+        h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    }
+
+    uint32_t h[8];
+    uint8_t block[64];
+    uint64_t length;
+    size_t used;
+};
+
+
+#ifdef TEST
+
+TEST(test_Sha256_matches_known_digests) {
+    assert(Sha256::hash("") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" && "Empty input");
+    assert(Sha256::hash("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" && "One block");
+    assert(Sha256::hash("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+           "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" && "Two blocks");
+    Sha256 sha;
+    const string million(1000000, 'a');
+    for (size_t i = 0; i < million.size(); i += 333) sha.update(million.substr(i, 333));
+    assert(sha.hex() == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" && "Incremental updates");
+}
+
+#endif
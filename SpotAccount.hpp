@@ -0,0 +1,317 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Candle.hpp"
+#include "LimitOrder.hpp"
+#include "LimitOrderBook.hpp"
+#include "FixedLedger.hpp"
+#include "OrderResult.hpp"
+#include "PerformanceMetrics.hpp"
+#include "IntraCandleResolver.hpp"
+
+#include "../misc/Value.hpp"
+
+using namespace std;
+
+// The order rules of one asset traded against a quote balance: market and
+// limit orders, reservations, maker and taker fees, in floats or in the
+// units of the fixed-point ledger, with every fill reported to the
+// metrics. A view over state its owner keeps (references), made per call:
+// TestExchange is one account, PortfolioExchange has one per symbol, all
+// sharing the quote balance.
+class SpotAccount {
+public:
+    struct Fees {
+        float takerBuyPc = 0;
+        float takerSellPc = 0;
+        float makerBuyPc = 0;
+        float makerSellPc = 0;
+
+        // The rates in the ledger's fee units, converted once per change
+        // instead of once per trade.
+        int64_t takerBuyUnits = 0;
+        int64_t takerSellUnits = 0;
+        int64_t makerBuyUnits = 0;
+        int64_t makerSellUnits = 0;
+
+        // After a rate or the ledger changed.
+        void convert(const FixedLedger& ledger) {
+            takerBuyUnits = ledger.feeUnits(takerBuyPc);
+            takerSellUnits = ledger.feeUnits(takerSellPc);
+            makerBuyUnits = ledger.feeUnits(makerBuyPc);
+            makerSellUnits = ledger.feeUnits(makerSellPc);
+        }
+    };
+
+    SpotAccount(
+        float& balance, int64_t& balanceUnits,
+        float& asset, int64_t& assetUnits,
+        LimitOrderBook& orders,
+        const FixedLedger& ledger,
+        const Fees& fees, // converted for the ledger
+        PerformanceMetrics* metrics = nullptr,
+        PerformanceMetrics::Position* position = nullptr // of the asset, nullptr: the metrics' own
+    ):
+        balance(balance), balanceUnits(balanceUnits),
+        asset(asset), assetUnits(assetUnits),
+        orders(orders), ledger(ledger), fees(fees),
+        metrics(metrics), position(position)
+    {}
+
+    float getBalance() const { return ledger.isEnabled() ? ledger.quotedValue(balanceUnits) : balance; }
+    float getAsset() const { return ledger.isEnabled() ? ledger.quantityValue(assetUnits) : asset; }
+
+    // Value of the asset at the price, pending sells included, and the
+    // cash reserved by pending buys.
+    float getReservedAndAssetValue(float price) const {
+        if (ledger.isEnabled())
+            return ledger.quotedValue(orders.getReservedUnits(OrderType::BUY_LIMIT)) +
+                ledger.quantityValue(assetUnits + orders.getReservedUnits(OrderType::SELL_LIMIT)) * price;
+        return orders.getReserved(OrderType::BUY_LIMIT) + (asset + orders.getReserved(OrderType::SELL_LIMIT)) * price;
+    }
+
+    // The whole account at the price: balance, reservations and asset.
+    float getEquity(float price) const {
+        if (ledger.isEnabled())
+            return ledger.quotedValue(balanceUnits + orders.getReservedUnits(OrderType::BUY_LIMIT)) +
+                ledger.quantityValue(assetUnits + orders.getReservedUnits(OrderType::SELL_LIMIT)) * price;
+        return balance + getReservedAndAssetValue(price);
+    }
+
+    // Whether any asset is held, in the account or in pending sells.
+    bool isExposed() const {
+        if (ledger.isEnabled()) return assetUnits > 0 || orders.getReservedUnits(OrderType::SELL_LIMIT) > 0;
+        return asset > 0 || orders.getReserved(OrderType::SELL_LIMIT) > 0;
+    }
+
+    OrderResult buy(float quoted, float price) {
+        if (price <= .0f)
+            return OrderResult::fail(OrderStatus::INVALID_PRICE, price);
+
+        if (quoted <= .0f) // TODO: pre-validation can be in a central place to prevent errors on live systems too?
+            return OrderResult::fail(OrderStatus::INVALID_AMOUNT, quoted);
+
+        if (ledger.isEnabled()) return buyFixed(ledger.quotedUnits(quoted), quoted, price, false);
+
+        // Calculate total cost including taker fee
+        if (Value(quoted) > Value(balance))
+            return OrderResult::fail(OrderStatus::INSUFFICIENT_BALANCE, quoted, balance);
+
+        float amount = quoted / price; // Asset amount we get
+        balance -= quoted; // Deduct quoted amount
+        float fee = amount * fees.takerBuyPc;
+        asset += amount - fee; // TODO: pre-calculation can be in a central place to valudate the backtesting on live systems?
+        filled(true, quoted, amount - fee);
+
+        return OrderResult::ok();
+    }
+
+    OrderResult sell(float amount, float price) {
+        if (price <= .0f)
+            return OrderResult::fail(OrderStatus::INVALID_PRICE, price);
+
+        if (amount <= .0f)
+            return OrderResult::fail(OrderStatus::INVALID_AMOUNT, amount);
+
+        if (ledger.isEnabled()) return sellFixed(ledger.quantityUnits(amount), amount, price, false);
+
+        if (Value(amount) > Value(asset))
+            return OrderResult::fail(OrderStatus::INSUFFICIENT_ASSET, amount, asset);
+
+        asset -= amount;
+        float quoted = amount * price; // Gross proceeds
+        float fee = quoted * fees.takerSellPc; // Fee on proceeds
+        balance += quoted - fee;
+        filled(false, quoted - fee, amount);
+
+        return OrderResult::ok();
+    }
+
+    // Place a buy limit order (will execute when market price <= limit price)
+    OrderResult buyLimit(float quoted, float limitPrice) {
+        if (limitPrice <= .0f)
+            return OrderResult::fail(OrderStatus::INVALID_PRICE, limitPrice);
+
+        if (quoted <= .0f) // Invalid parameters
+            return OrderResult::fail(OrderStatus::INVALID_AMOUNT, quoted);
+
+        if (ledger.isEnabled()) return buyFixed(ledger.quotedUnits(quoted), quoted, limitPrice, true);
+
+        if (Value(quoted) > Value(balance)) // Insufficient balance
+            return OrderResult::fail(OrderStatus::INSUFFICIENT_BALANCE, quoted, balance);
+
+        balance -= quoted; // Reserve the cash for this order
+
+        // Add to pending orders
+        orders.add(LimitOrder(OrderType::BUY_LIMIT, limitPrice, quoted));
+
+        return OrderResult::ok();
+    }
+
+    // Place a sell limit order (will execute when market price >= limit price)
+    OrderResult sellLimit(float amount, float limitPrice) {
+        if (limitPrice <= .0f)
+            return OrderResult::fail(OrderStatus::INVALID_PRICE, limitPrice);
+
+        if (amount <= .0f) // Invalid parameters
+            return OrderResult::fail(OrderStatus::INVALID_AMOUNT, amount);
+
+        if (ledger.isEnabled()) return sellFixed(ledger.quantityUnits(amount), amount, limitPrice, true);
+
+        if (Value(amount) > Value(asset)) // Insufficient assets
+            return OrderResult::fail(OrderStatus::INSUFFICIENT_ASSET, amount, asset);
+
+        // Reserve the assets for this order
+        asset -= amount;
+
+        // Add to pending orders
+        orders.add(LimitOrder(OrderType::SELL_LIMIT, limitPrice, amount));
+
+        return OrderResult::ok();
+    }
+
+    // The whole balance (asset): on the fixed-point ledger exactly the units
+    // held, which a float amount may round past.
+    OrderResult buyAll(float price) {
+        return ledger.isEnabled() ? buyFixed(balanceUnits, getBalance(), price, false) : buy(balance, price);
+    }
+
+    OrderResult sellAll(float price) {
+        return ledger.isEnabled() ? sellFixed(assetUnits, getAsset(), price, false) : sell(asset, price);
+    }
+
+    OrderResult buyLimitAll(float limitPrice) {
+        return ledger.isEnabled() ? buyFixed(balanceUnits, getBalance(), limitPrice, true) : buyLimit(balance, limitPrice);
+    }
+
+    OrderResult sellLimitAll(float limitPrice) {
+        return ledger.isEnabled() ? sellFixed(assetUnits, getAsset(), limitPrice, true) : sellLimit(asset, limitPrice);
+    }
+
+    // Cancel all pending orders (return reserved funds/assets)
+    void cancelAll() {
+        for (const auto& order: orders.orders()) // in placement order
+            if (ledger.isEnabled()) (order.type == OrderType::BUY_LIMIT ? balanceUnits : assetUnits) += order.units;
+            else if (order.type == OrderType::BUY_LIMIT) balance += order.amount; // Return reserved cash
+            else asset += order.amount; // Return reserved assets
+        orders.clear();
+    }
+
+    // Fills the orders the candle crosses, in placement order, with maker
+    // fees. When it crosses both buys and sells and there is a resolver,
+    // the fine candles are replayed first, filling orders in the order the
+    // market reached them; what they miss still fills on the candle.
+    // Returns the number of filled orders.
+    size_t process(const Candle& candle, IntraCandleResolver* resolver = nullptr) {
+        if (orders.empty()) return 0;
+        size_t count = 0;
+        if (resolver && orders.crossesBoth(candle.getLow(), candle.getHigh()))
+            for (const Candle& fine: resolver->candles(candle.getTime()))
+                count += fill(orders.fill(fine.getLow(), fine.getHigh()));
+        return count + fill(orders.fill(candle.getLow(), candle.getHigh()));
+    }
+
+protected:
+
+    // Fixed-point ledger counterparts of the orders above: the same rules
+    // in integer units, compared exactly instead of through Value().
+    // `quoted` (`amount`) is the requested float, for the results and orders.
+    OrderResult buyFixed(int64_t units, float quoted, float orderPrice, bool limit) {
+        const int64_t priced = ledger.priceUnits(orderPrice);
+        if (priced <= 0)
+            return OrderResult::fail(OrderStatus::INVALID_PRICE, orderPrice);
+        if (units <= 0)
+            return OrderResult::fail(OrderStatus::INVALID_AMOUNT, quoted);
+        if (units > balanceUnits)
+            return OrderResult::fail(OrderStatus::INSUFFICIENT_BALANCE, quoted, getBalance());
+
+        balanceUnits -= units;
+        if (limit) orders.add(LimitOrder(OrderType::BUY_LIMIT, orderPrice, quoted, units));
+        else {
+            const int64_t amount = ledger.assetFor(units, priced);
+            const int64_t net = amount - ledger.feeOf(amount, fees.takerBuyUnits);
+            assetUnits += net;
+            filled(true, ledger.quotedValue(units), ledger.quantityValue(net));
+        }
+        return OrderResult::ok();
+    }
+
+    OrderResult sellFixed(int64_t units, float amount, float orderPrice, bool limit) {
+        const int64_t priced = ledger.priceUnits(orderPrice);
+        if (priced <= 0)
+            return OrderResult::fail(OrderStatus::INVALID_PRICE, orderPrice);
+        if (units <= 0)
+            return OrderResult::fail(OrderStatus::INVALID_AMOUNT, amount);
+        if (units > assetUnits)
+            return OrderResult::fail(OrderStatus::INSUFFICIENT_ASSET, amount, getAsset());
+
+        assetUnits -= units;
+        if (limit) orders.add(LimitOrder(OrderType::SELL_LIMIT, orderPrice, amount, units));
+        else {
+            const int64_t quoted = ledger.quotedFor(units, priced);
+            const int64_t net = quoted - ledger.feeOf(quoted, fees.takerSellUnits);
+            balanceUnits += net;
+            filled(false, ledger.quotedValue(net), ledger.quantityValue(units));
+        }
+        return OrderResult::ok();
+    }
+
+    size_t fill(const vector<LimitOrder>& crossed) {
+        for (const LimitOrder& order: crossed) execute(order);
+        return crossed.size();
+    }
+
+    void execute(const LimitOrder& order) {
+        if (ledger.isEnabled()) executeFixed(order);
+        else if (order.type == OrderType::BUY_LIMIT) {
+            // Buy order executes when market goes at or below limit price
+            // Execute buy order with maker fee
+            float fee = order.amount * fees.makerBuyPc; // Fee in quoted currency
+            float net = (order.amount - fee) / order.price; // Net asset amount after fee
+
+            asset += net;
+            filled(true, order.amount, net);
+        } else { // SELL_LIMIT
+            // Sell order executes when market goes at or above limit price
+            // Execute sell order with maker fee
+            float gross = order.amount * order.price; // Gross proceeds
+            float fee = gross * fees.makerSellPc; // Fee on proceeds
+            float net = gross - fee; // Net amount we receive
+
+            balance += net;
+            filled(false, net, order.amount);
+        }
+    }
+
+    void executeFixed(const LimitOrder& order) {
+        const int64_t priced = ledger.priceUnits(order.price);
+        if (order.type == OrderType::BUY_LIMIT) {
+            const int64_t fee = ledger.feeOf(order.units, fees.makerBuyUnits); // Fee in quoted currency
+            const int64_t net = ledger.assetFor(order.units - fee, priced);
+            assetUnits += net;
+            filled(true, ledger.quotedValue(order.units), ledger.quantityValue(net));
+        } else {
+            const int64_t gross = ledger.quotedFor(order.units, priced);
+            const int64_t net = gross - ledger.feeOf(gross, fees.makerSellUnits);
+            balanceUnits += net;
+            filled(false, ledger.quotedValue(net), ledger.quantityValue(order.units));
+        }
+    }
+
+    void filled(bool buy, double quoted, double amount) {
+        if (!metrics) return;
+        if (position) metrics->onFill(*position, buy, quoted, amount);
+        else metrics->onFill(buy, quoted, amount);
+    }
+
+    float& balance;
+    int64_t& balanceUnits;
+    float& asset;
+    int64_t& assetUnits;
+    LimitOrderBook& orders;
+    const FixedLedger& ledger;
+    const Fees& fees;
+    PerformanceMetrics* metrics;
+    PerformanceMetrics::Position* position;
+};
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <span>
+
+#include "../misc/ERROR.hpp"
 #include "Candle.hpp"
 #include "Exchange.hpp"
 
@@ -23,6 +26,24 @@ public:
     // Called when a candle sick closes
     virtual void onCandleClose(const Candle&) = 0; 
 
+    // Optional batched form of onCandleClose for consecutive candles.
+    // Returns how many candles from the front were handled; they must be
+    // the ones onCandleClose would not have placed orders on (internal
+    // state only, no exchange calls). The runner sends the next candle to
+    // onCandleClose and continues with a new batch, so results stay
+    // identical to per-candle calls. Default: handles none.
+    virtual size_t onCandleBatch(span<const Candle>) { return 0; }
+
+    // Back to the state before onStart, keeping the parameters, so an
+    // instance can be reused for the next run.
+    virtual void reset() {}
+
+    // New instance with the same parameters and state (and exchange),
+    // owned by the caller.
+    virtual Strategy* clone() const {
+        throw ERROR("Strategy can not be cloned");
+    }
+
 protected:
     Exchange* exchange = nullptr;
 };
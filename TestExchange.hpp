@@ -1,13 +1,29 @@
 #pragma once
 
 #include "LimitOrder.hpp"
+#include "LimitOrderBook.hpp"
+#include "FixedLedger.hpp"
+#include "SpotAccount.hpp"
+#include "PerformanceMetrics.hpp"
+#include "IntraCandleResolver.hpp"
 #include "Exchange.hpp"
 #include "Strategy.hpp"
 
-#include "../misc/Value.hpp"
-
 class TestExchange: public Exchange {
 public:
+    // Full simulated account state, for reusing an instance across runs.
+    struct State {
+        uint32_t time = 0;
+        float price = 0;
+        float balance = 0;
+        float asset = 0;
+        vector<LimitOrder> limitOrders; // in placement order
+        float feeTakerBuyPc = 0, feeTakerSellPc = 0, feeMakerBuyPc = 0, feeMakerSellPc = 0;
+        FixedLedger ledger;
+        int64_t balanceUnits = 0;
+        int64_t assetUnits = 0;
+    };
+
     TestExchange(
         bool logsOnError,
         bool showsOnError,
@@ -19,11 +35,11 @@ public:
     virtual ~TestExchange() {}
     
     float getBalanceTotal() override {
-        return balance + asset * price;
+        return getBalance() + getAsset() * price;
     }
 
     float getBalanceUsed() override {
-        return asset * price;
+        return getAsset() * price;
     }
 
     float getBalanceFree() override {
@@ -39,11 +55,11 @@ public:
     }
     
     float getAssetTotal() override {
-        return asset + balance / price;
+        return getAsset() + getBalance() / price;
     }
 
     float getAssetUsed() override {
-        return asset;
+        return getAsset();
     }
 
     float getAssetFree() override {
@@ -58,6 +74,17 @@ public:
         return getAssetFree() / getAssetTotal();
     }
     
+    // Account value at the current price, the cash and asset reserved by
+    // pending limit orders included (getBalanceTotal() leaves them out).
+    float getEquity() {
+        return account().getEquity(price);
+    }
+
+    // Whether any asset is held, in the account or in pending sells.
+    bool isExposed() {
+        return account().isExposed();
+    }
+
     // Get number of pending limit orders
     size_t getPendingOrderCount() const override {
         return limitOrders.size();
@@ -65,161 +92,183 @@ public:
     
     // Cancel all pending orders (return reserved funds/assets)
     void cancelAllOrders() override {
-        for (const auto& order: limitOrders)
-            if (order.type == OrderType::BUY_LIMIT) balance += order.amount; // Return reserved cash
-            else asset += order.amount; // Return reserved assets
-        limitOrders.clear();
+        account().cancelAll();
     }
 
+    // Switches the account to an integer fixed-point ledger: balance and
+    // asset are converted now, prices and fees whenever they are used.
+    // Results are reproducible and exact in ledger units (getBalanceUnits(),
+    // getAssetUnits()); the float getters convert from the units.
+    // Throws, leaving the account as it was, when the balance or the asset
+    // does not fit the units.
+    void setFixedPoint(const FixedLedger::Scales& scales) {
+        if (!limitOrders.empty()) throw ERROR("Fixed-point ledger can not be set with pending orders");
+        const FixedLedger fixed(scales);
+        const int64_t balance = fixed.quotedUnits(getBalance());
+        const int64_t asset = fixed.quantityUnits(getAsset());
+        ledger = fixed;
+        balanceUnits = balance;
+        assetUnits = asset;
+        fees.convert(ledger);
+    }
+
+    bool isFixedPoint() const { return ledger.isEnabled(); }
+    const FixedLedger& getLedger() const { return ledger; }
+    int64_t getBalanceUnits() const { return balanceUnits; }
+    int64_t getAssetUnits() const { return assetUnits; }
+
+    // Fills are reported to the metrics (not owned, nullptr: none); the
+    // BacktestRunner adds the equity of every candle.
+    void setMetrics(PerformanceMetrics* metrics) { this->metrics = metrics; }
+    PerformanceMetrics* getMetrics() const { return metrics; }
+
 
     // ============ Internal use only, DO NOT call in strategy! ============
 
+    State snapshot() const {
+        State state;
+        snapshot(state);
+        return state;
+    }
+
+    // Copies into an existing state, reusing its order buffer.
+    void snapshot(State& state) const {
+        state.time = time;
+        state.price = price;
+        state.balance = balance;
+        state.asset = asset;
+        const vector<LimitOrder>& orders = limitOrders.orders();
+        state.limitOrders.assign(orders.begin(), orders.end());
+        state.feeTakerBuyPc = fees.takerBuyPc;
+        state.feeTakerSellPc = fees.takerSellPc;
+        state.feeMakerBuyPc = fees.makerBuyPc;
+        state.feeMakerSellPc = fees.makerSellPc;
+        state.ledger = ledger;
+        state.balanceUnits = balanceUnits;
+        state.assetUnits = assetUnits;
+    }
+
+    // Restores without reallocating once the order buffer has grown.
+    virtual void restore(const State& state) {
+        time = state.time;
+        price = state.price;
+        balance = state.balance;
+        asset = state.asset;
+        limitOrders.assign(state.limitOrders);
+        fees.takerBuyPc = state.feeTakerBuyPc;
+        fees.takerSellPc = state.feeTakerSellPc;
+        fees.makerBuyPc = state.feeMakerBuyPc;
+        fees.makerSellPc = state.feeMakerSellPc;
+        ledger = state.ledger;
+        fees.convert(ledger);
+        balanceUnits = state.balanceUnits;
+        assetUnits = state.assetUnits;
+    }
+
     virtual void setTime(uint32_t time) { this->time = time; }
     virtual void setPrice(float price) { this->price = price; }
     
-    void setBalance(float balance) { this->balance = balance; }
-    void setAsset(float asset) { this->asset = asset; }
-    float getBalance() const { return balance; }
-    float getAsset() const { return asset; }
-    void setFeeMakerBuyPc(float feeMakerBuyPc) { this->feeMakerBuyPc = feeMakerBuyPc; }
-    void setFeeMakerSellPc(float feeMakerSellPc) { this->feeMakerSellPc = feeMakerSellPc; }
-    void setFeeTakerBuyPc(float feeTakerBuyPc) { this->feeTakerBuyPc = feeTakerBuyPc; }
-    void setFeeTakerSellPc(float feeTakerSellPc) { this->feeTakerSellPc = feeTakerSellPc; }
-
-    // Updated processLimitOrders method with maker fees
+    void setBalance(float balance) {
+        if (ledger.isEnabled()) balanceUnits = ledger.quotedUnits(balance);
+        else this->balance = balance;
+    }
+    void setAsset(float asset) {
+        if (ledger.isEnabled()) assetUnits = ledger.quantityUnits(asset);
+        else this->asset = asset;
+    }
+    float getBalance() const { return ledger.isEnabled() ? ledger.quotedValue(balanceUnits) : balance; }
+    float getAsset() const { return ledger.isEnabled() ? ledger.quantityValue(assetUnits) : asset; }
+    void setFeeMakerBuyPc(float feeMakerBuyPc) { fees.makerBuyPc = feeMakerBuyPc; fees.convert(ledger); }
+    void setFeeMakerSellPc(float feeMakerSellPc) { fees.makerSellPc = feeMakerSellPc; fees.convert(ledger); }
+    void setFeeTakerBuyPc(float feeTakerBuyPc) { fees.takerBuyPc = feeTakerBuyPc; fees.convert(ledger); }
+    void setFeeTakerSellPc(float feeTakerSellPc) { fees.takerSellPc = feeTakerSellPc; fees.convert(ledger); }
+
+    // Fills the orders the candle crosses, with maker fees (see
+    // SpotAccount::process(), and the resolver below).
     void processLimitOrders(const Candle& candle) {
-        auto it = limitOrders.begin();
-        
-        while (it != limitOrders.end()) {
-            bool orderFilled = false;
-            
-            if (it->type == OrderType::BUY_LIMIT) {
-                // Buy order executes when market goes at or below limit price
-                if (candle.getLow() <= it->price) {
-                    // Execute buy order with maker fee
-                    float fee = it->amount * feeMakerBuyPc; // Fee in quoted currency
-                    float net = (it->amount - fee) / it->price; // Net asset amount after fee
-                    
-                    asset += net;
-                    orderFilled = true;
-                }
-            } else { // SELL_LIMIT
-                // Sell order executes when market goes at or above limit price
-                if (candle.getHigh() >= it->price) {
-                    // Execute sell order with maker fee
-                    float gross = it->amount * it->price; // Gross proceeds
-                    float fee = gross * feeMakerSellPc; // Fee on proceeds
-                    float net = gross - fee; // Net amount we receive
-                    
-                    balance += net;
-                    orderFilled = true;
-                }
-            }
-            
-            if (orderFilled) it = limitOrders.erase(it);
-            else ++it;
-        }
+        if (limitOrders.empty()) return;
+        account().process(candle, resolver.get());
     }
 
+    // Finer history for candles where fill order is ambiguous (nullptr: off).
+    void setIntraCandleResolver(shared_ptr<IntraCandleResolver> resolver) { this->resolver = resolver; }
+    shared_ptr<IntraCandleResolver> getIntraCandleResolver() const { return resolver; }
+
 protected:
 
     uint32_t time;
     float price = 0;
 
-    float balance;
-    float asset;    
+    float balance = 0;
+    float asset = 0;
+
+    FixedLedger ledger; // disabled unless setFixedPoint()
+    int64_t balanceUnits = 0;
+    int64_t assetUnits = 0;
+
+    LimitOrderBook limitOrders;
 
-    vector<LimitOrder> limitOrders;
+    PerformanceMetrics* metrics = nullptr;
+    shared_ptr<IntraCandleResolver> resolver;
 
-    float feeTakerBuyPc, feeTakerSellPc, feeMakerBuyPc, feeMakerSellPc;
+    SpotAccount::Fees fees; // converted for the ledger
 
     virtual uint32_t getTime() override { return time; }
     virtual float getPrice() override { return price; }
     
-    [[nodiscard]]
-    bool buyProtected(float quoted) override {
-        if (price <= .0f)
-            return error(ERROR("Negative price: " + to_string(price)));
-
-        if (quoted <= .0f) // TODO: pre-validation can be in a central place to prevent errors on live systems too?
-            return error(ERROR("Negative quoted amount: " + to_string(quoted)));
-        
-        // Calculate total cost including taker fee
-        if (Value(quoted) > Value(balance))
-            return error(ERROR("Insufficient balance: " + to_string(quoted) + " > " + to_string(balance)));
-        
-        float amount = quoted / price; // Asset amount we get
-        balance -= quoted; // Deduct quoted amount
-        float fee = amount * feeTakerBuyPc;
-        asset += amount - fee; // TODO: pre-calculation can be in a central place to valudate the backtesting on live systems?
-        
-        return true;
+    // The order rules over this account's state.
+    SpotAccount account() {
+        return SpotAccount(balance, balanceUnits, asset, assetUnits, limitOrders, ledger, fees, metrics);
     }
 
     [[nodiscard]]
-    bool sellProtected(float amount) override {
-        if (price <= .0f)
-            return error(ERROR("Negative price: " + to_string(price)));
-
-        if (amount <= .0f)
-            return error(ERROR("Negative amount: " + to_string(amount)));
+    OrderResult buyProtected(float quoted) override {
+        return account().buy(quoted, price);
+    }
 
-        if (Value(amount) > Value(asset))
-            return error(ERROR("Insufficient amount: " + to_string(amount) + " > " + to_string(asset)));
-        
-        asset -= amount;
-        float quoted = amount * price; // Gross proceeds
-        float fee = quoted * feeTakerSellPc; // Fee on proceeds
-        balance += quoted - fee;
-        
-        return true;
+    [[nodiscard]]
+    OrderResult sellProtected(float amount) override {
+        return account().sell(amount, price);
     }
 
     // Place a buy limit order (will execute when market price <= limit price)
     [[nodiscard]]
-    bool buyLimitProtected(float quoted, float limitPrice) override {
-        if (limitPrice <= .0f)
-            return error(ERROR("Negative limit price: " + to_string(price)));
+    OrderResult buyLimitProtected(float quoted, float limitPrice) override {
+        return account().buyLimit(quoted, limitPrice);
+    }
 
-        if (quoted <= .0f) // Invalid parameters
-            return error(ERROR("Negative quoted amount: " + to_string(quoted)));
+    // Place a sell limit order (will execute when market price >= limit price)
+    [[nodiscard]]
+    OrderResult sellLimitProtected(float amount, float limitPrice) override {
+        return account().sellLimit(amount, limitPrice);
+    }
 
-        if (Value(quoted) > Value(balance)) // Insufficient balance
-            return error(ERROR("Insufficient balance: " + to_string(quoted) + " > " + to_string(balance)));
-        
-        balance -= quoted; // Reserve the cash for this order
-        
-        // Add to pending orders
-        limitOrders.emplace_back(OrderType::BUY_LIMIT, limitPrice, quoted);
-        
-        return true;
+    [[nodiscard]]
+    OrderResult buyAllProtected() override {
+        return account().buyAll(price);
     }
-    
-    // Place a sell limit order (will execute when market price >= limit price)
+
     [[nodiscard]]
-    bool sellLimitProtected(float amount, float limitPrice) override {
-        if (limitPrice <= .0f)
-            return error(ERROR("Negative limit price: " + to_string(price)));
+    OrderResult sellAllProtected() override {
+        return account().sellAll(price);
+    }
 
-        if (amount <= .0f) // Invalid parameters
-            return error(ERROR("Negative amount: " + to_string(amount)));
+    [[nodiscard]]
+    OrderResult buyLimitAllProtected(float limitPrice) override {
+        return account().buyLimitAll(limitPrice);
+    }
 
-        if (Value(amount) > Value(asset)) // Insufficient assets
-            return error(ERROR("Insufficient assets: " + to_string(amount) + " > " + to_string(asset)));
-        
-        // Reserve the assets for this order
-        asset -= amount;
-        
-        // Add to pending orders
-        limitOrders.emplace_back(OrderType::SELL_LIMIT, limitPrice, amount);
-        
-        return true;
+    [[nodiscard]]
+    OrderResult sellLimitAllProtected(float limitPrice) override {
+        return account().sellLimitAll(limitPrice);
     }
 };
 
 
 #ifdef TEST
 
+#include <chrono>
+
 #include "../misc/capture_cerr.hpp"
 #include "../misc/ConsoleLogger.hpp"
 
@@ -235,15 +284,7 @@ public:
 
     virtual ~TestExchangeMock() {}
 
-    void setBalance(float balance) { this->balance = balance; }
-    void setAsset(float asset) { this->asset = asset; }
-    float getBalance() const { return balance; }
-    float getAsset() const { return asset; }
     void setPrice(float price) { this->price = price; }
-    void setFeeMakerBuyPc(float feeMakerBuyPc) { this->feeMakerBuyPc = feeMakerBuyPc; }
-    void setFeeMakerSellPc(float feeMakerSellPc) { this->feeMakerSellPc = feeMakerSellPc; }
-    void setFeeTakerBuyPc(float feeTakerBuyPc) { this->feeTakerBuyPc = feeTakerBuyPc; }
-    void setFeeTakerSellPc(float feeTakerSellPc) { this->feeTakerSellPc = feeTakerSellPc; }
     void processLimitOrders(const Candle &candle) { TestExchange::processLimitOrders(candle); }
 } exchange;
 
@@ -503,4 +544,155 @@ TEST(test_TestExchange_processLimitOrders_does_not_execute_unfilled_orders) {
     assert(abs(exchange.getAsset() - 5) < 0.001f && "Assets should remain reserved");
 }
 
+TEST(test_TestExchange_snapshot_restore_roundtrip) {
+    TestExchangeMock exchange;
+    exchange.setBalance(1000);
+    exchange.setAsset(10);
+    exchange.setPrice(100);
+    exchange.setFeeTakerBuyPc(0.01);
+    assert(exchange.buyLimit(300, 90));
+    TestExchange::State state = exchange.snapshot();
+
+    assert(exchange.buy(200));
+    assert(exchange.sellLimit(4, 110));
+    exchange.setPrice(120);
+    exchange.restore(state);
+
+    assert(abs(exchange.getBalance() - 700) < 0.001f && abs(exchange.getAsset() - 10) < 0.001f && "Account should be restored");
+    assert(exchange.getPendingOrderCount() == 1 && abs(exchange.getBalanceUsed() - 1000) < 0.001f && "Orders and price should be restored");
+    exchange.cancelAllOrders();
+    assert(abs(exchange.getBalance() - 1000) < 0.001f && "Restored orders should keep their reservation");
+}
+
+
+TEST(test_TestExchange_fixed_point_ledger_is_exact) {
+    TestExchangeMock exchange(false, false, false);
+    exchange.setBalance(1000);
+    exchange.setAsset(0);
+    exchange.setPrice(50);
+    exchange.setFeeTakerBuyPc(0.01);
+    exchange.setFeeMakerSellPc(0.004);
+    exchange.setFixedPoint(FixedLedger::Scales{ 2, 8, 8, 6 });
+    const FixedLedger& ledger = exchange.getLedger();
+    assert(exchange.isFixedPoint() && exchange.getBalanceUnits() == ledger.quotedUnits(1000) && "Account should be converted");
+
+    assert(exchange.buy(500));
+    assert(exchange.getBalanceUnits() == ledger.quotedUnits(500) && exchange.getAssetUnits() == ledger.quantityUnits(9.9) &&
+           "Market buy should be exact in units");
+    assert(exchange.sellLimit(5, 105));
+    exchange.processLimitOrders(Candle(0, 100, 106, 99, 104, 1));
+    assert(exchange.getBalanceUnits() == ledger.quotedUnits(500 + 522.9) && exchange.getAssetUnits() == ledger.quantityUnits(4.9) &&
+           "Limit fill should be exact in units");
+    assert(abs(exchange.getBalance() - 1022.9) < 0.001f && abs(exchange.getBalanceTotal() - (1022.9 + 4.9 * 50)) < 0.01f &&
+           "Float getters should follow the ledger");
+
+    TestExchange::State state = exchange.snapshot();
+    assert(exchange.buyLimitAll(40) && exchange.getBalanceUnits() == 0 && "All of the balance should be reserved in units");
+    assert(!exchange.buyLimit(0.001, 40) && "The whole balance should be reserved");
+    exchange.cancelAllOrders();
+    assert(exchange.getBalanceUnits() == state.balanceUnits && "Cancel should return the reserved units");
+    assert(exchange.sellAll());
+    exchange.restore(state);
+    assert(exchange.getAssetUnits() == ledger.quantityUnits(4.9) && "Restore should bring back the ledger");
+}
+
+TEST(test_TestExchange_fixed_point_rejects_unrepresentable_account) {
+    TestExchangeMock exchange(false, false, false);
+    exchange.setBalance(1e12);
+    exchange.setAsset(2);
+    bool thrown = false;
+    try {
+        exchange.setFixedPoint(FixedLedger::Scales{ 8, 8, 8, 6 });
+    } catch (exception&) {
+        thrown = true;
+    }
+    assert(thrown && "A balance out of the ledger range should be rejected");
+    assert(!exchange.isFixedPoint() && exchange.getBalance() == 1e12f && exchange.getAsset() == 2 &&
+           "The account should be left as it was");
+    exchange.setBalance(1000);
+    exchange.setFixedPoint(FixedLedger::Scales{ 8, 8, 8, 6 });
+    assert(exchange.isFixedPoint() && exchange.getBalanceUnits() == exchange.getLedger().quotedUnits(1000) &&
+           "A representable balance should convert");
+}
+
+// Alternating market buys and sells, each sized by the previous one.
+inline pair<int64_t, float> TestExchange_test_trades(bool fixed, int trades, double& seconds) {
+    TestExchangeMock exchange(false, false, false);
+    exchange.setBalance(10000);
+    exchange.setAsset(0);
+    exchange.setFeeTakerBuyPc(0.000001);
+    exchange.setFeeTakerSellPc(0.000001);
+    if (fixed) exchange.setFixedPoint(FixedLedger::Scales());
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < trades; i++) {
+        exchange.setPrice(100 + 10 * sin(i / 100.0f));
+        if (i % 2) (void)exchange.sell(exchange.getAsset() / 2);
+        else (void)exchange.buy(exchange.getBalance() / 3);
+    }
+    seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return make_pair(exchange.getBalanceUnits(), exchange.getBalance());
+}
+
+TEST(test_TestExchange_fixed_point_is_reproducible) {
+    double seconds;
+    auto floating = TestExchange_test_trades(false, 100000, seconds);
+    auto fixed = TestExchange_test_trades(true, 100000, seconds);
+    assert(TestExchange_test_trades(true, 100000, seconds) == fixed && "Fixed-point runs should be identical");
+    assert(abs(fixed.second - floating.second) < floating.second * 0.01f && "Fixed-point should agree with the float ledger");
+}
+
+#ifdef BENCHMARK
+
+TEST(test_TestExchange_benchmark_fixed_point) {
+    double floatSec = 1e9, fixedSec = 1e9, seconds;
+    for (int i = 0; i < 5; i++) { // best of
+        TestExchange_test_trades(false, 3000000, seconds);
+        floatSec = min(floatSec, seconds);
+        TestExchange_test_trades(true, 3000000, seconds);
+        fixedSec = min(fixedSec, seconds);
+    }
+    cout << "  TestExchange: " << fixedSec * 1e9 / 3000000 << " ns/trade fixed-point, "
+         << floatSec * 1e9 / 3000000 << " ns/trade float" << endl;
+}
+
+#endif // BENCHMARK
+
+
+TEST(test_TestExchange_intra_candle_resolver_replays_fills_in_market_order) {
+    vector<Candle> minutes;
+    for (int hour = 0; hour < 3; hour++) {
+        minutes.push_back(Candle(hour * 3600, 100, 106, 100, 104, 1));        // up to the sell first
+        minutes.push_back(Candle(hour * 3600 + 60, 104, 104, 94, 96, 1));     // then down to the buy
+    }
+    vector<pair<time_sec, time_sec>> loaded;
+    auto resolver = make_shared<IntraCandleResolver>(3600, [&](time_sec from, time_sec to) {
+        loaded.push_back({ from, to });
+        return MappedCandles(vector<Candle>(minutes)).slice(from, to);
+    });
+    auto backtest = [](shared_ptr<IntraCandleResolver> resolver, PerformanceMetrics& metrics) {
+        TestExchangeMock exchange;
+        exchange.setBalance(1000);
+        exchange.setAsset(10);
+        exchange.setPrice(100);
+        exchange.setFeeMakerBuyPc(0);
+        exchange.setFeeMakerSellPc(0);
+        exchange.setMetrics(&metrics);
+        exchange.setIntraCandleResolver(resolver);
+        assert(exchange.buyLimit(100, 90));
+        exchange.processLimitOrders(Candle(0, 100, 101, 95, 100, 1)); // one side only
+        assert(exchange.buyLimit(500, 95));
+        assert(exchange.sellLimit(5, 105));
+        exchange.processLimitOrders(Candle(3600, 100, 106, 94, 96, 1)); // both sides
+        assert(exchange.getPendingOrderCount() == 1 && "Both crossed orders should fill");
+        return exchange.getBalance();
+    };
+
+    PerformanceMetrics coarse, resolved;
+    float balance = backtest(nullptr, coarse);
+    assert(coarse.getFills() == 2 && coarse.getTrades() == 1 && "Without a resolver the buy fills first (placement order)");
+    assert(backtest(resolver, resolved) == balance && resolved.getFills() == 2 && "Resolved fills should give the same account");
+    assert(resolved.getTrades() == 0 && "The sell was reached first, before the buy opened a position");
+    assert(loaded.size() == 1 && loaded[0].first == 3600 && resolver->getResolved() == 1 && "Only the ambiguous candle should load finer history");
+}
+
 #endif
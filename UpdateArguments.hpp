@@ -0,0 +1,74 @@
+#pragma once
+
+#include <iostream>
+
+#include "HistoryArguments.hpp"
+#include "FleetUpdater.hpp"
+
+#include "../misc/DynLoader.hpp"
+#include "../misc/explode.hpp"
+
+// Batch update of a history: every symbol with every interval, e.g.
+//   -h BinanceSpotCandleHistory -s BTCUSDT,ETHUSDT -i 1m,1h -p 4 -c 8 -r 20 -w 8
+class UpdateArguments: public Arguments {
+public:
+    UpdateArguments(
+        int argc, char* argv[],
+        DynLoader& loader
+    ):
+        Arguments(argc, argv), loader(loader)
+    {
+        addHelp({"history", "h"}, "History");
+        addHelp({"symbols", "s"}, "Symbols, comma separated");
+        addHelp({"intervals", "i"}, "Intervals, comma separated");
+        addHelp({"parallel", "p"}, "Pairs updated at once (default: 4)");
+        addHelp({"connections", "c"}, "Shared connections (default: 8)");
+        addHelp({"rate", "r"}, "Requests per second per host (default: unlimited)");
+        addHelp({"workers", "w"}, "Archive downloads at once per pair (default: 8)");
+
+        historyLib = HISTORIES_DIR + get<string>("history") + LIB_EXT;
+        history = loader.load<CandleHistory>(historyLib);
+
+        pairs = FleetUpdater::pairs(
+            explode(",", get<string>("symbols")),
+            explode(",", get<string>("intervals"))
+        );
+        if (has("parallel")) settings.parallel = stoul(get<string>("parallel"));
+        if (has("connections")) settings.connections = stoul(get<string>("connections"));
+        if (has("rate")) settings.rate = stod(get<string>("rate"));
+        if (has("workers")) settings.workers = stoul(get<string>("workers"));
+    }
+
+    virtual ~UpdateArguments() {}
+
+    string getHistoryLib() const { return historyLib; }
+    CandleHistory* getHistory() const { return history; }
+
+    const vector<FleetUpdater::Pair>& getPairs() const { return pairs; }
+    const FleetUpdater::Settings& getSettings() const { return settings; }
+
+    vector<FleetUpdater::Report> update(FleetUpdater::OnProgress onProgress = printProgress) const {
+        return FleetUpdater::updateAll(*getHistory(), pairs, settings, onProgress);
+    }
+
+    static void printProgress(const FleetUpdater::Report& report, size_t done, size_t total) {
+        cout << "[" << done << "/" << total << "] " << report.symbol << "-" << report.interval << ": ";
+        if (!report.error.empty()) cout << "ERROR: " << report.error;
+        else cout << report.candles << " candles in " << report.seconds << "s ("
+            << report.candlesPerSecond() << " candles/s, "
+            << report.bytesPerSecond() / 1e6 << " MB/s, "
+            << report.requests << " requests)";
+        cout << endl;
+    }
+
+protected:
+
+    DynLoader& loader;
+
+private:
+    string historyLib;
+    CandleHistory* history = nullptr;
+
+    vector<FleetUpdater::Pair> pairs;
+    FleetUpdater::Settings settings;
+};
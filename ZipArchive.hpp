@@ -0,0 +1,219 @@
+#pragma once
+
+// DEPENDENCY: z
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+#include <zlib.h>
+
+#include "../misc/ERROR.hpp"
+
+using namespace std;
+
+// Minimal in-memory zip reader (stored and deflated entries), so archives
+// can be inflated straight from the download buffer without temp files.
+class ZipArchive {
+public:
+    typedef function<void(const char* data, size_t size)> Chunk;
+
+    struct Entry {
+        string name;
+        uint16_t method;
+        uint32_t crc;
+        uint32_t compressedSize;
+        uint32_t size;
+        uint32_t offset; // local header
+    };
+
+    // Keeps a reference to `data`, which must outlive the archive.
+    ZipArchive(const string& data): data(data) {
+        // locate the end of central directory record
+        const size_t EOCD = 22;
+        if (data.size() < EOCD) throw ERROR("Invalid zip: too short");
+        size_t eocd = string::npos;
+        for (size_t i = data.size() - EOCD + 1; i-- > 0 && data.size() - i <= EOCD + 0xffff; )
+            if (u32(i) == 0x06054b50) {
+                eocd = i;
+                break;
+            }
+        if (eocd == string::npos) throw ERROR("Invalid zip: no central directory");
+        size_t count = u16(eocd + 10);
+        size_t at = u32(eocd + 16);
+        for (size_t i = 0; i < count; i++) {
+            if (at + 46 > data.size() || u32(at) != 0x02014b50)
+                throw ERROR("Invalid zip: broken central directory");
+            Entry entry;
+            entry.method = u16(at + 10);
+            entry.crc = u32(at + 16);
+            entry.compressedSize = u32(at + 20);
+            entry.size = u32(at + 24);
+            size_t nameLength = u16(at + 28);
+            size_t extraLength = u16(at + 30);
+            size_t commentLength = u16(at + 32);
+            entry.offset = u32(at + 42);
+            if (at + 46 + nameLength > data.size()) throw ERROR("Invalid zip: broken entry name");
+            entry.name = data.substr(at + 46, nameLength);
+            entries.push_back(entry);
+            at += 46 + nameLength + extraLength + commentLength;
+        }
+    }
+
+    ZipArchive(string&&) = delete;
+
+    virtual ~ZipArchive() {}
+
+    const vector<Entry>& getEntries() const { return entries; }
+
+    // Inflates the entry and passes the content to `chunk` piece by piece,
+    // checking the CRC at the end.
+    void stream(const Entry& entry, Chunk chunk) const {
+        size_t at = entry.offset;
+        if (at + 30 > data.size() || u32(at) != 0x04034b50)
+            throw ERROR("Invalid zip: broken local header: " + entry.name);
+        at += 30 + u16(at + 26) + u16(at + 28);
+        if (at + entry.compressedSize > data.size())
+            throw ERROR("Invalid zip: truncated entry: " + entry.name);
+        const char* in = data.data() + at;
+        uLong crc = crc32(0L, Z_NULL, 0);
+
+        if (entry.method == 0) { // stored
+            crc = crc32(crc, (const Bytef*)in, entry.compressedSize);
+            chunk(in, entry.compressedSize);
+        } else if (entry.method == 8) { // deflate
+            z_stream zs;
+            memset(&zs, 0, sizeof(zs));
+            if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+                throw ERROR("Unable to init inflate: " + entry.name);
+            zs.next_in = (Bytef*)in;
+            zs.avail_in = entry.compressedSize;
+            char out[1 << 16];
+            int status = Z_OK;
+            while (status != Z_STREAM_END) {
+                zs.next_out = (Bytef*)out;
+                zs.avail_out = sizeof(out);
+                status = inflate(&zs, Z_NO_FLUSH);
+                if (status != Z_OK && status != Z_STREAM_END) {
+                    inflateEnd(&zs);
+                    throw ERROR("Unable to inflate: " + entry.name);
+                }
+                size_t produced = sizeof(out) - zs.avail_out;
+                crc = crc32(crc, (const Bytef*)out, produced);
+                try {
+                    chunk(out, produced);
+                } catch (...) {
+                    inflateEnd(&zs);
+                    throw;
+                }
+            }
+            inflateEnd(&zs);
+        } else throw ERROR("Unsupported zip compression method " + to_string(entry.method) + ": " + entry.name);
+
+        if (crc != entry.crc) throw ERROR("Zip CRC mismatch: " + entry.name);
+    }
+
+    string read(const Entry& entry) const {
+        string content;
+        content.reserve(entry.size);
+        stream(entry, [&content](const char* data, size_t size) {
+            content.append(data, size);
+        });
+        return content;
+    }
+
+private:
+
+    uint16_t u16(size_t at) const {
+        if (at + 2 > data.size()) throw ERROR("Invalid zip: read past end");
+        const unsigned char* p = (const unsigned char*)data.data() + at;
+        return p[0] | (p[1] << 8);
+    }
+
+    uint32_t u32(size_t at) const {
+        if (at + 4 > data.size()) throw ERROR("Invalid zip: read past end");
+        const unsigned char* p = (const unsigned char*)data.data() + at;
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    const string& data;
+    vector<Entry> entries;
+};
+
+
+#ifdef TEST
+
+// Builds a single entry zip (stored or deflated) in memory.
+inline string ZipArchive_test_zip(const string& name, const string& content, bool deflated) {
+    string body = content;
+    if (deflated) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+        body.resize(deflateBound(&zs, content.size()));
+        zs.next_in = (Bytef*)content.data();
+        zs.avail_in = content.size();
+        zs.next_out = (Bytef*)body.data();
+        zs.avail_out = body.size();
+        deflate(&zs, Z_FINISH);
+        body.resize(zs.total_out);
+        deflateEnd(&zs);
+    }
+    uint32_t crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef*)content.data(), content.size());
+    auto put = [](string& out, uint32_t v, int bytes) {
+        for (int i = 0; i < bytes; i++) out.push_back((char)((v >> (8 * i)) & 0xff));
+    };
+    const uint16_t method = deflated ? 8 : 0;
+    string zip;
+    put(zip, 0x04034b50, 4); put(zip, 20, 2); put(zip, 0, 2); put(zip, method, 2);
+    put(zip, 0, 4); put(zip, crc, 4); put(zip, body.size(), 4); put(zip, content.size(), 4);
+    put(zip, name.size(), 2); put(zip, 0, 2);
+    zip += name + body;
+    const size_t central = zip.size();
+    put(zip, 0x02014b50, 4); put(zip, 20, 2); put(zip, 20, 2); put(zip, 0, 2); put(zip, method, 2);
+    put(zip, 0, 4); put(zip, crc, 4); put(zip, body.size(), 4); put(zip, content.size(), 4);
+    put(zip, name.size(), 2); put(zip, 0, 2); put(zip, 0, 2); put(zip, 0, 2); put(zip, 0, 2);
+    put(zip, 0, 4); put(zip, 0, 4);
+    zip += name;
+    const size_t centralSize = zip.size() - central;
+    put(zip, 0x06054b50, 4); put(zip, 0, 2); put(zip, 0, 2); put(zip, 1, 2); put(zip, 1, 2);
+    put(zip, centralSize, 4); put(zip, central, 4); put(zip, 0, 2);
+    return zip;
+}
+
+TEST(test_ZipArchive_reads_stored_and_deflated_entries) {
+    string content;
+    for (int i = 0; i < 20000; i++) content += "line " + to_string(i) + "\n";
+    for (bool deflated: { false, true }) {
+        string zip = ZipArchive_test_zip("data.csv", content, deflated);
+        ZipArchive archive(zip);
+        assert(archive.getEntries().size() == 1 && archive.getEntries()[0].name == "data.csv" && "Should list the entry");
+        assert(archive.read(archive.getEntries()[0]) == content && "Should extract the exact content");
+    }
+}
+
+TEST(test_ZipArchive_detects_corruption) {
+    string zip = ZipArchive_test_zip("data.csv", "1,2,3\n", false);
+    zip[30 + 8] = 'X'; // flip a content byte
+    ZipArchive archive(zip);
+    bool thrown = false;
+    try {
+        archive.read(archive.getEntries()[0]);
+    } catch (exception&) {
+        thrown = true;
+    }
+    assert(thrown && "CRC mismatch should be reported");
+
+    thrown = false;
+    try {
+        string text = "not a zip at all, just some text";
+        ZipArchive broken(text);
+    } catch (exception&) {
+        thrown = true;
+    }
+    assert(thrown && "Non-zip data should be rejected");
+}
+
+#endif
@@ -1,36 +1,25 @@
-
 // DEPENDENCY: curl
+// DEPENDENCY: z
 
-#include <stdlib.h>                           // for atof, atoll
 #include <iostream>                           // for basic_ostream, cout, endl
-#include <map>                                // for map
 #include <string>                             // for operator+, allocator
-#include <utility>                            // for pair
 #include <vector>                             // for vector
-#include "../../misc/Curl.hpp"               // for Curl
 #include "../../misc/ERROR.hpp"              // for ERROR
 #include "../../misc/EXTERN.hpp"             // for EXTERN_DEFAULT
-#include "../../misc/Logger.hpp"     // for createLogger
-#include "../../misc/safe.hpp"       // for safe
-#include "../../misc/datetime_to_sec.hpp"    // for datetime_to_sec
-#include "../../misc/execute.hpp"            // for execute
-#include "../../misc/explode.hpp"            // for explode
 #include "../../misc/file_exists.hpp"        // for file_exists
-#include "../../misc/file_get_contents.hpp"  // for file_get_contents
-#include "../../misc/file_put_contents.hpp"  // for file_put_contents
 #include "../../misc/mkdir.hpp"              // for mkdir
-#include "../../misc/remove.hpp"             // for remove
-#include "../../misc/replace_extension.hpp"  // for replace_extension
-#include "../../misc/str_contains.hpp"       // for str_contains
-#include "../../misc/str_replace.hpp"        // for str_replace
-#include "../../misc/trim.hpp"               // for trim
+#include "../../misc/Logger.hpp"     // for createLogger
 #include "../../misc/ConsoleLogger.hpp"
 #include "../Candle.hpp"                      // for Candle
 #include "../CandleHistory.hpp"               // for CandleHistory
+#include "../BinanceKlineDownloader.hpp"      // for BinanceKlineDownloader
+#include "../BinanceKlineManifest.hpp"        // for BinanceKlineManifest
+#include "../FetcherPool.hpp"                 // for FetcherPool
+#include "../FleetUpdater.hpp"                // for FleetUpdater
 
 using namespace std;
 
-class BinanceSpotCandleHistory: public CandleHistory {
+class BinanceSpotCandleHistory: public CandleHistory, public FleetCandleHistory {
 public:
     BinanceSpotCandleHistory(): CandleHistory() {
         createLogger<ConsoleLogger>();
@@ -42,72 +31,71 @@ public:
         return "binance/spot";
     }
 
+    string manifestFilename(const string& symbol, const string& interval) {
+        string folder = ".data/" + this->folder() + "/manifests";
+        if (!file_exists(folder) && !mkdir(folder, true))
+            throw ERROR("Unable to create folder: " + folder);
+        return folder + "/" + symbol + "-" + interval + ".manifest";
+    }
+
     void update(const string& symbol, const string& interval) override {
-        string url = "https://s3-ap-northeast-1.amazonaws.com/data.binance.vision?delimiter=/&prefix=data/spot/daily/klines/" + symbol + "/" + interval + "/";
-        Curl curl;
-        string result;
-        string marker;
-        vector<Candle> candles = load(symbol, interval);
-        Curl::StreamCallback cb = [&result](const string& chunk) {
-            result += chunk;
-        };
-        while (true) {
-            result = "";
-            if (!curl.GET(url + "&marker=" + marker, cb))
-                throw ERROR("Unable to GET: " + url + "&marker=" + marker);
-            const string start_mark = "<Contents><Key>";
-            const string end_mark = ".CHECKSUM</Key>";
-            vector<string> splits = explode(start_mark, result);        
-            for (const string& split: splits) {
-                if (!str_contains(split, end_mark)) continue;
-                string zip = explode(end_mark, split)[0];
-                string link = "https://data.binance.vision/" + zip;
-                string date = str_replace({
-                    { "data/spot/daily/klines/" + symbol + "/" + interval + "/" + symbol + "-" + interval + "-", "" },
-                    { ".zip", ""}
-                }, zip);
-                if (candles.empty() || datetime_to_sec(date) > candles[candles.size() - 1].getTime()) {
-                    cout << link << endl;
-                    // download zip file
-                    string result_safe = result;
-                    result = "";
-                    if (!curl.GET(link, cb))
-                        throw ERROR("Unable to GET: " + link);
-                    const string tempdir = ".data/binance/temp";
-                    if (!file_exists(tempdir) && !mkdir(tempdir, true))
-                        throw ERROR("Unable to create folder: " + tempdir);
-                    const string zipf = tempdir + "/" + symbol + "-" + interval + "-" + date + ".zip";
-                    file_put_contents(zipf, result, false, true);
-                    execute("unzip -o " + zipf + " -d " + tempdir, true);
-                    remove(zipf, true);
-                    // parse csv
-                    string csvf = replace_extension(zipf, ".csv");
-                    string csv = file_get_contents(csvf);
-                    vector<string> lines = explode("\n", csv);
-                    for (const string& line: lines) {
-                        if (trim(line).empty()) continue;
-                        vector<string> cols = explode(",", trim(line));
-                        Candle candle;
-                        candle.setTime(atoll(cols[0].substr(0, 10).c_str()));
-                        candle.setOpen(atof(cols[1].c_str()));
-                        candle.setHigh(atof(cols[2].c_str()));
-                        candle.setLow(atof(cols[3].c_str()));
-                        candle.setClose(atof(cols[4].c_str()));
-                        candle.setVolume(atof(cols[5].c_str()));
-                        candles.push_back(candle);
-                    }
-                    remove(csvf, true);
-                    result = result_safe;
-                }
-            }
-            if (!str_contains(result, "<IsTruncated>true</IsTruncated>")) break;
-            splits = explode("<NextMarker>", result);
-            if (splits.empty()) break;
-            splits = explode("</NextMarker>", splits[1]);
-            if (splits.empty()) break;
-            marker = splits[0];
+        sync(symbol, storedInterval(interval), BinanceKlineDownloader::curlFetchers(),
+            [](const BinanceKlineDownloader::Archive& archive, const BinanceKlineDownloader::Day&) {
+                cout << "https://data.binance.vision/" << archive.key << endl;
+            });
+    }
+
+    // All pairs share one pool of keep-alive connections, rate limited per host.
+    vector<FleetUpdater::Report> updateAll(
+        const vector<FleetUpdater::Pair>& pairs,
+        const FleetUpdater::Settings& settings = FleetUpdater::Settings(),
+        FleetUpdater::OnProgress onProgress = nullptr
+    ) override {
+        const vector<FleetUpdater::Pair> stored = FleetUpdater::storedPairs(*this, pairs);
+        for (const FleetUpdater::Pair& pair: stored) { // create the folders before the threads do
+            filename(pair.symbol, pair.interval);
+            manifestFilename(pair.symbol, pair.interval);
         }
-        save(candles, symbol, interval);
+        FetcherPool pool(BinanceKlineDownloader::curlFetchers(), settings.connections, settings.rate);
+        FleetUpdater fleet(pool, settings.parallel);
+        return fleet.run(stored, [this, &settings](const FleetUpdater::Pair& pair, FetcherPool::FetcherFactory fetchers) {
+            return sync(pair.symbol, pair.interval, fetchers, nullptr, settings.workers);
+        }, onProgress);
+    }
+
+    // Appends the new candles after the stored ones, downloading `workers`
+    // archives at once, returns their number.
+    size_t sync(
+        const string& symbol, const string& interval,
+        BinanceKlineDownloader::FetcherFactory fetchers,
+        BinanceKlineDownloader::OnArchive onArchive = nullptr,
+        size_t workers = FleetUpdater::Settings().workers
+    ) {
+        BinanceKlineDownloader downloader(workers, fetchers);
+        BinanceKlineManifest manifest(manifestFilename(symbol, interval));
+        vector<Candle> candles = downloader.sync(
+            symbol, interval, lastTime(symbol, interval), manifest, onArchive);
+        append(candles, symbol, interval);
+        manifest.save();
+        return candles.size();
+    }
+
+    void repair(const string& symbol, const string& requested) override {
+        const string interval = storedInterval(requested);
+        BinanceKlineDownloader downloader;
+        BinanceKlineManifest manifest(manifestFilename(symbol, interval));
+        // only the days whose published checksum changed or failed are fetched again
+        vector<pair<time_sec, time_sec>> days;
+        vector<Candle> candles = downloader.repair(
+            symbol, interval, manifest,
+            [&days](const BinanceKlineDownloader::Archive& archive, const BinanceKlineDownloader::Day&) {
+                cout << "repair: https://data.binance.vision/" << archive.key << endl;
+                days.push_back({ archive.time, archive.time + BinanceKlineDownloader::DAY - 1 });
+            });
+        // a re-fetched day replaces the whole stored day, even with fewer candles
+        replace(candles, symbol, interval, days);
+        manifest.save();
+        update(symbol, interval);
     }
 };
 
@@ -9,10 +9,16 @@ public:
 
     virtual void onStart(const Candle&) override {}
 
+    virtual void reset() override {
+        buyPrice = 0;
+        i = 0;
+    }
+
+    virtual Strategy* clone() const override {
+        return new Strategy1(*this);
+    }
+
     virtual void onCandleClose(const Candle& candle) override {
-        const int TBUY = 10;
-        const int TSELL = 20;
-        const int TREPEAT = 30;
         const float BUYPC = 20;
         const float SELLPC = 2;
         float price = candle.getClose();        
@@ -33,6 +39,18 @@ public:
         if (i == TREPEAT) i = 0;
     }
 
+    // Only the counter moves between trades: skip to the candle before the next one.
+    virtual size_t onCandleBatch(span<const Candle> candles) override {
+        const int next = i < TBUY ? TBUY : i < TSELL ? TSELL : TREPEAT + TBUY;
+        const size_t quiet = min<size_t>(candles.size(), next - i - 1);
+        i = (i + quiet) % TREPEAT;
+        return quiet;
+    }
+
+    static const int TBUY = 10;
+    static const int TSELL = 20;
+    static const int TREPEAT = 30;
+
     int buyPrice = 0;
     int i = 0;
 };
@@ -0,0 +1,102 @@
+// Allocation checks of the hot paths. Counting needs the global allocation
+// functions replaced, which affects the whole binary it is linked into, so
+// they are a test program of their own instead of a header TEST block:
+//   g++ -std=c++20 -O2 tests/allocations.cpp -o allocations && ./allocations
+
+#include <new>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+
+#include "../BacktestRunner.hpp"
+
+using namespace std;
+
+// Every form of operator new is counted.
+static atomic<size_t> allocations = 0;
+
+static void* allocate(size_t size) {
+    allocations++;
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+static void* allocate(size_t size, align_val_t align) {
+    allocations++;
+    size_t alignment = (size_t)align;
+    if (void* p = aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)) return p;
+    throw bad_alloc();
+}
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void* operator new(size_t size, align_val_t align) { return allocate(size, align); }
+void* operator new[](size_t size, align_val_t align) { return allocate(size, align); }
+void* operator new(size_t size, const nothrow_t&) noexcept { try { return allocate(size); } catch (...) { return nullptr; } }
+void* operator new[](size_t size, const nothrow_t&) noexcept { try { return allocate(size); } catch (...) { return nullptr; } }
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, align_val_t) noexcept { free(p); }
+void operator delete[](void* p, align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { free(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { free(p); }
+
+// Allocations while it is in scope.
+class AllocationCounter {
+public:
+    AllocationCounter(): before(allocations) {}
+    size_t count() const { return allocations - before; }
+private:
+    size_t before;
+};
+
+// Neither trades nor batches: every candle takes the per-candle path.
+class QuietStrategy: public Strategy {
+public:
+    size_t closes = 0;
+    void onStart(const Candle&) override {}
+    void onCandleClose(const Candle&) override { closes++; }
+};
+
+class QuietExchange: public TestExchange {
+public:
+    QuietExchange(): TestExchange(false, false, false) {
+        setBalance(1000);
+    }
+};
+
+void test_BacktestRunner_loop_does_not_allocate() {
+    vector<Candle> candles;
+    for (int i = 0; i < 100000; i++) candles.push_back(Candle(i, 10, 11, 9, 10, 1));
+    QuietStrategy strategy;
+    QuietExchange exchange;
+    BacktestRunner runner(strategy, exchange);
+
+    AllocationCounter counter;
+    runner.run(candles);
+    assert(counter.count() == 0 && "The hot loop should not allocate");
+    assert(strategy.closes == 99999 && runner.getStats().candles == 99999 && "Stats should count the candles");
+}
+
+void test_TestExchange_orders_do_not_allocate() {
+    QuietExchange exchange; // rejections are not reported
+    exchange.setPrice(10);
+    (void)exchange.buyLimit(100, 9); // the order book's pool gets its first chunk
+    exchange.cancelAllOrders();
+    AllocationCounter counter;
+    OrderResult rejected = exchange.buy(5000);
+    OrderResult accepted = exchange.buyLimit(100, 9);
+    OrderResult invalid = exchange.sell(-1);
+    assert(counter.count() == 0 && "Placing and rejecting orders should not allocate");
+    assert(!rejected && accepted && !invalid);
+}
+
+int main() {
+    test_BacktestRunner_loop_does_not_allocate();
+    test_TestExchange_orders_do_not_allocate();
+    cout << "allocations: 2 tests passed" << endl;
+}